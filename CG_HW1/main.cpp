@@ -14,6 +14,20 @@
 //
 #include <unordered_map>
 #include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#if defined(__AVX__)
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+#endif
 
 #ifndef max
 # define max(a,b) (((a)>(b))?(a):(b))
@@ -25,6 +39,8 @@ using namespace std;
 // Default window size
 const int WINDOW_WIDTH = 800;
 const int WINDOW_HEIGHT = 600;
+// current window size
+int screenHeight = WINDOW_HEIGHT;
 
 bool mouse_pressed = false;
 int starting_press_x = -1;
@@ -80,6 +96,13 @@ TransMode cur_trans_mode = GeoTranslation;
 Matrix4 view_matrix;
 Matrix4 project_matrix;
 
+// A level of detail of a model: `index_count` indices from `first_index` on. `error` is how far the
+// surface moved, in normalized model units.
+struct MeshLod
+{
+	uint32_t first_index, index_count;
+	float error;
+};
 
 typedef struct
 {
@@ -92,7 +115,9 @@ typedef struct
 	GLuint p_normal;
 	int materialId;
 	int indexCount;
+	GLenum indexType;
 	GLuint m_texture;
+	vector<MeshLod> lods;	// see BuildLods(), indexCount is the one of level 0
 } Shape;
 Shape quad;
 Shape m_shpae;
@@ -357,6 +382,7 @@ void ChangeSize(GLFWwindow* window, int width, int height)
 	// [TODO] change your aspect ratio
     if (width == 0 || height == 0)
             return;
+    screenHeight = height;
 
     // Update aspect ratio
     proj.aspect = static_cast<float>(width) / height;
@@ -468,6 +494,9 @@ void drawPlane()
 
 bool is_solid = false;
 
+static float ModelPixelsPerUnit(const model& m);
+static const MeshLod* SelectLod(const Shape& shape, float pixels_per_unit);
+
 // Render function for display rendering
 void RenderScene(void) {	
 	// clear canvas
@@ -513,8 +542,13 @@ void RenderScene(void) {
     
 	// use uniform to send mvp to vertex shader
 	glUniformMatrix4fv(iLocMVP, 1, GL_FALSE, mvp);
-	glBindVertexArray(m_shape_list[cur_idx].vao);
-	glDrawArrays(GL_TRIANGLES, 0, m_shape_list[cur_idx].vertex_count);
+	const Shape& shape = m_shape_list[cur_idx];
+	glBindVertexArray(shape.vao);
+	const MeshLod* lod = SelectLod(shape, ModelPixelsPerUnit(models.at(cur_idx)));
+	if (lod)
+		glDrawElements(GL_TRIANGLES, lod->index_count, shape.indexType, (GLvoid*)(lod->first_index * (shape.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint))));
+	else
+		glDrawElements(GL_TRIANGLES, shape.indexCount, shape.indexType, 0);
 	drawPlane();
 
 }
@@ -729,135 +763,463 @@ void setShaders()
     }
 }
 
-void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, tinyobj::shape_t* shape)
+// Face corners with the same (vertex, normal, texcoord) indices share one vertex.
+struct IndexHash
 {
-	vector<float> xVector, yVector, zVector;
-	float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
+	size_t operator()(const tinyobj::index_t& idx) const
+	{
+		return (size_t)idx.vertex_index * 73856093u ^ (size_t)idx.normal_index * 19349663u ^ (size_t)idx.texcoord_index * 83492791u;
+	}
+};
 
-	// find out min and max value of X, Y and Z axis
-	for (int i = 0; i < attrib->vertices.size(); i++)
+struct IndexEqual
+{
+	bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const
+	{
+		return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+	}
+};
+
+//* Position kernels *//
+// Used by normalization() on the interleaved xyz positions of a model. The SIMD loops read W vertices
+// (W = 8 with AVX, 4 with SSE2) as 3 registers, so float j of such a block always holds axis j % 3.
+// Results match the scalar loops.
+#if defined(__AVX__)
+typedef __m256 PosVec;
+const size_t POS_VEC_WIDTH = 8;
+# define POSITIONS_SIMD "AVX"
+# define PosLoad _mm256_loadu_ps
+# define PosStore _mm256_storeu_ps
+# define PosSet1 _mm256_set1_ps
+# define PosMin _mm256_min_ps
+# define PosMax _mm256_max_ps
+# define PosSub _mm256_sub_ps
+# define PosDiv _mm256_div_ps
+#elif defined(__SSE2__) || defined(_M_X64)
+typedef __m128 PosVec;
+const size_t POS_VEC_WIDTH = 4;
+# define POSITIONS_SIMD "SSE2"
+# define PosLoad _mm_loadu_ps
+# define PosStore _mm_storeu_ps
+# define PosSet1 _mm_set1_ps
+# define PosMin _mm_min_ps
+# define PosMax _mm_max_ps
+# define PosSub _mm_sub_ps
+# define PosDiv _mm_div_ps
+#endif
+
+static void PositionBoundsScalar(const GLfloat* positions, size_t first, size_t count, float minPos[3], float maxPos[3])
+{
+	for (size_t i = first; i < count; i++)
 	{
-		//maxs = max(maxs, attrib->vertices.at(i));
-		if (i % 3 == 0)
+		for (int k = 0; k < 3; k++)
 		{
+			minPos[k] = min(minPos[k], positions[3 * i + k]);
+			maxPos[k] = max(maxPos[k], positions[3 * i + k]);
+		}
+	}
+}
 
-			xVector.push_back(attrib->vertices.at(i));
+static void RecenterAndScaleScalar(GLfloat* positions, size_t first, size_t count, const float offset[3], float scale)
+{
+	for (size_t i = first; i < count; i++)
+	{
+		for (int k = 0; k < 3; k++)
+			positions[3 * i + k] = (positions[3 * i + k] - offset[k]) / scale;
+	}
+}
 
-			if (attrib->vertices.at(i) < minX)
+// Grows minPos/maxPos to contain `count` xyz positions.
+void PositionBounds(const GLfloat* positions, size_t count, float minPos[3], float maxPos[3])
+{
+	size_t i = 0;
+#ifdef POSITIONS_SIMD
+	if (count >= POS_VEC_WIDTH)
+	{
+		PosVec lo[3], hi[3];
+		for (int k = 0; k < 3; k++)
+			lo[k] = hi[k] = PosLoad(positions + k * POS_VEC_WIDTH);
+		for (; i + POS_VEC_WIDTH <= count; i += POS_VEC_WIDTH)
+		{
+			const GLfloat* block = positions + 3 * i;
+			for (int k = 0; k < 3; k++)
 			{
-				minX = attrib->vertices.at(i);
+				PosVec v = PosLoad(block + k * POS_VEC_WIDTH);
+				lo[k] = PosMin(lo[k], v);
+				hi[k] = PosMax(hi[k], v);
 			}
+		}
 
-			if (attrib->vertices.at(i) > maxX)
-			{
-				maxX = attrib->vertices.at(i);
-			}
+		float lanes[2][3 * POS_VEC_WIDTH];
+		for (int k = 0; k < 3; k++)
+		{
+			PosStore(lanes[0] + k * POS_VEC_WIDTH, lo[k]);
+			PosStore(lanes[1] + k * POS_VEC_WIDTH, hi[k]);
 		}
-		else if (i % 3 == 1)
+		for (size_t j = 0; j < 3 * POS_VEC_WIDTH; j++)
 		{
-			yVector.push_back(attrib->vertices.at(i));
+			minPos[j % 3] = min(minPos[j % 3], lanes[0][j]);
+			maxPos[j % 3] = max(maxPos[j % 3], lanes[1][j]);
+		}
+	}
+#endif
+	PositionBoundsScalar(positions, i, count, minPos, maxPos);
+}
 
-			if (attrib->vertices.at(i) < minY)
-			{
-				minY = attrib->vertices.at(i);
-			}
+// positions = (positions - offset) / scale for `count` xyz positions, in place.
+void RecenterAndScale(GLfloat* positions, size_t count, const float offset[3], float scale)
+{
+	size_t i = 0;
+#ifdef POSITIONS_SIMD
+	float pattern[3 * POS_VEC_WIDTH];
+	for (size_t j = 0; j < 3 * POS_VEC_WIDTH; j++)
+		pattern[j] = offset[j % 3];
+	PosVec off[3];
+	for (int k = 0; k < 3; k++)
+		off[k] = PosLoad(pattern + k * POS_VEC_WIDTH);
+	PosVec s = PosSet1(scale);
+
+	for (; i + POS_VEC_WIDTH <= count; i += POS_VEC_WIDTH)
+	{
+		GLfloat* block = positions + 3 * i;
+		for (int k = 0; k < 3; k++)
+			PosStore(block + k * POS_VEC_WIDTH, PosDiv(PosSub(PosLoad(block + k * POS_VEC_WIDTH), off[k]), s));
+	}
+#endif
+	RecenterAndScaleScalar(positions, i, count, offset, scale);
+}
+
+// Centers the bounding box of the whole model and scales its longest axis to [-1, 1]. Done once per
+// model, shapes share attrib->vertices and are indexed by IndexShape() afterwards.
+void normalization(tinyobj::attrib_t* attrib)
+{
+	vector<GLfloat>& positions = attrib->vertices;
+	float minPos[3] = { 10000, 10000, 10000 }, maxPos[3] = { -10000, -10000, -10000 };
+
+	// find out min and max value of X, Y and Z axis
+	PositionBounds(positions.data(), positions.size() / 3, minPos, maxPos);
+
+	float offset[3];
+	float greatestAxis = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		offset[k] = (maxPos[k] + minPos[k]) / 2;
+		greatestAxis = max(greatestAxis, maxPos[k] - minPos[k]);
+	}
+	float scale = greatestAxis / 2;
+	RecenterAndScale(positions.data(), positions.size() / 3, offset, scale);
+}
+
+// Appends the vertices and indices of one shape of a normalized model.
+void IndexShape(const tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLuint>& indices, const tinyobj::shape_t* shape)
+{
+	unordered_map<tinyobj::index_t, GLuint, IndexHash, IndexEqual> vertex_ids;
+	vertex_ids.reserve(shape->mesh.indices.size());
+	indices.reserve(shape->mesh.indices.size());
+	for (size_t i = 0; i < shape->mesh.indices.size(); i++) {
+		tinyobj::index_t idx = shape->mesh.indices[i];
+		auto found = vertex_ids.insert(make_pair(idx, (GLuint)(vertices.size() / 3)));
+		if (found.second) {
+			// first use of this vertex
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 0]);
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 1]);
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 2]);
+			// Optional: vertex colors
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 0]);
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 1]);
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 2]);
+		}
+		indices.push_back(found.first->second);
+	}
+}
+
+// Uploads `indices` to the element buffer of the bound VAO, 16 bit when `vertex_count` allows it.
+void CreateIndexBuffer(Shape* shape, const vector<GLuint>& indices, int vertex_count)
+{
+	glGenBuffers(1, &shape->ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shape->ebo);
+	if (vertex_count <= 65536)
+	{
+		vector<GLushort> shortIndices(indices.begin(), indices.end());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(GLushort), shortIndices.data(), GL_STATIC_DRAW);
+		shape->indexType = GL_UNSIGNED_SHORT;
+	}
+	else
+	{
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		shape->indexType = GL_UNSIGNED_INT;
+	}
+	shape->indexCount = indices.size();
+}
+
+//* Level of detail *//
+// Every model gets up to LOD_COUNT - 1 simplified index lists after its own, made with quadric error
+// metrics(Garland and Heckbert 1997). Edges collapse into one of their vertices, so all levels share
+// the vertex buffer. Vertices on a border of the index buffer never move. RenderScene() draws the
+// coarsest level whose error projects to at most lodPixelError pixels.
+bool buildLods = true;
+const int LOD_COUNT = 4;
+float lodPixelError = 1.0f;
+// collapses moving the surface further than this(in normalized model units) are not done
+const float LOD_MAX_ERROR = 0.05f;
+
+// Sum of the squared distances to a set of planes, weighted by triangle area.
+struct Quadric
+{
+	double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0, w = 0;
 
-			if (attrib->vertices.at(i) > maxY)
+	void AddPlane(double a, double b, double c, double d, double weight)
+	{
+		a2 += weight * a * a; ab += weight * a * b; ac += weight * a * c; ad += weight * a * d;
+		b2 += weight * b * b; bc += weight * b * c; bd += weight * b * d;
+		c2 += weight * c * c; cd += weight * c * d;
+		d2 += weight * d * d;
+		w += weight;
+	}
+
+	void Add(const Quadric& q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+		w += q.w;
+	}
+
+	// mean squared distance of `p` to the planes
+	double Error(const GLfloat* p) const
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x + b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+				   c2 * z * z + 2 * cd * z + d2;
+		return w > 0 ? max(e, 0.0) / w : 0;
+	}
+};
+
+static void TriangleNormal(const GLfloat* p0, const GLfloat* p1, const GLfloat* p2, double n[3])
+{
+	double u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	double v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	n[0] = u[1] * v[2] - u[2] * v[1];
+	n[1] = u[2] * v[0] - u[0] * v[2];
+	n[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+// True if moving `from` onto `to` turns one of the triangles `tris` around `from` over.
+static bool CollapseFlips(const GLfloat* positions, const vector<GLuint>& indices, const GLuint* tris, size_t tri_count, GLuint from, GLuint to)
+{
+	for (size_t i = 0; i < tri_count; i++)
+	{
+		const GLuint* t = &indices[tris[i] * 3];
+		int k = t[0] == from ? 0 : t[1] == from ? 1 : 2;
+		GLuint b = t[(k + 1) % 3], c = t[(k + 2) % 3];
+		// the triangles on the collapsed edge go away
+		if (b == to || c == to)
+			continue;
+		double before[3], after[3];
+		TriangleNormal(&positions[from * 3], &positions[b * 3], &positions[c * 3], before);
+		TriangleNormal(&positions[to * 3], &positions[b * 3], &positions[c * 3], after);
+		if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0)
+			return true;
+	}
+	return false;
+}
+
+// Collapses edges of `indices` until at most `target` indices are left or every collapse costs more
+// than LOD_MAX_ERROR. Returns the largest squared error of a collapse done.
+static double SimplifyMesh(const GLfloat* positions, vector<Quadric>& quadrics, const vector<char>& locked, vector<GLuint>& indices, size_t target)
+{
+	struct Collapse
+	{
+		GLuint from, to;
+		double error;
+		bool operator<(const Collapse& rhs) const { return error < rhs.error; }
+	};
+
+	size_t vertex_count = quadrics.size();
+	double maxError = 0;
+	vector<GLuint> firstTri, tris, remap(vertex_count);
+	vector<char> touched(vertex_count);
+	vector<Collapse> collapses;
+	while (indices.size() > target)
+	{
+		// triangles around every vertex
+		firstTri.assign(vertex_count + 1, 0);
+		for (GLuint v : indices)
+			firstTri[v + 1]++;
+		for (size_t v = 0; v < vertex_count; v++)
+			firstTri[v + 1] += firstTri[v];
+		tris.resize(indices.size());
+		vector<GLuint> next(firstTri.begin(), firstTri.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			tris[next[indices[i]]++] = i / 3;
+
+		// both directions of every edge, cheapest first
+		collapses.clear();
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			GLuint a = indices[i], b = indices[i - i % 3 + (i + 1) % 3];
+			if (!locked[a])
 			{
-				maxY = attrib->vertices.at(i);
+				Quadric q = quadrics[a];
+				q.Add(quadrics[b]);
+				collapses.push_back({ a, b, q.Error(&positions[b * 3]) });
 			}
 		}
-		else if (i % 3 == 2)
+		sort(collapses.begin(), collapses.end());
+
+		// collapses of one pass do not share a triangle, every one removes about two of them
+		for (size_t v = 0; v < vertex_count; v++)
+			remap[v] = v;
+		touched.assign(vertex_count, 0);
+		size_t removable = (indices.size() - target) / 3, removed = 0;
+		for (const Collapse& c : collapses)
 		{
-			zVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minZ)
+			if (removed >= removable || c.error > LOD_MAX_ERROR * LOD_MAX_ERROR)
+				break;
+			if (touched[c.from] || touched[c.to])
+				continue;
+			const GLuint* around = &tris[firstTri[c.from]];
+			size_t around_count = firstTri[c.from + 1] - firstTri[c.from];
+			if (CollapseFlips(positions, indices, around, around_count, c.from, c.to))
+				continue;
+
+			remap[c.from] = c.to;
+			quadrics[c.to].Add(quadrics[c.from]);
+			for (size_t i = 0; i < around_count; i++)
 			{
-				minZ = attrib->vertices.at(i);
+				for (int k = 0; k < 3; k++)
+					touched[indices[around[i] * 3 + k]] = 1;
 			}
+			maxError = max(maxError, c.error);
+			removed += 2;
+		}
+		if (removed == 0)
+			break;
 
-			if (attrib->vertices.at(i) > maxZ)
-			{
-				maxZ = attrib->vertices.at(i);
-			}
+		size_t kept = 0;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			GLuint a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			indices[kept++] = a;
+			indices[kept++] = b;
+			indices[kept++] = c;
 		}
+		indices.resize(kept);
 	}
+	return maxError;
+}
 
-	float offsetX = (maxX + minX) / 2;
-	float offsetY = (maxY + minY) / 2;
-	float offsetZ = (maxZ + minZ) / 2;
-
-	for (int i = 0; i < attrib->vertices.size(); i++)
+// Appends the simplified levels of a model to its `indices` and describes all levels in `lods`,
+// level 0 being the model itself. `positions` are the xyz of its vertices.
+void BuildLods(const GLfloat* positions, size_t vertex_count, vector<GLuint>& indices, vector<MeshLod>* lods)
+{
+	lods->assign(1, MeshLod{ 0, (uint32_t)indices.size(), 0 });
+	// not worth it for a few triangles
+	if (!buildLods || indices.size() < 3 * 256)
+		return;
+
+	vector<Quadric> quadrics(vertex_count);
+	unordered_map<uint64_t, int> edges;
+	for (size_t i = 0; i < indices.size(); i += 3)
 	{
-		if (offsetX != 0 && i % 3 == 0)
+		const GLuint* t = &indices[i];
+		double n[3];
+		TriangleNormal(&positions[t[0] * 3], &positions[t[1] * 3], &positions[t[2] * 3], n);
+		double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length > 0)
 		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
+			const GLfloat* p = &positions[t[0] * 3];
+			double a = n[0] / length, b = n[1] / length, c = n[2] / length;
+			for (int k = 0; k < 3; k++)
+				quadrics[t[k]].AddPlane(a, b, c, -(a * p[0] + b * p[1] + c * p[2]), length / 2);
 		}
-		else if (offsetY != 0 && i % 3 == 1)
+		for (int k = 0; k < 3; k++)
 		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
+			GLuint a = min(t[k], t[(k + 1) % 3]), b = max(t[k], t[(k + 1) % 3]);
+			edges[(uint64_t)a << 32 | b]++;
 		}
-		else if (offsetZ != 0 && i % 3 == 2)
+	}
+	// an edge of one triangle(or of more than two) is a border
+	vector<char> locked(vertex_count, 0);
+	for (const auto& edge : edges)
+	{
+		if (edge.second != 2)
 		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+			locked[edge.first >> 32] = 1;
+			locked[edge.first & 0xffffffff] = 1;
 		}
 	}
 
-	float greatestAxis = maxX - minX;
-	float distanceOfYAxis = maxY - minY;
-	float distanceOfZAxis = maxZ - minZ;
-
-	if (distanceOfYAxis > greatestAxis)
+	vector<GLuint> level(indices);
+	double error = 0;
+	for (int i = 1; i < LOD_COUNT; i++)
 	{
-		greatestAxis = distanceOfYAxis;
+		size_t previous = lods->back().index_count;
+		double levelError = SimplifyMesh(positions, quadrics, locked, level, lods->front().index_count >> i);
+		error = max(error, levelError);
+		// stop once a level would save less than a fifth of the previous one
+		if (level.size() > previous * 4 / 5)
+			break;
+		lods->push_back({ (uint32_t)indices.size(), (uint32_t)level.size(), (float)sqrt(error) });
+		indices.insert(indices.end(), level.begin(), level.end());
 	}
+}
 
-	if (distanceOfZAxis > greatestAxis)
+// Screen pixels per normalized model unit at the near side of the bounding sphere of `m`, which
+// has radius sqrt(3) after normalization().
+static float ModelPixelsPerUnit(const model& m)
+{
+	float scale = max(fabs(m.scale.x), max(fabs(m.scale.y), fabs(m.scale.z)));
+	float pixels = project_matrix[5] * screenHeight / 2 * scale;
+	if (cur_proj_mode == Perspective)
 	{
-		greatestAxis = distanceOfZAxis;
+		Vector3 forward = main_camera.center - main_camera.position;
+		forward.normalize();
+		float distance = (m.position - main_camera.position).dot(forward) - sqrtf(3.0f) * scale;
+		// the camera is inside the bounding sphere
+		if (distance <= proj.nearClip)
+			return FLT_MAX;
+		pixels /= distance;
 	}
+	return pixels;
+}
 
-	float scale = greatestAxis / 2;
-
-	for (int i = 0; i < attrib->vertices.size(); i++)
+// The coarsest level of `shape` moving the surface at most lodPixelError pixels on screen, NULL if
+// it has none.
+static const MeshLod* SelectLod(const Shape& shape, float pixels_per_unit)
+{
+	const MeshLod* lod = NULL;
+	for (const MeshLod& level : shape.lods)
 	{
-		//std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
-		attrib->vertices.at(i) = attrib->vertices.at(i)/ scale;
-	}
-	size_t index_offset = 0;
-	vertices.reserve(shape->mesh.num_face_vertices.size() * 3);
-	colors.reserve(shape->mesh.num_face_vertices.size() * 3);
-	for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++) {
-		int fv = shape->mesh.num_face_vertices[f];
-
-		// Loop over vertices in the face.
-		for (size_t v = 0; v < fv; v++) {
-			// access to vertex
-			tinyobj::index_t idx = shape->mesh.indices[index_offset + v];
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 0]);
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 1]);
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 2]);
-			// Optional: vertex colors
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 0]);
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 1]);
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 2]);
-		}
-		index_offset += fv;
+		if (level.error * pixels_per_unit <= lodPixelError)
+			lod = &level;
 	}
+	return lod;
 }
+//* Level of detail *//
 
-void LoadModels(string model_path)
+// A model prepared on a loader thread, uploaded by UploadModel().
+struct PendingModel
+{
+	vector<GLfloat> vertices;
+	vector<GLfloat> colors;
+	vector<GLuint> indices;	// all levels of detail
+	vector<MeshLod> lods;
+	// the .obj did not load, UploadModel() exits: exit() on a loader thread would join it from the pool's destructor
+	bool failed = false;
+};
+
+// CPU side of loading a model, no GL calls: safe on a loader thread.
+PendingModel PrepareModel(string model_path)
 {
 	vector<tinyobj::shape_t> shapes;
 	vector<tinyobj::material_t> materials;
 	tinyobj::attrib_t attrib;
-	vector<GLfloat> vertices;
-	vector<GLfloat> colors;
 
 	string err;
 	string warn;
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str());
+	bool ret = tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &warn, &err, model_path.c_str());
 
 	if (!warn.empty()) {
 		cout << warn << std::endl;
@@ -867,13 +1229,73 @@ void LoadModels(string model_path)
 		cerr << err << std::endl;
 	}
 
+	PendingModel pending;
 	if (!ret) {
-		exit(1);
+		pending.failed = true;
+		return pending;
 	}
 
 	printf("Load Models Success ! Shapes size %d Maerial size %d\n", shapes.size(), materials.size());
 	
-	normalization(&attrib, vertices, colors, &shapes[0]);
+	normalization(&attrib);
+	IndexShape(&attrib, pending.vertices, pending.colors, pending.indices, &shapes[0]);
+	printf("Indexed %d face corners into %d vertices\n", int(pending.indices.size()), int(pending.vertices.size() / 3));
+	BuildLods(pending.vertices.data(), pending.vertices.size() / 3, pending.indices, &pending.lods);
+	printf("Level of detail %s: %d", model_path.c_str(), (int)pending.lods[0].index_count / 3);
+	for (size_t i = 1; i < pending.lods.size(); i++)
+		printf(" -> %d", (int)pending.lods[i].index_count / 3);
+	printf(" triangles\n");
+	return pending;
+}
+
+//* Vertex quantization *//
+// 12 bytes per vertex instead of 24: positions are in [-1, 1] after normalization() and stored as
+// 16 bit SNORM(padded to 4 components), colors as RGBA8. The shaders read them unchanged.
+// UploadModel() prints the error of every model.
+bool quantizeVertices = false;
+
+// Largest differences between the float vertices and their quantized values.
+struct QuantizationError
+{
+	double position = 0, color = 0;
+};
+
+// The decoded value is c / 32767 on GL 4.2 and later, older drivers are off by less than one more step.
+static vector<GLshort> QuantizePositions(const vector<GLfloat>& vertices, QuantizationError* error)
+{
+	vector<GLshort> res(vertices.size() / 3 * 4, 0);
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		float v = min(max(vertices[i], -1.0f), 1.0f);
+		GLshort c = (GLshort)floorf(v * 32767 + 0.5f);
+		res[i / 3 * 4 + i % 3] = c;
+		error->position = max(error->position, fabs(c / 32767.0 - vertices[i]));
+	}
+	return res;
+}
+
+static vector<GLubyte> QuantizeColors(const vector<GLfloat>& colors, QuantizationError* error)
+{
+	vector<GLubyte> res(colors.size() / 3 * 4, 255);
+	for (size_t i = 0; i < colors.size(); i++)
+	{
+		float v = min(max(colors[i], 0.0f), 1.0f);
+		GLubyte c = (GLubyte)floorf(v * 255 + 0.5f);
+		res[i / 3 * 4 + i % 3] = c;
+		error->color = max(error->color, fabs(c / 255.0 - colors[i]));
+	}
+	return res;
+}
+//* Vertex quantization *//
+
+// GL side of loading a model, on the context thread.
+void UploadModel(const PendingModel& pending)
+{
+	if (pending.failed)
+		exit(1);
+
+	const vector<GLfloat>& vertices = pending.vertices;
+	const vector<GLfloat>& colors = pending.colors;
 
 	Shape tmp_shape;
 	glGenVertexArrays(1, &tmp_shape.vao);
@@ -881,14 +1303,35 @@ void LoadModels(string model_path)
 
 	glGenBuffers(1, &tmp_shape.vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GL_FLOAT), &vertices.at(0), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 	tmp_shape.vertex_count = vertices.size() / 3;
+	if (quantizeVertices)
+	{
+		QuantizationError error;
+		vector<GLshort> positions = QuantizePositions(vertices, &error);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(GLshort), positions.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, 4 * sizeof(GLshort), 0);
+
+		vector<GLubyte> packed_colors = QuantizeColors(colors, &error);
+		glGenBuffers(1, &tmp_shape.p_color);
+		glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
+		glBufferData(GL_ARRAY_BUFFER, packed_colors.size(), packed_colors.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+		printf("Quantized %d vertices, max error position %.2g, color %.2g\n", tmp_shape.vertex_count, error.position, error.color);
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GL_FLOAT), &vertices.at(0), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glGenBuffers(1, &tmp_shape.p_color);
+		glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
+		glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GL_FLOAT), &colors.at(0), GL_STATIC_DRAW);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	}
 
-	glGenBuffers(1, &tmp_shape.p_color);
-	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
-	glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GL_FLOAT), &colors.at(0), GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	CreateIndexBuffer(&tmp_shape, pending.indices, tmp_shape.vertex_count);
+	tmp_shape.lods = pending.lods;
+	tmp_shape.indexCount = pending.lods[0].index_count;
 
 	m_shape_list.push_back(tmp_shape);
 	model tmp_model;
@@ -897,10 +1340,94 @@ void LoadModels(string model_path)
 
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
+}
+
+void LoadModels(string model_path)
+{
+	UploadModel(PrepareModel(model_path));
+}
+
+//* Loader threads *//
+// setupRC() prepares all models at once on a pool of threads and uploads each one as soon as it
+// and the ones before it are ready, so the startup time no longer sums over the models.
+bool parallelModelLoading = true;
+
+class LoaderPool
+{
+public:
+	explicit LoaderPool(unsigned thread_count)
+	{
+		for (unsigned i = 0; i < thread_count; i++)
+			threads.push_back(thread(&LoaderPool::Run, this));
+	}
+
+	~LoaderPool()
+	{
+		{
+			lock_guard<mutex> lock(m);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (thread& t : threads)
+			t.join();
+	}
+
+	template <typename F>
+	future<typename result_of<F()>::type> Submit(F f)
+	{
+		typedef typename result_of<F()>::type R;
+		shared_ptr<packaged_task<R()>> task = make_shared<packaged_task<R()>>(f);
+		future<R> res = task->get_future();
+		{
+			lock_guard<mutex> lock(m);
+			tasks.push_back([task]() { (*task)(); });
+		}
+		wake.notify_one();
+		return res;
+	}
+
+private:
+	void Run()
+	{
+		for (;;)
+		{
+			function<void()> task;
+			{
+				unique_lock<mutex> lock(m);
+				wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty())
+					return;
+				task = move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	vector<thread> threads;
+	deque<function<void()>> tasks;
+	mutex m;
+	condition_variable wake;
+	bool stopping = false;
+};
+
+LoaderPool& GetLoaderPool()
+{
+	static LoaderPool pool(max(1u, thread::hardware_concurrency()));
+	return pool;
+}
+
+void LoadModelsParallel(const vector<string>& model_paths)
+{
+	vector<future<PendingModel>> pending;
+	for (const string& model_path : model_paths)
+		pending.push_back(GetLoaderPool().Submit([model_path]() { return PrepareModel(model_path); }));
 
-	shapes.clear();
-	materials.clear();
+	// models[] and m_shape_list[] have the order of model_paths
+	for (future<PendingModel>& f : pending)
+		UploadModel(f.get());
 }
+//* Loader threads *//
 
 void initParameter()
 {
@@ -932,8 +1459,11 @@ void setupRC()
 	vector<string> model_list{ "../ColorModels/bunny5KC.obj", "../ColorModels/dragon10KC.obj", "../ColorModels/lucy25KC.obj", "../ColorModels/teapot4KC.obj", "../ColorModels/dolphinC.obj"};
 	// [TODO] Load five model at here
 	//LoadModels(model_list[cur_idx]);
-    for (const auto &model_path : model_list)
-            LoadModels(model_path);
+	if (parallelModelLoading)
+		LoadModelsParallel(model_list);
+	else
+		for (const auto &model_path : model_list)
+			LoadModels(model_path);
 }
 
 void glPrintContextInfo(bool printExtension)
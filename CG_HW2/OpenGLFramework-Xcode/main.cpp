@@ -14,6 +14,20 @@
 //
 #include <unordered_map>
 #include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#if defined(__AVX__)
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+#endif
 
 #ifndef max
 # define max(a,b) (((a)>(b))?(a):(b))
@@ -48,12 +62,10 @@ struct PhongMaterial
     Vector3 Ka;
     Vector3 Kd;
     Vector3 Ks;
-};
-struct UniformPhongMaterial
-{
-    GLint iLocKa;
-    GLint iLocKs;
-    GLint iLocKd;
+
+    // its MaterialBlock, see UploadMaterialBlocks()
+    GLuint uniformBuffer = 0;
+    GLintptr uniformOffset = 0;
 };
 
 typedef struct
@@ -67,6 +79,7 @@ typedef struct
     GLuint p_normal;
     PhongMaterial material;
     int indexCount;
+    GLenum indexType;
     GLuint m_texture;
 } Shape;
 
@@ -77,6 +90,7 @@ struct model
     Vector3 rotation = Vector3(0, 0, 0);    // Euler form
 
     vector<Shape> shapes;
+    GLuint materialBuffer = 0;  // the MaterialBlocks of the shapes, see UploadMaterialBlocks()
 };
 vector<model> models;
 
@@ -122,17 +136,6 @@ struct LightInfo
 };
 LightInfo lightSources[numOfLightSources];
 
-
-struct UniformLightInfo
-{
-    GLint iLocPosition;
-    GLint iLocAmbient;
-    GLint iLocDiffuse;
-    GLint iLocSpecular;
-    GLint iLocConstantAttenuation;
-    GLint iLocLinearAttenuation;
-    GLint iLocQuadraticAttenuation;
-};
     
 struct SpotLightInfo
 {
@@ -142,30 +145,174 @@ struct SpotLightInfo
 };
 SpotLightInfo spotLightInfo;
 
-struct UniformSpotLight
-{
-    GLint iLocSpotDirection;
-    GLint iLocSpotExponent;
-    GLint iLocSpotCutOff;
-};
-    
 struct Uniform
 {
     GLint iLocMVP;
     GLint iLocM;
-    GLint iLocCameraPosition;
-    UniformLightInfo iLocLightInfo;
-    UniformPhongMaterial iLocMaterial;
-    UniformSpotLight iLocSpotLight;
-    GLint iLocShininess;
-    GLint iLocCurLightMode;
-    GLint iLocIsPerPixLighting;
+    GLint iLocN;
 };
 Uniform uniform;
 
 int curLightMode = 0;
 GLfloat shininess;
 
+//* Uniform blocks *//
+// The lighting uniforms are std140 blocks. RenderScene() keeps a FrameBlock per viewport and the
+// LightBlock in uniform buffers and writes them only when they change; the MaterialBlocks of a model
+// are written once by UploadModel(), a shape just binds its range.
+enum UniformBlockBinding
+{
+    FRAME_BLOCK_BINDING = 0,
+    LIGHT_BLOCK_BINDING = 1,
+    MATERIAL_BLOCK_BINDING = 2,
+};
+
+// std140 mirrors of the blocks of the shaders: a vec3 takes 16 bytes unless a scalar follows in its
+// last 4, structs and blocks are padded to 16 bytes.
+struct FrameBlock
+{
+    GLfloat cameraPosition[3];
+    GLint curLightMode;
+    GLfloat shininess;
+    GLint isPerPixLighting;
+    GLint sideBySide;
+    GLfloat pad[1];
+};
+
+struct LightBlock
+{
+    // LightInfo lightSources
+    GLfloat position[4], ambient[4], diffuse[4];
+    GLfloat specular[3], constantAttenuation;
+    GLfloat linearAttenuation, quadraticAttenuation, pad0[2];
+    // SpotLightInfo spotLightInfo
+    GLfloat spotDirection[3], spotExponent;
+    GLfloat spotCutOff, pad1[3];
+};
+
+struct MaterialBlock
+{
+    // PhongMaterial material
+    GLfloat Ka[4], Kd[4], Ks[4];
+};
+static_assert(sizeof(FrameBlock) == 32 && sizeof(LightBlock) == 112 && sizeof(MaterialBlock) == 48, "std140 layout");
+
+// Both viewports have a slot of frameBuffer. The copies are what the buffers hold.
+struct UniformBuffers
+{
+    GLuint frameBuffer, lightBuffer;
+    GLint alignment = 256;  // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    FrameBlock frames[2];
+    LightBlock light;
+    bool frameWritten[2] = { false, false }, lightWritten = false;
+};
+UniformBuffers uniformBuffers;
+
+// Distance between blocks of `size` bytes that are bound by range.
+static GLintptr UniformBlockStride(size_t size)
+{
+    GLintptr alignment = uniformBuffers.alignment;
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static void CopyVector3(const Vector3& v, GLfloat* out)
+{
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+}
+
+// Writes `block` to slot `slot` of `buffer` unless `written` already has it there.
+template <typename Block>
+static void WriteUniformBlock(GLuint buffer, int slot, const Block& block, Block* written, bool* valid)
+{
+    if (*valid && memcmp(&block, written, sizeof(Block)) == 0)
+        return;
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, slot * UniformBlockStride(sizeof(Block)), sizeof(Block), &block);
+    *written = block;
+    *valid = true;
+}
+
+// The FrameBlock of the viewport `slot` and the LightBlock, bound for the next draws. With
+// `side_by_side` the shaders take the half and lighting mode from gl_InstanceID instead.
+void SetFrameUniforms(int slot, int is_per_pixel_lighting, bool side_by_side = false)
+{
+    FrameBlock frame = FrameBlock();
+    CopyVector3(main_camera.position, frame.cameraPosition);
+    frame.curLightMode = curLightMode;
+    frame.shininess = shininess;
+    frame.isPerPixLighting = is_per_pixel_lighting;
+    frame.sideBySide = side_by_side;
+    WriteUniformBlock(uniformBuffers.frameBuffer, slot, frame, &uniformBuffers.frames[slot], &uniformBuffers.frameWritten[slot]);
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, uniformBuffers.frameBuffer, slot * UniformBlockStride(sizeof(FrameBlock)),
+                      sizeof(FrameBlock));
+
+    const LightInfo& info = lightSources[curLightMode];
+    LightBlock light = LightBlock();
+    CopyVector3(info.position, light.position);
+    CopyVector3(info.ambient, light.ambient);
+    CopyVector3(info.diffuse, light.diffuse);
+    CopyVector3(info.specular, light.specular);
+    light.constantAttenuation = info.constantAttenuation;
+    light.linearAttenuation = info.linearAttenuation;
+    light.quadraticAttenuation = info.quadraticAttenuation;
+    CopyVector3(spotLightInfo.spotDirection, light.spotDirection);
+    light.spotExponent = spotLightInfo.spotExponent;
+    light.spotCutOff = spotLightInfo.spotCutOff;
+    WriteUniformBlock(uniformBuffers.lightBuffer, 0, light, &uniformBuffers.light, &uniformBuffers.lightWritten);
+}
+
+// One uniform buffer with the MaterialBlocks of `materials`, which get their range of it. Returns
+// the buffer, 0 without materials.
+GLuint UploadMaterialBlocks(vector<PhongMaterial>& materials)
+{
+    if (materials.empty())
+        return 0;
+    GLintptr stride = UniformBlockStride(sizeof(MaterialBlock));
+    vector<char> data(stride * materials.size());
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        PhongMaterial& material = materials[i];
+        MaterialBlock block = MaterialBlock();
+        CopyVector3(material.Ka, block.Ka);
+        CopyVector3(material.Kd, block.Kd);
+        CopyVector3(material.Ks, block.Ks);
+        memcpy(&data[i * stride], &block, sizeof(block));
+        material.uniformBuffer = buffer;
+        material.uniformOffset = i * stride;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+    return buffer;
+}
+
+// Binds the blocks of `program` to their binding points and creates the buffers of RenderScene().
+void SetupUniformBlocks(GLuint program)
+{
+    const pair<const char*, GLuint> blocks[] = { { "FrameBlock", FRAME_BLOCK_BINDING }, { "LightBlock", LIGHT_BLOCK_BINDING },
+                                                 { "MaterialBlock", MATERIAL_BLOCK_BINDING } };
+    for (const auto& block : blocks)
+    {
+        GLuint index = glGetUniformBlockIndex(program, block.first);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, block.second);
+    }
+
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformBuffers.alignment);
+    uniformBuffers.alignment = max(uniformBuffers.alignment, 16);
+    glGenBuffers(1, &uniformBuffers.frameBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers.frameBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, 2 * UniformBlockStride(sizeof(FrameBlock)), NULL, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &uniformBuffers.lightBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers.lightBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, uniformBuffers.lightBuffer);
+}
+//* Uniform blocks *//
+
 static GLvoid Normalize(GLfloat v[3])
 {
     GLfloat l;
@@ -350,6 +497,22 @@ void setGLMatrix(GLfloat* glm, Matrix4& m) {
     glm[3] = m[12];  glm[7] = m[13];  glm[11] = m[14];   glm[15] = m[15];
 }
 
+// mat3(transpose(inverse(m))) for glUniformMatrix3fv(..., GL_FALSE, ...): the column-major inverse
+// transpose is the row-major inverse. The shaders normalize the normals, so the upper 3x3 is scaled
+// to keep small models clear of the determinant threshold of Matrix3::invert().
+void setGLNormalMatrix(GLfloat* glm, const Matrix4& m) {
+    float largest = 0.0f;
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+            largest = max(largest, fabsf(m[row * 4 + col]));
+    }
+    float s = largest > 0.0f ? 1.0f / largest : 1.0f;
+    Matrix3 inverse(m[0] * s, m[1] * s, m[2] * s, m[4] * s, m[5] * s, m[6] * s, m[8] * s, m[9] * s, m[10] * s);
+    inverse.invert();
+    memcpy(glm, inverse.get(), 9 * sizeof(GLfloat));
+}
+
 // Vertex buffers
 //GLuint VAO, VBO;
 
@@ -387,6 +550,10 @@ void transVec3ToShader(GLint iLoc, const Vector3 &v)
 }
 
 // Render function for display rendering
+// Draw both views with one instanced draw per shape instead of one draw per half of the window, see
+// shader.vs.
+bool sideBySideRendering = true;
+
 void RenderScene(void) {
     // clear canvas
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -403,6 +570,7 @@ void RenderScene(void) {
     Matrix4 MVP;
     GLfloat mvp[16];
     GLfloat m[16];
+    GLfloat n[9];
     Matrix4 M;
     // [TODO] multiply all the matrix
     // MVP
@@ -412,49 +580,46 @@ void RenderScene(void) {
     // row-major ---> column-major
     setGLMatrix(mvp, MVP);
     setGLMatrix(m, M);
+    setGLNormalMatrix(n, M);
 
     // Use uniform to send mvp to vertex shader
     glUniformMatrix4fv(uniform.iLocMVP, 1, GL_FALSE, mvp);
     glUniformMatrix4fv(uniform.iLocM, 1, GL_FALSE, m);
-    transVec3ToShader(uniform.iLocCameraPosition, main_camera.position);
-
-    // Cache the light information
-    auto& currentLightInfo = lightSources[curLightMode];
-
-    transVec3ToShader(uniform.iLocLightInfo.iLocPosition, currentLightInfo.position);
-    transVec3ToShader(uniform.iLocLightInfo.iLocAmbient, currentLightInfo.ambient);
-    transVec3ToShader(uniform.iLocLightInfo.iLocDiffuse, currentLightInfo.diffuse);
-    transVec3ToShader(uniform.iLocLightInfo.iLocSpecular, currentLightInfo.specular);
-    glUniform1f(uniform.iLocLightInfo.iLocConstantAttenuation, currentLightInfo.constantAttenuation);
-    glUniform1f(uniform.iLocLightInfo.iLocLinearAttenuation, currentLightInfo.linearAttenuation);
-    glUniform1f(uniform.iLocLightInfo.iLocQuadraticAttenuation, currentLightInfo.quadraticAttenuation);
+    glUniformMatrix3fv(uniform.iLocN, 1, GL_FALSE, n);
 
-    transVec3ToShader(uniform.iLocSpotLight.iLocSpotDirection, spotLightInfo.spotDirection);
-    glUniform1f(uniform.iLocSpotLight.iLocSpotExponent, spotLightInfo.spotExponent);
-    glUniform1f(uniform.iLocSpotLight.iLocSpotCutOff, spotLightInfo.spotCutOff);
-
-    glUniform1i(uniform.iLocCurLightMode, curLightMode);
-    glUniform1f(uniform.iLocShininess, shininess);
+    if (sideBySideRendering)
+    {
+        // each instance lands in its half of the viewport
+        SetFrameUniforms(0, 0, true);
+        glViewport(0, 0, cur_WINDOW_WIDTH / 2 * 2, cur_WINDOW_HEIGHT);
+        for (auto& shape : currentModel.shapes)
+        {
+            glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, shape.material.uniformBuffer, shape.material.uniformOffset,
+                              sizeof(MaterialBlock));
+            glBindVertexArray(shape.vao);
+            glDrawElementsInstanced(GL_TRIANGLES, shape.indexCount, shape.indexType, 0, 2);
+        }
+        return;
+    }
 
     for (auto& shape : currentModel.shapes)
     {
-        transVec3ToShader(uniform.iLocMaterial.iLocKa, shape.material.Ka);
-        transVec3ToShader(uniform.iLocMaterial.iLocKd, shape.material.Kd);
-        transVec3ToShader(uniform.iLocMaterial.iLocKs, shape.material.Ks);
+        glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, shape.material.uniformBuffer, shape.material.uniformOffset,
+                          sizeof(MaterialBlock));
 
         /* draw left */
-        glUniform1i(uniform.iLocIsPerPixLighting, 0);
+        SetFrameUniforms(0, 0);
         glViewport(0, 0, cur_WINDOW_WIDTH / 2, cur_WINDOW_HEIGHT);
 
         glBindVertexArray(shape.vao);
-        glDrawArrays(GL_TRIANGLES, 0, shape.vertex_count);
+        glDrawElements(GL_TRIANGLES, shape.indexCount, shape.indexType, 0);
 
         /* draw right */
-        glUniform1i(uniform.iLocIsPerPixLighting, 1);
+        SetFrameUniforms(1, 1);
         glViewport(cur_WINDOW_WIDTH / 2, 0, cur_WINDOW_WIDTH / 2, cur_WINDOW_HEIGHT);
 
         glBindVertexArray(shape.vao);
-        glDrawArrays(GL_TRIANGLES, 0, shape.vertex_count);
+        glDrawElements(GL_TRIANGLES, shape.indexCount, shape.indexType, 0);
     }
 }
 
@@ -637,27 +802,9 @@ void setShaders()
 
     uniform.iLocMVP = glGetUniformLocation(p, "MVP");
     uniform.iLocM = glGetUniformLocation(p, "M");
-    uniform.iLocCameraPosition = glGetUniformLocation(p, "cameraPosition");
-
-    uniform.iLocMaterial.iLocKa = glGetUniformLocation(p, "material.Ka");
-    uniform.iLocMaterial.iLocKd = glGetUniformLocation(p, "material.Kd");
-    uniform.iLocMaterial.iLocKs = glGetUniformLocation(p, "material.Ks");
-
-    uniform.iLocLightInfo.iLocPosition = glGetUniformLocation(p, "lightSources.position");
-    uniform.iLocLightInfo.iLocAmbient = glGetUniformLocation(p, "lightSources.ambient");
-    uniform.iLocLightInfo.iLocDiffuse = glGetUniformLocation(p, "lightSources.diffuse");
-    uniform.iLocLightInfo.iLocSpecular = glGetUniformLocation(p, "lightSources.specular");
-    uniform.iLocLightInfo.iLocConstantAttenuation =  glGetUniformLocation(p, "lightSources.constAttenuation");
-    uniform.iLocLightInfo.iLocLinearAttenuation =    glGetUniformLocation(p, "lightSources.linearAttenuation");
-    uniform.iLocLightInfo.iLocQuadraticAttenuation = glGetUniformLocation(p, "lightSources.quadraticAttenuation");
-
-    uniform.iLocSpotLight.iLocSpotDirection = glGetUniformLocation(p, "spotLightInfo.spotDirection");
-    uniform.iLocSpotLight.iLocSpotExponent = glGetUniformLocation(p, "spotLightInfo.spotExponent");
-    uniform.iLocSpotLight.iLocSpotCutOff = glGetUniformLocation(p, "spotLightInfo.spotCutOff");
-
-    uniform.iLocCurLightMode = glGetUniformLocation(p, "curLightMode");
-    uniform.iLocShininess = glGetUniformLocation(p, "shininess");
-    uniform.iLocIsPerPixLighting = glGetUniformLocation(p, "isPerPixLighting");
+    uniform.iLocN = glGetUniformLocation(p, "N");
+    // lights, camera and materials are uniform blocks
+    SetupUniformBlocks(p);
 
     if (success)
         glUseProgram(p);
@@ -668,109 +815,361 @@ void setShaders()
     }
 }
 
-void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, tinyobj::shape_t* shape)
+// Face corners with the same (vertex, normal, texcoord) indices share one vertex.
+struct IndexHash
 {
-    vector<float> xVector, yVector, zVector;
-    float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
+    size_t operator()(const tinyobj::index_t& idx) const
+    {
+        return (size_t)idx.vertex_index * 73856093u ^ (size_t)idx.normal_index * 19349663u ^ (size_t)idx.texcoord_index * 83492791u;
+    }
+};
 
-    // find out min and max value of X, Y and Z axis
-    for (int i = 0; i < attrib->vertices.size(); i++)
+struct IndexEqual
+{
+    bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const
     {
-        //maxs = max(maxs, attrib->vertices.at(i));
-        if (i % 3 == 0)
+        return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+    }
+};
+
+//* Position kernels *//
+// Used by normalization() on the interleaved xyz positions of a model. The SIMD loops read W vertices
+// (W = 8 with AVX, 4 with SSE2) as 3 registers, so float j of such a block always holds axis j % 3.
+// Results match the scalar loops.
+#if defined(__AVX__)
+typedef __m256 PosVec;
+const size_t POS_VEC_WIDTH = 8;
+# define POSITIONS_SIMD "AVX"
+# define PosLoad _mm256_loadu_ps
+# define PosStore _mm256_storeu_ps
+# define PosSet1 _mm256_set1_ps
+# define PosMin _mm256_min_ps
+# define PosMax _mm256_max_ps
+# define PosSub _mm256_sub_ps
+# define PosDiv _mm256_div_ps
+#elif defined(__SSE2__) || defined(_M_X64)
+typedef __m128 PosVec;
+const size_t POS_VEC_WIDTH = 4;
+# define POSITIONS_SIMD "SSE2"
+# define PosLoad _mm_loadu_ps
+# define PosStore _mm_storeu_ps
+# define PosSet1 _mm_set1_ps
+# define PosMin _mm_min_ps
+# define PosMax _mm_max_ps
+# define PosSub _mm_sub_ps
+# define PosDiv _mm_div_ps
+#endif
+
+static void PositionBoundsScalar(const GLfloat* positions, size_t first, size_t count, float minPos[3], float maxPos[3])
+{
+    for (size_t i = first; i < count; i++)
+    {
+        for (int k = 0; k < 3; k++)
         {
+            minPos[k] = min(minPos[k], positions[3 * i + k]);
+            maxPos[k] = max(maxPos[k], positions[3 * i + k]);
+        }
+    }
+}
 
-            xVector.push_back(attrib->vertices.at(i));
+static void RecenterAndScaleScalar(GLfloat* positions, size_t first, size_t count, const float offset[3], float scale)
+{
+    for (size_t i = first; i < count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+            positions[3 * i + k] = (positions[3 * i + k] - offset[k]) / scale;
+    }
+}
 
-            if (attrib->vertices.at(i) < minX)
+// Grows minPos/maxPos to contain `count` xyz positions.
+void PositionBounds(const GLfloat* positions, size_t count, float minPos[3], float maxPos[3])
+{
+    size_t i = 0;
+#ifdef POSITIONS_SIMD
+    if (count >= POS_VEC_WIDTH)
+    {
+        PosVec lo[3], hi[3];
+        for (int k = 0; k < 3; k++)
+            lo[k] = hi[k] = PosLoad(positions + k * POS_VEC_WIDTH);
+        for (; i + POS_VEC_WIDTH <= count; i += POS_VEC_WIDTH)
+        {
+            const GLfloat* block = positions + 3 * i;
+            for (int k = 0; k < 3; k++)
             {
-                minX = attrib->vertices.at(i);
+                PosVec v = PosLoad(block + k * POS_VEC_WIDTH);
+                lo[k] = PosMin(lo[k], v);
+                hi[k] = PosMax(hi[k], v);
             }
+        }
 
-            if (attrib->vertices.at(i) > maxX)
-            {
-                maxX = attrib->vertices.at(i);
-            }
+        float lanes[2][3 * POS_VEC_WIDTH];
+        for (int k = 0; k < 3; k++)
+        {
+            PosStore(lanes[0] + k * POS_VEC_WIDTH, lo[k]);
+            PosStore(lanes[1] + k * POS_VEC_WIDTH, hi[k]);
         }
-        else if (i % 3 == 1)
+        for (size_t j = 0; j < 3 * POS_VEC_WIDTH; j++)
         {
-            yVector.push_back(attrib->vertices.at(i));
+            minPos[j % 3] = min(minPos[j % 3], lanes[0][j]);
+            maxPos[j % 3] = max(maxPos[j % 3], lanes[1][j]);
+        }
+    }
+#endif
+    PositionBoundsScalar(positions, i, count, minPos, maxPos);
+}
 
-            if (attrib->vertices.at(i) < minY)
-            {
-                minY = attrib->vertices.at(i);
-            }
+// positions = (positions - offset) / scale for `count` xyz positions, in place.
+void RecenterAndScale(GLfloat* positions, size_t count, const float offset[3], float scale)
+{
+    size_t i = 0;
+#ifdef POSITIONS_SIMD
+    float pattern[3 * POS_VEC_WIDTH];
+    for (size_t j = 0; j < 3 * POS_VEC_WIDTH; j++)
+        pattern[j] = offset[j % 3];
+    PosVec off[3];
+    for (int k = 0; k < 3; k++)
+        off[k] = PosLoad(pattern + k * POS_VEC_WIDTH);
+    PosVec s = PosSet1(scale);
+
+    for (; i + POS_VEC_WIDTH <= count; i += POS_VEC_WIDTH)
+    {
+        GLfloat* block = positions + 3 * i;
+        for (int k = 0; k < 3; k++)
+            PosStore(block + k * POS_VEC_WIDTH, PosDiv(PosSub(PosLoad(block + k * POS_VEC_WIDTH), off[k]), s));
+    }
+#endif
+    RecenterAndScaleScalar(positions, i, count, offset, scale);
+}
 
-            if (attrib->vertices.at(i) > maxY)
-            {
-                maxY = attrib->vertices.at(i);
-            }
-        }
-        else if (i % 3 == 2)
-        {
-            zVector.push_back(attrib->vertices.at(i));
+// Centers the bounding box of the whole model and scales its longest axis to [-1, 1]. Done once per
+// model, shapes share attrib->vertices and are indexed by IndexShape() afterwards.
+void normalization(tinyobj::attrib_t* attrib)
+{
+    vector<GLfloat>& positions = attrib->vertices;
+    float minPos[3] = { 10000, 10000, 10000 }, maxPos[3] = { -10000, -10000, -10000 };
 
-            if (attrib->vertices.at(i) < minZ)
-            {
-                minZ = attrib->vertices.at(i);
-            }
+    // find out min and max value of X, Y and Z axis
+    PositionBounds(positions.data(), positions.size() / 3, minPos, maxPos);
 
-            if (attrib->vertices.at(i) > maxZ)
-            {
-                maxZ = attrib->vertices.at(i);
-            }
-        }
+    float offset[3];
+    float greatestAxis = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        offset[k] = (maxPos[k] + minPos[k]) / 2;
+        greatestAxis = max(greatestAxis, maxPos[k] - minPos[k]);
     }
+    float scale = greatestAxis / 2;
+    RecenterAndScale(positions.data(), positions.size() / 3, offset, scale);
+}
 
-    float offsetX = (maxX + minX) / 2;
-    float offsetY = (maxY + minY) / 2;
-    float offsetZ = (maxZ + minZ) / 2;
+//* Generated normals *//
+// .obj files without vn lines get smooth normals: the normal of a position is the sum of the normals
+// of the triangles around it, weighted by their area and by their angle at the position.
+const size_t ACCUMULATE_THREAD_TRIANGLES = 1 << 16;
 
-    for (int i = 0; i < attrib->vertices.size(); i++)
+// Runs task(0) .. task(count - 1) on `count` threads, task(0) on the calling one.
+static void RunParallel(size_t count, const function<void(size_t)>& task)
+{
+    vector<future<void>> tasks;
+    for (size_t i = 1; i < count; i++)
+        tasks.push_back(async(launch::async, task, i));
+    task(0);
+    for (future<void>& t : tasks)
+        t.get();
+}
+
+// Sums C floats per vertex over the corners of `triangle_count` triangles(`corners` holds 3 vertex ids
+// each) without atomics: every thread adds a range of triangles into its own buffer, covering only the
+// vertex ids of its range, then every thread sums a range of vertices over these buffers. The order of
+// the sums does not depend on the timing. weigh(triangle, w) writes C floats per corner of `triangle`
+// to w, or returns false to skip it.
+template <int C, typename Weigh>
+static void AccumulateCorners(const uint32_t* corners, size_t triangle_count, size_t vertex_count, const Weigh& weigh, vector<float>* sums)
+{
+    size_t threads = (triangle_count + ACCUMULATE_THREAD_TRIANGLES - 1) / ACCUMULATE_THREAD_TRIANGLES;
+    size_t cores = thread::hardware_concurrency();
+    threads = max((size_t)1, min(threads, max((size_t)1, cores)));
+
+    struct Chunk
     {
-        if (offsetX != 0 && i % 3 == 0)
+        uint32_t low = 1, high = 0;     // vertex ids in sums, none by default
+        vector<float> sums;
+    };
+    vector<Chunk> chunks(threads);
+    RunParallel(threads, [&](size_t c) {
+        size_t first = triangle_count * c / threads, last = triangle_count * (c + 1) / threads;
+        if (first == last)
+            return;
+        Chunk& chunk = chunks[c];
+        uint32_t low = UINT32_MAX, high = 0;
+        for (size_t i = first * 3; i < last * 3; i++)
         {
-            attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
+            low = min(low, corners[i]);
+            high = max(high, corners[i]);
         }
-        else if (offsetY != 0 && i % 3 == 1)
+        chunk.low = low;
+        chunk.high = high;
+        chunk.sums.assign((size_t)(high - low + 1) * C, 0.0f);
+
+        float w[3 * C];
+        for (size_t t = first; t < last; t++)
         {
-            attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
+            if (!weigh(t, w))
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                float* sum = &chunk.sums[(size_t)(corners[t * 3 + k] - low) * C];
+                for (int j = 0; j < C; j++)
+                    sum[j] += w[k * C + j];
+            }
         }
-        else if (offsetZ != 0 && i % 3 == 2)
+    });
+
+    sums->assign(vertex_count * C, 0.0f);
+    RunParallel(threads, [&](size_t c) {
+        size_t first = vertex_count * c / threads, last = vertex_count * (c + 1) / threads;
+        for (const Chunk& chunk : chunks)
         {
-            attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+            size_t from = max(first, (size_t)chunk.low), to = min(last, (size_t)chunk.high + 1);
+            for (size_t v = from; v < to; v++)
+            {
+                for (int j = 0; j < C; j++)
+                    (*sums)[v * C + j] += chunk.sums[(v - chunk.low) * C + j];
+            }
         }
-    }
+    });
+}
 
-    float greatestAxis = maxX - minX;
-    float distanceOfYAxis = maxY - minY;
-    float distanceOfZAxis = maxZ - minZ;
+static void Subtract3(const GLfloat* a, const GLfloat* b, float out[3])
+{
+    for (int k = 0; k < 3; k++)
+        out[k] = a[k] - b[k];
+}
 
-    if (distanceOfYAxis > greatestAxis)
+static void Cross3(const float a[3], const float b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float Dot3(const float a[3], const float b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Scales `v` to length 1, a zero vector stays zero.
+static void Normalize3(float v[3])
+{
+    float length = sqrtf(Dot3(v, v));
+    if (length > 0)
     {
-        greatestAxis = distanceOfYAxis;
+        for (int k = 0; k < 3; k++)
+            v[k] /= length;
     }
+}
 
-    if (distanceOfZAxis > greatestAxis)
+// The angles of a triangle at its corners. `cross_length` is the length of its normal(p1 - p0) x (p2 - p0).
+static void CornerAngles(const GLfloat* const p[3], float cross_length, float angles[3])
+{
+    for (int k = 0; k < 3; k++)
     {
-        greatestAxis = distanceOfZAxis;
+        float a[3], b[3];
+        Subtract3(p[(k + 1) % 3], p[k], a);
+        Subtract3(p[(k + 2) % 3], p[k], b);
+        angles[k] = atan2f(cross_length, Dot3(a, b));
     }
+}
 
-    float scale = greatestAxis / 2;
+// One unit normal per position of `positions`, from the triangles of `triangles`(3 position ids each).
+// Positions without a triangle get a zero normal.
+void GenerateSmoothNormals(const GLfloat* positions, size_t position_count, const vector<uint32_t>& triangles, vector<GLfloat>* normals)
+{
+    AccumulateCorners<3>(triangles.data(), triangles.size() / 3, position_count, [&](size_t t, float* w) {
+        const GLfloat* p[3] = { &positions[triangles[t * 3] * 3], &positions[triangles[t * 3 + 1] * 3], &positions[triangles[t * 3 + 2] * 3] };
+        float u[3], v[3], n[3], angles[3];
+        Subtract3(p[1], p[0], u);
+        Subtract3(p[2], p[0], v);
+        Cross3(u, v, n);
+        float length = sqrtf(Dot3(n, n));
+        if (!(length > 0))
+            return false;
+        // the length of n is twice the area
+        CornerAngles(p, length, angles);
+        for (int k = 0; k < 3; k++)
+        {
+            for (int j = 0; j < 3; j++)
+                w[k * 3 + j] = n[j] * angles[k];
+        }
+        return true;
+    }, normals);
+
+    size_t threads = min(max((size_t)1, (size_t)thread::hardware_concurrency()), position_count / ACCUMULATE_THREAD_TRIANGLES + 1);
+    RunParallel(threads, [&](size_t c) {
+        for (size_t i = position_count * c / threads; i < position_count * (c + 1) / threads; i++)
+            Normalize3(&(*normals)[i * 3]);
+    });
+}
 
-    for (int i = 0; i < attrib->vertices.size(); i++)
+// Gives the corners of `shapes` without normal the smooth normal of their position, appended to
+// attrib->normals.
+void GenerateMissingNormals(tinyobj::attrib_t* attrib, vector<tinyobj::shape_t>& shapes, const string& model_path)
+{
+    auto start = chrono::steady_clock::now();
+    vector<uint32_t> triangles;
+    for (const tinyobj::shape_t& shape : shapes)
     {
-        //std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
-        attrib->vertices.at(i) = attrib->vertices.at(i) / scale;
+        size_t index_offset = 0;
+        for (int fv : shape.mesh.num_face_vertices)
+        {
+            const tinyobj::index_t* face = &shape.mesh.indices[index_offset];
+            index_offset += fv;
+            bool missing = false;
+            for (int v = 0; v < fv; v++)
+                missing = missing || face[v].normal_index < 0;
+            if (!missing)
+                continue;
+            // faces are triangulated, a fan otherwise
+            for (int v = 2; v < fv; v++)
+            {
+                triangles.push_back(face[0].vertex_index);
+                triangles.push_back(face[v - 1].vertex_index);
+                triangles.push_back(face[v].vertex_index);
+            }
+        }
     }
-    size_t index_offset = 0;
-    for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++) {
-        int fv = shape->mesh.num_face_vertices[f];
-
-        // Loop over vertices in the face.
-        for (size_t v = 0; v < fv; v++) {
-            // access to vertex
-            tinyobj::index_t idx = shape->mesh.indices[index_offset + v];
+    if (triangles.empty())
+        return;
+
+    vector<GLfloat> generated;
+    size_t position_count = attrib->vertices.size() / 3;
+    GenerateSmoothNormals(attrib->vertices.data(), position_count, triangles, &generated);
+    int base = attrib->normals.size() / 3;
+    attrib->normals.insert(attrib->normals.end(), generated.begin(), generated.end());
+    for (tinyobj::shape_t& shape : shapes)
+    {
+        for (tinyobj::index_t& idx : shape.mesh.indices)
+        {
+            if (idx.normal_index < 0)
+                idx.normal_index = base + idx.vertex_index;
+        }
+    }
+    printf("Normals %s: generated for %d positions from %d triangles in %.1f ms\n", model_path.c_str(), (int)position_count,
+           (int)(triangles.size() / 3), chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+}
+//* Generated normals *//
+
+// Appends the vertices and indices of one shape of a normalized model.
+void IndexShape(const tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLuint>& indices, const tinyobj::shape_t* shape)
+{
+    unordered_map<tinyobj::index_t, GLuint, IndexHash, IndexEqual> vertex_ids;
+    vertex_ids.reserve(shape->mesh.indices.size());
+    indices.reserve(shape->mesh.indices.size());
+    for (size_t i = 0; i < shape->mesh.indices.size(); i++) {
+        tinyobj::index_t idx = shape->mesh.indices[i];
+        auto found = vertex_ids.insert(make_pair(idx, (GLuint)(vertices.size() / 3)));
+        if (found.second) {
+            // first use of this vertex
             vertices.push_back(attrib->vertices[3 * idx.vertex_index + 0]);
             vertices.push_back(attrib->vertices[3 * idx.vertex_index + 1]);
             vertices.push_back(attrib->vertices[3 * idx.vertex_index + 2]);
@@ -783,26 +1182,63 @@ void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<
                 normals.push_back(attrib->normals[3 * idx.normal_index + 0]);
                 normals.push_back(attrib->normals[3 * idx.normal_index + 1]);
                 normals.push_back(attrib->normals[3 * idx.normal_index + 2]);
+            } else {
+                normals.insert(normals.end(), 3, 0.0f);
             }
         }
-        index_offset += fv;
+        indices.push_back(found.first->second);
     }
 }
 
+// Uploads `indices` to the element buffer of the bound VAO, 16 bit when `vertex_count` allows it.
+void CreateIndexBuffer(Shape* shape, const vector<GLuint>& indices, int vertex_count)
+{
+    glGenBuffers(1, &shape->ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shape->ebo);
+    if (vertex_count <= 65536)
+    {
+        vector<GLushort> shortIndices(indices.begin(), indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(GLushort), shortIndices.data(), GL_STATIC_DRAW);
+        shape->indexType = GL_UNSIGNED_SHORT;
+    }
+    else
+    {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+        shape->indexType = GL_UNSIGNED_INT;
+    }
+    shape->indexCount = indices.size();
+}
+
 string GetBaseDir(const string& filepath) {
     if (filepath.find_last_of("/\\") != std::string::npos)
         return filepath.substr(0, filepath.find_last_of("/\\"));
     return "";
 }
 
-void LoadModels(string model_path)
+// A shape prepared on a loader thread, uploaded by UploadModel().
+struct PendingShape
 {
-    vector<tinyobj::shape_t> shapes;
-    vector<tinyobj::material_t> materials;
-    tinyobj::attrib_t attrib;
     vector<GLfloat> vertices;
     vector<GLfloat> colors;
     vector<GLfloat> normals;
+    vector<GLuint> indices;
+    int material;
+};
+
+struct PendingModel
+{
+    vector<PhongMaterial> materials;
+    vector<PendingShape> shapes;
+    // the .obj did not load, UploadModel() exits: exit() on a loader thread would join it from the pool's destructor
+    bool failed = false;
+};
+
+// CPU side of loading a model, no GL calls: safe on a loader thread.
+PendingModel PrepareModel(string model_path)
+{
+    vector<tinyobj::shape_t> shapes;
+    vector<tinyobj::material_t> materials;
+    tinyobj::attrib_t attrib;
 
     string err;
     string warn;
@@ -815,7 +1251,7 @@ void LoadModels(string model_path)
     base_dir += "/";
 #endif
 
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
+    bool ret = tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
 
     if (!warn.empty()) {
         cout << warn << std::endl;
@@ -825,32 +1261,56 @@ void LoadModels(string model_path)
         cerr << err << std::endl;
     }
 
+    PendingModel tmp_model;
     if (!ret) {
-        exit(1);
+        tmp_model.failed = true;
+        return tmp_model;
     }
 
     printf("Load Models Success ! Shapes size %d Material size %d\n", int(shapes.size()), int(materials.size()));
-    model tmp_model;
 
-    vector<PhongMaterial> allMaterial;
     for (int i = 0; i < materials.size(); i++)
     {
         PhongMaterial material;
         material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
         material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
         material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
-        allMaterial.push_back(material);
+        tmp_model.materials.push_back(material);
     }
 
+    normalization(&attrib);
+    GenerateMissingNormals(&attrib, shapes, model_path);
     for (int i = 0; i < shapes.size(); i++)
     {
-
-        vertices.clear();
-        colors.clear();
-        normals.clear();
-        normalization(&attrib, vertices, colors, normals, &shapes[i]);
+        tmp_model.shapes.push_back(PendingShape());
+        PendingShape& shape = tmp_model.shapes.back();
+        IndexShape(&attrib, shape.vertices, shape.colors, shape.normals, shape.indices, &shapes[i]);
+        printf("Indexed %d face corners into %d vertices\n", int(shape.indices.size()), int(shape.vertices.size() / 3));
         // printf("Vertices size: %d", vertices.size() / 3);
 
+        // not support per face material, use material of first face
+        shape.material = shapes[i].mesh.material_ids[0];
+    }
+    return tmp_model;
+}
+
+// GL side of loading a model, on the context thread.
+model UploadModel(const PendingModel& pending)
+{
+    if (pending.failed)
+        exit(1);
+
+    model tmp_model;
+    // the last one is for the shapes of a model without materials
+    vector<PhongMaterial> materials = pending.materials;
+    materials.push_back(PhongMaterial());
+    tmp_model.materialBuffer = UploadMaterialBlocks(materials);
+    for (const PendingShape& shape : pending.shapes)
+    {
+        const vector<GLfloat>& vertices = shape.vertices;
+        const vector<GLfloat>& colors = shape.colors;
+        const vector<GLfloat>& normals = shape.normals;
+
         Shape tmp_shape;
         glGenVertexArrays(1, &tmp_shape.vao);
         glBindVertexArray(tmp_shape.vao);
@@ -871,20 +1331,105 @@ void LoadModels(string model_path)
         glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GL_FLOAT), &normals.at(0), GL_STATIC_DRAW);
         glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
+        CreateIndexBuffer(&tmp_shape, shape.indices, tmp_shape.vertex_count);
+
         glEnableVertexAttribArray(0);
         glEnableVertexAttribArray(1);
         glEnableVertexAttribArray(2);
 
-        // not support per face material, use material of first face
-        if (allMaterial.size() > 0)
-            tmp_shape.material = allMaterial[shapes[i].mesh.material_ids[0]];
+        tmp_shape.material = materials[pending.materials.size() > 0 ? shape.material : materials.size() - 1];
         tmp_model.shapes.push_back(tmp_shape);
     }
-    shapes.clear();
-    materials.clear();
-    models.push_back(tmp_model);
+    return tmp_model;
+}
+
+void LoadModels(string model_path)
+{
+    models.push_back(UploadModel(PrepareModel(model_path)));
+}
+
+//* Loader threads *//
+// setupRC() prepares all models at once on a pool of threads and uploads each one as soon as it
+// and the ones before it are ready, so the startup time no longer sums over the models.
+bool parallelModelLoading = true;
+
+class LoaderPool
+{
+public:
+    explicit LoaderPool(unsigned thread_count)
+    {
+        for (unsigned i = 0; i < thread_count; i++)
+            threads.push_back(thread(&LoaderPool::Run, this));
+    }
+
+    ~LoaderPool()
+    {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& t : threads)
+            t.join();
+    }
+
+    template <typename F>
+    future<typename result_of<F()>::type> Submit(F f)
+    {
+        typedef typename result_of<F()>::type R;
+        shared_ptr<packaged_task<R()>> task = make_shared<packaged_task<R()>>(f);
+        future<R> res = task->get_future();
+        {
+            lock_guard<mutex> lock(m);
+            tasks.push_back([task]() { (*task)(); });
+        }
+        wake.notify_one();
+        return res;
+    }
+
+private:
+    void Run()
+    {
+        for (;;)
+        {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(m);
+                wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    vector<thread> threads;
+    deque<function<void()>> tasks;
+    mutex m;
+    condition_variable wake;
+    bool stopping = false;
+};
+
+LoaderPool& GetLoaderPool()
+{
+    static LoaderPool pool(max(1u, thread::hardware_concurrency()));
+    return pool;
 }
 
+void LoadModelsParallel(const vector<string>& model_paths)
+{
+    vector<future<PendingModel>> pending;
+    for (const string& model_path : model_paths)
+        pending.push_back(GetLoaderPool().Submit([model_path]() { return PrepareModel(model_path); }));
+
+    // models[] has the order of model_paths
+    for (future<PendingModel>& f : pending)
+        models.push_back(UploadModel(f.get()));
+}
+//* Loader threads *//
+
 void initParameter()
 {
     // [TODO] Setup some parameters if you need
@@ -948,8 +1493,11 @@ void setupRC()
     vector<string> model_list{ "../NormalModels/bunny5KN.obj", "../NormalModels/dragon10KN.obj", "../NormalModels/lucy25KN.obj", "../NormalModels/teapot4KN.obj", "../NormalModels/dolphinN.obj"};
     // [TODO] Load five model at here
     //LoadModels(model_list[cur_idx]);
-    for (const auto &model_path : model_list)
-        LoadModels(model_path);
+    if (parallelModelLoading)
+        LoadModelsParallel(model_list);
+    else
+        for (const auto &model_path : model_list)
+            LoadModels(model_path);
 }
 
 void glPrintContextInfo(bool printExtension)
@@ -1010,6 +1558,8 @@ int main(int argc, char **argv)
 
     glfwSetFramebufferSizeCallback(window, ChangeSize);
     glEnable(GL_DEPTH_TEST);
+    // the side by side views clip at the middle of the window, see shader.vs
+    glEnable(GL_CLIP_DISTANCE0);
     // Setup render context
     setupRC();
 
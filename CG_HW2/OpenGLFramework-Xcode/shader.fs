@@ -4,18 +4,16 @@ out vec4 FragColor;
 in vec3 vertex_color;
 in vec3 vertex_normal;
 in vec3 vertex_pos;
+flat in int perPixelLighting;
 
 const float PI = 3.14159265359;
 
-uniform vec3 cameraPosition;
-
 struct PhongMaterial
 {
     vec3 Ka;
     vec3 Kd;
     vec3 Ks;
 };
-uniform PhongMaterial material;
 
 struct LightInfo
 {
@@ -27,7 +25,6 @@ struct LightInfo
     float linearAttenuation;
     float quadraticAttenuation;
 };
-uniform LightInfo lightSources;
 
 struct SpotLightInfo
 {
@@ -35,11 +32,28 @@ struct SpotLightInfo
     float spotExponent;
     float spotCutOff;
 };
-uniform SpotLightInfo spotLightInfo;
 
-uniform int curLightMode;
-uniform float shininess;
-uniform int isPerPixLighting;
+// std140 blocks, the same in both shaders: FrameBlock and LightBlock are written by RenderScene(),
+// MaterialBlock is a range of the uniform buffer of the model
+layout (std140) uniform FrameBlock
+{
+    vec3 cameraPosition;
+    int curLightMode;
+    float shininess;
+    int isPerPixLighting;
+    int sideBySide;
+};
+
+layout (std140) uniform LightBlock
+{
+    LightInfo lightSources;
+    SpotLightInfo spotLightInfo;
+};
+
+layout (std140) uniform MaterialBlock
+{
+    PhongMaterial material;
+};
 
 vec3 directionalLight(vec3 vertexPosition, vec3 vertexNormal)
 {
@@ -108,6 +122,6 @@ void main() {
        color = positionLight(vertex_pos, vertex_normal);
     else if (curLightMode == 2)
        color = spotLight(vertex_pos, vertex_normal);
-    FragColor = (isPerPixLighting == 1) ? vec4(color, 1.0f) : vec4(vertex_color, 1.0f);
+    FragColor = (perPixelLighting == 1) ? vec4(color, 1.0f) : vec4(vertex_color, 1.0f);
     //FragColor = vec4(vertex_normal, 1.0f);
 }
@@ -7,10 +7,12 @@ layout (location = 2) in vec3 aNormal;
 out vec3 vertex_pos;
 out vec3 vertex_color;
 out vec3 vertex_normal;
+flat out int perPixelLighting;
 
 uniform mat4 MVP;
 uniform mat4 M;
-uniform vec3 cameraPosition;
+// mat3(transpose(inverse(M))), once per draw on the CPU
+uniform mat3 N;
 
 const float PI = 3.14159265359;
 
@@ -20,7 +22,6 @@ struct PhongMaterial
     vec3 Kd;
     vec3 Ks;
 };
-uniform PhongMaterial material;
 
 struct LightInfo
 {
@@ -32,7 +33,6 @@ struct LightInfo
     float linearAttenuation;
     float quadraticAttenuation;
 };
-uniform LightInfo lightSources;
 
 struct SpotLightInfo
 {
@@ -40,10 +40,28 @@ struct SpotLightInfo
     float spotExponent;
     float spotCutOff;
 };
-uniform SpotLightInfo spotLightInfo;
 
-uniform int curLightMode;
-uniform float shininess;
+// std140 blocks, the same in both shaders: FrameBlock and LightBlock are written by RenderScene(),
+// MaterialBlock is a range of the uniform buffer of the model
+layout (std140) uniform FrameBlock
+{
+    vec3 cameraPosition;
+    int curLightMode;
+    float shininess;
+    int isPerPixLighting;
+    int sideBySide;
+};
+
+layout (std140) uniform LightBlock
+{
+    LightInfo lightSources;
+    SpotLightInfo spotLightInfo;
+};
+
+layout (std140) uniform MaterialBlock
+{
+    PhongMaterial material;
+};
 
 vec3 directionalLight(vec3 vertexPosition, vec3 vertexNormal)
 {
@@ -115,9 +133,20 @@ void main()
     */
     // [TODO]
    gl_Position = MVP * vec4(aPos, 1.0f);
+   perPixelLighting = isPerPixLighting;
+   gl_ClipDistance[0] = 1.0;
+   if (sideBySide == 1)
+   {
+       // both views in one draw: instance 0 is squeezed into the left half with per-vertex lighting,
+       // instance 1 into the right half with per-pixel lighting, the clip distance cuts at the middle
+       float side = (gl_InstanceID == 0) ? -1.0 : 1.0;
+       gl_Position.x = 0.5 * (gl_Position.x + side * gl_Position.w);
+       gl_ClipDistance[0] = side * gl_Position.x;
+       perPixelLighting = gl_InstanceID;
+   }
 
    vertex_pos = vec3(M * vec4(aPos, 1.0f));
-   vertex_normal = mat3(transpose(inverse(M))) * aNormal;
+   vertex_normal = N * aNormal;
 
    vec3 color;
     
@@ -61,6 +61,12 @@ THE SOFTWARE.
 #include <string>
 #include <vector>
 
+// `LoadObjParallel` needs std::thread(C++11).
+#if !defined(TINYOBJLOADER_HAS_THREADS) && \
+    (__cplusplus > 199711L || (defined(_MSVC_LANG) && _MSVC_LANG > 199711L))
+#define TINYOBJLOADER_HAS_THREADS
+#endif
+
 namespace tinyobj {
 
 // TODO(syoyo): Better C++11 detection for older compiler
@@ -396,6 +402,11 @@ struct attrib_t {
 struct callback_t {
   // W is optional and set to 1 if there is no `w` item in `v` line
   void (*vertex_cb)(void *user_data, real_t x, real_t y, real_t z, real_t w);
+  // Optional. Called for `v` lines instead of `vertex_cb` when set, with the
+  // vertex color extension(`v x y z r g b`) parsed as `LoadObj` does. r, g and
+  // b are 1 when the line has no color.
+  void (*vertex_color_cb)(void *user_data, real_t x, real_t y, real_t z,
+                          real_t r, real_t g, real_t b);
   void (*normal_cb)(void *user_data, real_t x, real_t y, real_t z);
 
   // y and z are optional and set to 0 if there is no `y` and/or `z` item(s) in
@@ -419,6 +430,7 @@ struct callback_t {
 
   callback_t()
       : vertex_cb(NULL),
+        vertex_color_cb(NULL),
         normal_cb(NULL),
         texcoord_cb(NULL),
         index_cb(NULL),
@@ -445,8 +457,11 @@ class MaterialReader {
 class MaterialFileReader : public MaterialReader {
  public:
   // Path could contain separator(';' in Windows, ':' in Posix)
-  explicit MaterialFileReader(const std::string &mtl_basedir)
-      : m_mtlBaseDir(mtl_basedir) {}
+  // When `use_mmap` is true, .mtl files are memory mapped instead of being
+  // read through std::ifstream.
+  explicit MaterialFileReader(const std::string &mtl_basedir,
+                              bool use_mmap = false)
+      : m_mtlBaseDir(mtl_basedir), m_useMmap(use_mmap) {}
   virtual ~MaterialFileReader() TINYOBJ_OVERRIDE {}
   virtual bool operator()(const std::string &matId,
                           std::vector<material_t> *materials,
@@ -455,6 +470,7 @@ class MaterialFileReader : public MaterialReader {
 
  private:
   std::string m_mtlBaseDir;
+  bool m_useMmap;
 };
 
 ///
@@ -575,6 +591,30 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
              const char *mtl_basedir = NULL, bool triangulate = true,
              bool default_vcols_fallback = true);
 
+/// Loads .obj from a file like `LoadObj`, but reads it through a read-only
+/// memory mapping and tokenizes the lines in place instead of copying them
+/// out of a std::ifstream. .mtl files referenced by `mtllib` are memory mapped
+/// as well. Produces the same `attrib`, `shapes` and `materials` as `LoadObj`.
+bool LoadObjMapped(attrib_t *attrib, std::vector<shape_t> *shapes,
+                   std::vector<material_t> *materials, std::string *warn,
+                   std::string *err, const char *filename,
+                   const char *mtl_basedir = NULL, bool triangulate = true,
+                   bool default_vcols_fallback = true);
+
+#ifdef TINYOBJLOADER_HAS_THREADS
+/// Loads .obj from a file like `LoadObjMapped`, but splits the file into
+/// chunks of whole lines and parses them on `num_threads` threads.
+/// `num_threads` 0 uses std::thread::hardware_concurrency(). Small files are
+/// parsed on the calling thread. Produces the same `attrib`, `shapes` and
+/// `materials` as `LoadObj`.
+bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                     std::vector<material_t> *materials, std::string *warn,
+                     std::string *err, const char *filename,
+                     const char *mtl_basedir = NULL, bool triangulate = true,
+                     bool default_vcols_fallback = true,
+                     unsigned int num_threads = 0);
+#endif
+
 /// Loads .obj from a file with custom user callback.
 /// .mtl is loaded as usual and parsed material_t data will be passed to
 /// `callback.mtllib_cb`.
@@ -586,6 +626,24 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
                          MaterialReader *readMatFn = NULL,
                          std::string *warn = NULL, std::string *err = NULL);
 
+/// Loads .obj from a file with custom user callback like
+/// `LoadObjWithCallback`, but reads it through a read-only memory mapping like
+/// `LoadObjMapped`. .mtl files are searched in `mtl_basedir`.
+bool LoadObjWithCallbackMapped(const char *filename, const callback_t &callback,
+                               void *user_data = NULL,
+                               const char *mtl_basedir = NULL,
+                               std::string *warn = NULL,
+                               std::string *err = NULL);
+
+/// Triangulates a polygon the way `LoadObj` does with `triangulate`, for the
+/// users of `LoadObjWithCallback`. `indices` are the `num_indices` corners of
+/// the polygon with 0-based indices, `vertices` the positions(x, y, z) they
+/// refer to. Appends 3 corners per triangle to `triangles`. A degenerated
+/// polygon may give less than `num_indices` - 2 triangles.
+void TriangulatePolygon(const index_t *indices, int num_indices,
+                        const std::vector<real_t> &vertices,
+                        std::vector<index_t> *triangles);
+
 /// Loads object from a std::istream, uses `readMatFn` to retrieve
 /// std::istream for materials.
 /// Returns true when loading .obj become success.
@@ -631,6 +689,25 @@ bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
 #include <fstream>
 #include <sstream>
 
+#ifdef TINYOBJLOADER_HAS_THREADS
+#include <thread>
+#endif
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace tinyobj {
 
 MaterialReader::~MaterialReader() {}
@@ -739,6 +816,200 @@ static std::istream &safeGetline(std::istream &is, std::string &t) {
   return is;
 }
 
+// Read-only memory mapping of a whole file.
+// An empty file maps to `data() == NULL` and `size() == 0`.
+class MappedFile {
+ public:
+  MappedFile()
+      : data_(NULL),
+        size_(0)
+#ifdef _WIN32
+        ,
+        file_(INVALID_HANDLE_VALUE),
+        mapping_(NULL)
+#endif
+  {
+  }
+  ~MappedFile() { Close(); }
+
+  bool Open(const char *filename) {
+    Close();
+#ifdef _WIN32
+    file_ = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(file_, &fsize)) {
+      Close();
+      return false;
+    }
+    size_ = static_cast<size_t>(fsize.QuadPart);
+    if (size_ > 0) {
+      mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (!mapping_) {
+        Close();
+        return false;
+      }
+      data_ = static_cast<const char *>(
+          MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+      if (!data_) {
+        Close();
+        return false;
+      }
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat sb;
+    if ((fstat(fd, &sb) != 0) || !S_ISREG(sb.st_mode)) {
+      close(fd);
+      return false;
+    }
+    size_ = static_cast<size_t>(sb.st_size);
+    if (size_ > 0) {
+      void *p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        size_ = 0;
+        return false;
+      }
+#ifdef MADV_SEQUENTIAL
+      madvise(p, size_, MADV_SEQUENTIAL);
+#endif
+      data_ = static_cast<const char *>(p);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+#endif
+    return true;
+  }
+
+  void Close() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_) munmap(const_cast<char *>(data_), size_);
+#endif
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+  const char *data_;
+  size_t size_;
+#ifdef _WIN32
+  HANDLE file_;
+  HANDLE mapping_;
+#endif
+};
+
+// std::streambuf reading straight from a memory range(e.g. a mapped file).
+class MemoryStreamBuf : public std::streambuf {
+ public:
+  MemoryStreamBuf(const char *begin, const char *end) {
+    setg(const_cast<char *>(begin), const_cast<char *>(begin),
+         const_cast<char *>(end));
+  }
+};
+
+//
+// Line readers for the .obj parser.
+// `Next` hands out one line as a [begin, end) range with the line break
+// removed. `*end` is always '\0', '\r' or '\n', so the token parsers, which
+// stop at any of those, never run into the next line.
+//
+class StreamLineReader {
+ public:
+  explicit StreamLineReader(std::istream &is) : is_(is) {}
+
+  bool Next(const char **begin, const char **end) {
+    if (is_.peek() == -1) {
+      return false;
+    }
+    safeGetline(is_, linebuf_);
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf_.size() > 0) {
+      if (linebuf_[linebuf_.size() - 1] == '\n')
+        linebuf_.erase(linebuf_.size() - 1);
+    }
+    if (linebuf_.size() > 0) {
+      if (linebuf_[linebuf_.size() - 1] == '\r')
+        linebuf_.erase(linebuf_.size() - 1);
+    }
+
+    (*begin) = linebuf_.c_str();
+    (*end) = (*begin) + linebuf_.size();
+    return true;
+  }
+
+ private:
+  StreamLineReader &operator=(const StreamLineReader &);
+
+  std::istream &is_;
+  std::string linebuf_;
+};
+
+// Splits lines in place out of a memory range. Accepts the same line breaks
+// as `safeGetline`('\n', '\r\n' and '\r').
+class MappedLineReader {
+ public:
+  MappedLineReader(const char *begin, const char *end) : p_(begin), end_(end) {}
+
+  bool Next(const char **begin, const char **end) {
+    if (p_ >= end_) {
+      return false;
+    }
+
+    const char *nl =
+        static_cast<const char *>(memchr(p_, '\n', size_t(end_ - p_)));
+    const char *line_end = nl ? nl : end_;
+    const char *next = nl ? nl + 1 : end_;
+
+    // Parsers skip " \t\r" between tokens, so the line break must be followed
+    // by '\n' to stop them in place. The last line of the file and lines ending
+    // with a lone '\r' are copied out instead.
+    bool in_place = (nl != NULL);
+    const char *cr =
+        static_cast<const char *>(memchr(p_, '\r', size_t(line_end - p_)));
+    if (cr) {
+      in_place = (cr + 1 == nl);
+      next = in_place ? nl + 1 : cr + 1;
+      line_end = cr;
+    }
+
+    if (!in_place) {
+      tail_.assign(p_, line_end);
+      (*begin) = tail_.c_str();
+      (*end) = (*begin) + tail_.size();
+    } else {
+      (*begin) = p_;
+      (*end) = line_end;
+    }
+    p_ = next;
+    return true;
+  }
+
+ private:
+  const char *p_;
+  const char *end_;
+  std::string tail_;
+};
+
 #define IS_SPACE(x) (((x) == ' ') || ((x) == '\t'))
 #define IS_DIGIT(x) \
   (static_cast<unsigned int>((x) - '0') < static_cast<unsigned int>(10))
@@ -768,50 +1039,63 @@ static inline bool fixIndex(int idx, int n, int *ret) {
   return false;  // never reach here.
 }
 
+// Parses `[sign] digit {digit}` like atoi(), but without the strtol() call and
+// its locale lookup. Returns the location just after the digits.
+static inline const char *scanInt(const char *s, int *value) {
+  bool negative = false;
+  if (*s == '+' || *s == '-') {
+    negative = (*s == '-');
+    s++;
+  }
+
+  unsigned int u = 0;
+  while (IS_DIGIT(*s)) {
+    u = u * 10 + static_cast<unsigned int>(*s - '0');
+    s++;
+  }
+
+  (*value) = static_cast<int>(negative ? 0u - u : u);
+  return s;
+}
+
+// atoi() skips any leading whitespace, including line breaks. Lines handed
+// out by the mapped file reader are not NUL-terminated, so stop at the line
+// end instead of picking up a number from the next line.
+static inline int atoiLine(const char *s) {
+  while (IS_SPACE(*s)) s++;
+  if (IS_NEW_LINE(*s)) {
+    return 0;
+  }
+  if (*s == '\v' || *s == '\f') {
+    return atoi(s);  // other whitespace atoi() skips. rare.
+  }
+
+  int i;
+  scanInt(s, &i);
+  return i;
+}
+
 static inline std::string parseString(const char **token) {
   std::string s;
   (*token) += strspn((*token), " \t");
-  size_t e = strcspn((*token), " \t\r");
+  size_t e = strcspn((*token), " \t\r\n");
   s = std::string((*token), &(*token)[e]);
   (*token) += e;
   return s;
 }
 
 static inline int parseInt(const char **token) {
-  (*token) += strspn((*token), " \t");
-  int i = atoi((*token));
-  (*token) += strcspn((*token), " \t\r");
+  while (IS_SPACE(**token)) (*token)++;
+  int i = atoiLine((*token));
+  (*token) += strcspn((*token), " \t\r\n");
   return i;
 }
 
-// Tries to parse a floating point number located at s.
-//
-// s_end should be a location in the string where reading should absolutely
-// stop. For example at the end of the string, to prevent buffer overflows.
-//
-// Parses the following EBNF grammar:
-//   sign    = "+" | "-" ;
-//   END     = ? anything not in digit ?
-//   digit   = "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9" ;
-//   integer = [sign] , digit , {digit} ;
-//   decimal = integer , ["." , integer] ;
-//   float   = ( decimal , END ) | ( decimal , ("E" | "e") , integer , END ) ;
-//
-//  Valid strings are for example:
-//   -0  +3.1417e+2  -0.0E-3  1.0324  -1.41   11e2
-//
-// If the parsing is a success, result is set to the parsed value and true
-// is returned.
-//
-// The function is greedy and will parse until any of the following happens:
-//  - a non-conforming character is encountered.
-//  - s_end is reached.
-//
-// The following situations triggers a failure:
-//  - s >= s_end.
-//  - parse failure.
-//
-static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+// Digit by digit version of `parseDouble`, for the numbers which do not fit its
+// fast path(more than 19 significant digits, or large exponents). `s_end` must
+// not be NULL.
+static bool tryParseDoubleSlow(const char *s, const char *s_end,
+                               double *result) {
   if (s >= s_end) {
     return false;
   }
@@ -937,27 +1221,182 @@ fail:
   return false;
 }
 
+// Tries to parse a floating point number located at s.
+//
+// s_end should be a location in the string where reading should absolutely
+// stop. For example at the end of the string, to prevent buffer overflows.
+//
+// Parses the following EBNF grammar:
+//   sign    = "+" | "-" ;
+//   END     = ? anything not in digit ?
+//   digit   = "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9" ;
+//   integer = [sign] , digit , {digit} ;
+//   decimal = integer , ["." , integer] ;
+//   float   = ( decimal , END ) | ( decimal , ("E" | "e") , integer , END ) ;
+//
+//  Valid strings are for example:
+//   -0  +3.1417e+2  -0.0E-3  1.0324  -1.41   11e2
+//
+// If the parsing is a success, result is set to the parsed value and the
+// location just after the number is returned.
+//
+// The function is greedy and will parse until any of the following happens:
+//  - a non-conforming character is encountered.
+//  - s_end is reached.
+//
+// `s_end` may be NULL when the number is followed by a delimiter(a space, a
+// line break or a NUL), since these stop the parsing as well.
+//
+// The following situations triggers a failure(NULL is returned):
+//  - s >= s_end.
+//  - parse failure.
+//
+// The digits are collected into an integer, and the value is assembled with
+// a single multiplication or division by an exact power of ten, like the
+// fast path of Eisel-Lemire/std::from_chars. This is correctly rounded and
+// needs neither std::pow nor std::ldexp.
+//
+static const char *parseDouble(const char *s, const char *s_end,
+                               double *result) {
+  // 10^0 ... 10^22 are exact in a double.
+  static const double pow10_lut[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  const int max_pow10 = 22;
+  const int max_digits = 19;  // fits in 64bit
+  const unsigned long long max_exact_mantissa = 1ULL << 53;
+
+  if (s_end && s >= s_end) {
+    return NULL;
+  }
+
+  const char *curr = s;
+  bool negative = false;
+  bool leading_decimal_dots = false;
+
+  // Find out what sign we've got.
+  if (*curr == '+' || *curr == '-') {
+    negative = (*curr == '-');
+    curr++;
+    if ((curr != s_end) && (*curr == '.')) {
+      // accept. Somethig like `.7e+2`, `-.5234`
+      leading_decimal_dots = true;
+    }
+  } else if (IS_DIGIT(*curr)) { /* Pass through. */
+  } else if (*curr == '.') {
+    // accept. Somethig like `.7e+2`, `-.5234`
+    leading_decimal_dots = true;
+  } else {
+    return NULL;
+  }
+
+  unsigned long long mantissa = 0;
+  int num_digits = 0;  // significant digits in `mantissa`
+  int exponent = 0;    // base 10
+  bool truncated = false;
+
+  // Read the integer part.
+  if (!leading_decimal_dots) {
+    const char *digits = curr;
+    while ((curr != s_end) && IS_DIGIT(*curr)) {
+      if (num_digits < max_digits) {
+        mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+        num_digits += (mantissa != 0);
+      } else {
+        exponent++;
+        truncated = true;
+      }
+      curr++;
+    }
+
+    // We must make sure we actually got something.
+    if (curr == digits) return NULL;
+  }
+
+  // Read the decimal part.
+  if ((curr != s_end) && (*curr == '.')) {
+    curr++;
+    while ((curr != s_end) && IS_DIGIT(*curr)) {
+      if (num_digits < max_digits) {
+        mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+        num_digits += (mantissa != 0);
+        exponent--;
+      } else {
+        truncated = true;
+      }
+      curr++;
+    }
+  }
+
+  // Read the exponent part.
+  if ((curr != s_end) && (*curr == 'e' || *curr == 'E')) {
+    curr++;
+    bool exp_negative = false;
+    if ((curr != s_end) && (*curr == '+' || *curr == '-')) {
+      exp_negative = (*curr == '-');
+      curr++;
+    } else if ((curr != s_end) && IS_DIGIT(*curr)) { /* Pass through. */
+    } else {
+      // Empty E is not allowed.
+      return NULL;
+    }
+
+    const char *digits = curr;
+    int exp = 0;
+    while ((curr != s_end) && IS_DIGIT(*curr)) {
+      if (exp < 100000) {  // saturate. far out of the range of a double.
+        exp = exp * 10 + (*curr - '0');
+      }
+      curr++;
+    }
+    if (curr == digits) return NULL;
+
+    exponent += exp_negative ? -exp : exp;
+  }
+
+  if (truncated || mantissa > max_exact_mantissa ||
+      exponent < -max_pow10 || exponent > max_pow10) {
+    return tryParseDoubleSlow(s, curr, result) ? curr : NULL;
+  }
+
+  double value = static_cast<double>(mantissa);
+  if (exponent < 0) {
+    value /= pow10_lut[-exponent];
+  } else {
+    value *= pow10_lut[exponent];
+  }
+  *result = negative ? -value : value;
+  return curr;
+}
+
+// Skips the rest of a token after a number, e.g. garbage like `1.0abc`.
+static inline const char *skipToken(const char *s) {
+  if (IS_SPACE(*s) || IS_NEW_LINE(*s)) {
+    return s;
+  }
+  return s + strcspn(s, " \t\r\n");
+}
+
 static inline real_t parseReal(const char **token, double default_value = 0.0) {
-  (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
+  while (IS_SPACE(**token)) (*token)++;
   double val = default_value;
-  tryParseDouble((*token), end, &val);
+  const char *end = parseDouble((*token), NULL, &val);
   real_t f = static_cast<real_t>(val);
-  (*token) = end;
+  (*token) = skipToken(end ? end : (*token));
   return f;
 }
 
 static inline bool parseReal(const char **token, real_t *out) {
-  (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
+  while (IS_SPACE(**token)) (*token)++;
   double val;
-  bool ret = tryParseDouble((*token), end, &val);
-  if (ret) {
+  const char *end = parseDouble((*token), NULL, &val);
+  if (end) {
     real_t f = static_cast<real_t>(val);
     (*out) = f;
   }
-  (*token) = end;
-  return ret;
+  (*token) = skipToken(end ? end : (*token));
+  return end != NULL;
 }
 
 static inline void parseReal2(real_t *x, real_t *y, const char **token,
@@ -1010,7 +1449,7 @@ static inline bool parseVertexWithColor(real_t *x, real_t *y, real_t *z,
 
 static inline bool parseOnOff(const char **token, bool default_value = true) {
   (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
+  const char *end = (*token) + strcspn((*token), " \t\r\n");
 
   bool ret = default_value;
   if ((0 == strncmp((*token), "on", 2))) {
@@ -1026,7 +1465,7 @@ static inline bool parseOnOff(const char **token, bool default_value = true) {
 static inline texture_type_t parseTextureType(
     const char **token, texture_type_t default_value = TEXTURE_TYPE_NONE) {
   (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
+  const char *end = (*token) + strcspn((*token), " \t\r\n");
   texture_type_t ty = default_value;
 
   if ((0 == strncmp((*token), "cube_top", strlen("cube_top")))) {
@@ -1049,12 +1488,29 @@ static inline texture_type_t parseTextureType(
   return ty;
 }
 
+// `atoiLine` followed by skipping to the next '/' or the end of the token, in
+// one pass over the digits.
+static inline int parseIndex(const char **token) {
+  const char *s = (*token);
+  int i;
+  if (IS_DIGIT(*s) || *s == '-' || *s == '+') {
+    s = scanInt(s, &i);
+    if (*s != '/' && !IS_SPACE(*s) && !IS_NEW_LINE(*s)) {
+      s += strcspn(s, "/ \t\r\n");
+    }
+  } else {
+    i = atoiLine(s);
+    s += strcspn(s, "/ \t\r\n");
+  }
+  (*token) = s;
+  return i;
+}
+
 static tag_sizes parseTagTriple(const char **token) {
   tag_sizes ts;
 
   (*token) += strspn((*token), " \t");
-  ts.num_ints = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  ts.num_ints = parseIndex(token);
   if ((*token)[0] != '/') {
     return ts;
   }
@@ -1062,8 +1518,7 @@ static tag_sizes parseTagTriple(const char **token) {
   (*token)++;  // Skip '/'
 
   (*token) += strspn((*token), " \t");
-  ts.num_reals = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  ts.num_reals = parseIndex(token);
   if ((*token)[0] != '/') {
     return ts;
   }
@@ -1083,11 +1538,10 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
 
   vertex_index_t vi(-1);
 
-  if (!fixIndex(atoi((*token)), vsize, &(vi.v_idx))) {
+  if (!fixIndex(parseIndex(token), vsize, &(vi.v_idx))) {
     return false;
   }
 
-  (*token) += strcspn((*token), "/ \t\r");
   if ((*token)[0] != '/') {
     (*ret) = vi;
     return true;
@@ -1097,20 +1551,18 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
   // i//k
   if ((*token)[0] == '/') {
     (*token)++;
-    if (!fixIndex(atoi((*token)), vnsize, &(vi.vn_idx))) {
+    if (!fixIndex(parseIndex(token), vnsize, &(vi.vn_idx))) {
       return false;
     }
-    (*token) += strcspn((*token), "/ \t\r");
     (*ret) = vi;
     return true;
   }
 
   // i/j/k or i/j
-  if (!fixIndex(atoi((*token)), vtsize, &(vi.vt_idx))) {
+  if (!fixIndex(parseIndex(token), vtsize, &(vi.vt_idx))) {
     return false;
   }
 
-  (*token) += strcspn((*token), "/ \t\r");
   if ((*token)[0] != '/') {
     (*ret) = vi;
     return true;
@@ -1118,10 +1570,9 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
 
   // i/j/k
   (*token)++;  // skip '/'
-  if (!fixIndex(atoi((*token)), vnsize, &(vi.vn_idx))) {
+  if (!fixIndex(parseIndex(token), vnsize, &(vi.vn_idx))) {
     return false;
   }
-  (*token) += strcspn((*token), "/ \t\r");
 
   (*ret) = vi;
 
@@ -1132,8 +1583,7 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
 static vertex_index_t parseRawTriple(const char **token) {
   vertex_index_t vi(static_cast<int>(0));  // 0 is an invalid index in OBJ
 
-  vi.v_idx = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  vi.v_idx = parseIndex(token);
   if ((*token)[0] != '/') {
     return vi;
   }
@@ -1142,22 +1592,19 @@ static vertex_index_t parseRawTriple(const char **token) {
   // i//k
   if ((*token)[0] == '/') {
     (*token)++;
-    vi.vn_idx = atoi((*token));
-    (*token) += strcspn((*token), "/ \t\r");
+    vi.vn_idx = parseIndex(token);
     return vi;
   }
 
   // i/j/k or i/j
-  vi.vt_idx = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  vi.vt_idx = parseIndex(token);
   if ((*token)[0] != '/') {
     return vi;
   }
 
   // i/j/k
   (*token)++;  // skip '/'
-  vi.vn_idx = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  vi.vn_idx = parseIndex(token);
   return vi;
 }
 
@@ -1339,236 +1786,220 @@ static int pnpoly(int nvert, T *vertx, T *verty, T testx, T testy) {
   return c;
 }
 
-// TODO(syoyo): refactor function.
-static bool exportGroupsToShape(shape_t *shape, const PrimGroup &prim_group,
-                                const std::vector<tag_t> &tags,
-                                const int material_id, const std::string &name,
-                                bool triangulate,
-                                const std::vector<real_t> &v) {
-  if (prim_group.IsEmpty()) {
-    return false;
+// Triangulates a polygon face(3 or more corners) by ear clipping in the plane
+// it spans the most, and appends the corners of the triangles to `triangles`.
+// `v_size` is the number of `v` elements that can be referenced.
+static void triangulateFace(const std::vector<vertex_index_t> &face,
+                            const std::vector<real_t> &v, size_t v_size,
+                            std::vector<vertex_index_t> *triangles) {
+  size_t npolys = face.size();
+  if (npolys == 3) {
+    triangles->insert(triangles->end(), face.begin(), face.end());
+    return;
+  }
+
+  // find the two axes to work in
+  size_t axes[2] = {1, 2};
+  for (size_t k = 0; k < npolys; ++k) {
+    vertex_index_t i0 = face[(k + 0) % npolys];
+    vertex_index_t i1 = face[(k + 1) % npolys];
+    vertex_index_t i2 = face[(k + 2) % npolys];
+    size_t vi0 = size_t(i0.v_idx);
+    size_t vi1 = size_t(i1.v_idx);
+    size_t vi2 = size_t(i2.v_idx);
+
+    if (((3 * vi0 + 2) >= v_size) || ((3 * vi1 + 2) >= v_size) ||
+        ((3 * vi2 + 2) >= v_size)) {
+      // Invalid triangle.
+      // FIXME(syoyo): Is it ok to simply skip this invalid triangle?
+      continue;
+    }
+    real_t v0x = v[vi0 * 3 + 0];
+    real_t v0y = v[vi0 * 3 + 1];
+    real_t v0z = v[vi0 * 3 + 2];
+    real_t v1x = v[vi1 * 3 + 0];
+    real_t v1y = v[vi1 * 3 + 1];
+    real_t v1z = v[vi1 * 3 + 2];
+    real_t v2x = v[vi2 * 3 + 0];
+    real_t v2y = v[vi2 * 3 + 1];
+    real_t v2z = v[vi2 * 3 + 2];
+    real_t e0x = v1x - v0x;
+    real_t e0y = v1y - v0y;
+    real_t e0z = v1z - v0z;
+    real_t e1x = v2x - v1x;
+    real_t e1y = v2y - v1y;
+    real_t e1z = v2z - v1z;
+    real_t cx = std::fabs(e0y * e1z - e0z * e1y);
+    real_t cy = std::fabs(e0z * e1x - e0x * e1z);
+    real_t cz = std::fabs(e0x * e1y - e0y * e1x);
+    const real_t epsilon = std::numeric_limits<real_t>::epsilon();
+    if (cx > epsilon || cy > epsilon || cz > epsilon) {
+      // found a corner
+      if (cx > cy && cx > cz) {
+      } else {
+        axes[0] = 0;
+        if (cz > cx && cz > cy) axes[1] = 1;
+      }
+      break;
+    }
   }
 
-  shape->name = name;
+  real_t area = 0;
+  for (size_t k = 0; k < npolys; ++k) {
+    vertex_index_t i0 = face[(k + 0) % npolys];
+    vertex_index_t i1 = face[(k + 1) % npolys];
+    size_t vi0 = size_t(i0.v_idx);
+    size_t vi1 = size_t(i1.v_idx);
+    if (((vi0 * 3 + axes[0]) >= v_size) || ((vi0 * 3 + axes[1]) >= v_size) ||
+        ((vi1 * 3 + axes[0]) >= v_size) || ((vi1 * 3 + axes[1]) >= v_size)) {
+      // Invalid index.
+      continue;
+    }
+    real_t v0x = v[vi0 * 3 + axes[0]];
+    real_t v0y = v[vi0 * 3 + axes[1]];
+    real_t v1x = v[vi1 * 3 + axes[0]];
+    real_t v1y = v[vi1 * 3 + axes[1]];
+    area += (v0x * v1y - v0y * v1x) * static_cast<real_t>(0.5);
+  }
 
-  // polygon
-  if (!prim_group.faceGroup.empty()) {
-    // Flatten vertices and indices
-    for (size_t i = 0; i < prim_group.faceGroup.size(); i++) {
-      const face_t &face = prim_group.faceGroup[i];
+  std::vector<vertex_index_t> remainingFace = face;  // copy
+  size_t guess_vert = 0;
+  vertex_index_t ind[3];
+  real_t vx[3];
+  real_t vy[3];
 
-      size_t npolys = face.vertex_indices.size();
+  // How many iterations can we do without decreasing the remaining
+  // vertices.
+  size_t remainingIterations = face.size();
+  size_t previousRemainingVertices = remainingFace.size();
 
-      if (npolys < 3) {
-        // Face must have 3+ vertices.
+  while (remainingFace.size() > 3 && remainingIterations > 0) {
+    npolys = remainingFace.size();
+    if (guess_vert >= npolys) {
+      guess_vert -= npolys;
+    }
+
+    if (previousRemainingVertices != npolys) {
+      // The number of remaining vertices decreased. Reset counters.
+      previousRemainingVertices = npolys;
+      remainingIterations = npolys;
+    } else {
+      // We didn't consume a vertex on previous iteration, reduce the
+      // available iterations.
+      remainingIterations--;
+    }
+
+    for (size_t k = 0; k < 3; k++) {
+      ind[k] = remainingFace[(guess_vert + k) % npolys];
+      size_t vi = size_t(ind[k].v_idx);
+      if (((vi * 3 + axes[0]) >= v_size) || ((vi * 3 + axes[1]) >= v_size)) {
+        // ???
+        vx[k] = static_cast<real_t>(0.0);
+        vy[k] = static_cast<real_t>(0.0);
+      } else {
+        vx[k] = v[vi * 3 + axes[0]];
+        vy[k] = v[vi * 3 + axes[1]];
+      }
+    }
+    real_t e0x = vx[1] - vx[0];
+    real_t e0y = vy[1] - vy[0];
+    real_t e1x = vx[2] - vx[1];
+    real_t e1y = vy[2] - vy[1];
+    real_t cross = e0x * e1y - e0y * e1x;
+    // if an internal angle
+    if (cross * area < static_cast<real_t>(0.0)) {
+      guess_vert += 1;
+      continue;
+    }
+
+    // check all other verts in case they are inside this triangle
+    bool overlap = false;
+    for (size_t otherVert = 3; otherVert < npolys; ++otherVert) {
+      size_t idx = (guess_vert + otherVert) % npolys;
+
+      if (idx >= remainingFace.size()) {
+        // ???
         continue;
       }
 
-      vertex_index_t i0 = face.vertex_indices[0];
-      vertex_index_t i1(-1);
-      vertex_index_t i2 = face.vertex_indices[1];
+      size_t ovi = size_t(remainingFace[idx].v_idx);
 
-      if (triangulate) {
-        // find the two axes to work in
-        size_t axes[2] = {1, 2};
-        for (size_t k = 0; k < npolys; ++k) {
-          i0 = face.vertex_indices[(k + 0) % npolys];
-          i1 = face.vertex_indices[(k + 1) % npolys];
-          i2 = face.vertex_indices[(k + 2) % npolys];
-          size_t vi0 = size_t(i0.v_idx);
-          size_t vi1 = size_t(i1.v_idx);
-          size_t vi2 = size_t(i2.v_idx);
-
-          if (((3 * vi0 + 2) >= v.size()) || ((3 * vi1 + 2) >= v.size()) ||
-              ((3 * vi2 + 2) >= v.size())) {
-            // Invalid triangle.
-            // FIXME(syoyo): Is it ok to simply skip this invalid triangle?
-            continue;
-          }
-          real_t v0x = v[vi0 * 3 + 0];
-          real_t v0y = v[vi0 * 3 + 1];
-          real_t v0z = v[vi0 * 3 + 2];
-          real_t v1x = v[vi1 * 3 + 0];
-          real_t v1y = v[vi1 * 3 + 1];
-          real_t v1z = v[vi1 * 3 + 2];
-          real_t v2x = v[vi2 * 3 + 0];
-          real_t v2y = v[vi2 * 3 + 1];
-          real_t v2z = v[vi2 * 3 + 2];
-          real_t e0x = v1x - v0x;
-          real_t e0y = v1y - v0y;
-          real_t e0z = v1z - v0z;
-          real_t e1x = v2x - v1x;
-          real_t e1y = v2y - v1y;
-          real_t e1z = v2z - v1z;
-          real_t cx = std::fabs(e0y * e1z - e0z * e1y);
-          real_t cy = std::fabs(e0z * e1x - e0x * e1z);
-          real_t cz = std::fabs(e0x * e1y - e0y * e1x);
-          const real_t epsilon = std::numeric_limits<real_t>::epsilon();
-          if (cx > epsilon || cy > epsilon || cz > epsilon) {
-            // found a corner
-            if (cx > cy && cx > cz) {
-            } else {
-              axes[0] = 0;
-              if (cz > cx && cz > cy) axes[1] = 1;
-            }
-            break;
-          }
-        }
-
-        real_t area = 0;
-        for (size_t k = 0; k < npolys; ++k) {
-          i0 = face.vertex_indices[(k + 0) % npolys];
-          i1 = face.vertex_indices[(k + 1) % npolys];
-          size_t vi0 = size_t(i0.v_idx);
-          size_t vi1 = size_t(i1.v_idx);
-          if (((vi0 * 3 + axes[0]) >= v.size()) ||
-              ((vi0 * 3 + axes[1]) >= v.size()) ||
-              ((vi1 * 3 + axes[0]) >= v.size()) ||
-              ((vi1 * 3 + axes[1]) >= v.size())) {
-            // Invalid index.
-            continue;
-          }
-          real_t v0x = v[vi0 * 3 + axes[0]];
-          real_t v0y = v[vi0 * 3 + axes[1]];
-          real_t v1x = v[vi1 * 3 + axes[0]];
-          real_t v1y = v[vi1 * 3 + axes[1]];
-          area += (v0x * v1y - v0y * v1x) * static_cast<real_t>(0.5);
-        }
-
-        face_t remainingFace = face;  // copy
-        size_t guess_vert = 0;
-        vertex_index_t ind[3];
-        real_t vx[3];
-        real_t vy[3];
-
-        // How many iterations can we do without decreasing the remaining
-        // vertices.
-        size_t remainingIterations = face.vertex_indices.size();
-        size_t previousRemainingVertices = remainingFace.vertex_indices.size();
-
-        while (remainingFace.vertex_indices.size() > 3 &&
-               remainingIterations > 0) {
-          npolys = remainingFace.vertex_indices.size();
-          if (guess_vert >= npolys) {
-            guess_vert -= npolys;
-          }
-
-          if (previousRemainingVertices != npolys) {
-            // The number of remaining vertices decreased. Reset counters.
-            previousRemainingVertices = npolys;
-            remainingIterations = npolys;
-          } else {
-            // We didn't consume a vertex on previous iteration, reduce the
-            // available iterations.
-            remainingIterations--;
-          }
+      if (((ovi * 3 + axes[0]) >= v_size) || ((ovi * 3 + axes[1]) >= v_size)) {
+        // ???
+        continue;
+      }
+      real_t tx = v[ovi * 3 + axes[0]];
+      real_t ty = v[ovi * 3 + axes[1]];
+      if (pnpoly(3, vx, vy, tx, ty)) {
+        overlap = true;
+        break;
+      }
+    }
 
-          for (size_t k = 0; k < 3; k++) {
-            ind[k] = remainingFace.vertex_indices[(guess_vert + k) % npolys];
-            size_t vi = size_t(ind[k].v_idx);
-            if (((vi * 3 + axes[0]) >= v.size()) ||
-                ((vi * 3 + axes[1]) >= v.size())) {
-              // ???
-              vx[k] = static_cast<real_t>(0.0);
-              vy[k] = static_cast<real_t>(0.0);
-            } else {
-              vx[k] = v[vi * 3 + axes[0]];
-              vy[k] = v[vi * 3 + axes[1]];
-            }
-          }
-          real_t e0x = vx[1] - vx[0];
-          real_t e0y = vy[1] - vy[0];
-          real_t e1x = vx[2] - vx[1];
-          real_t e1y = vy[2] - vy[1];
-          real_t cross = e0x * e1y - e0y * e1x;
-          // if an internal angle
-          if (cross * area < static_cast<real_t>(0.0)) {
-            guess_vert += 1;
-            continue;
-          }
+    if (overlap) {
+      guess_vert += 1;
+      continue;
+    }
 
-          // check all other verts in case they are inside this triangle
-          bool overlap = false;
-          for (size_t otherVert = 3; otherVert < npolys; ++otherVert) {
-            size_t idx = (guess_vert + otherVert) % npolys;
+    // this triangle is an ear
+    triangles->push_back(ind[0]);
+    triangles->push_back(ind[1]);
+    triangles->push_back(ind[2]);
 
-            if (idx >= remainingFace.vertex_indices.size()) {
-              // ???
-              continue;
-            }
+    // remove v1 from the list
+    size_t removed_vert_index = (guess_vert + 1) % npolys;
+    while (removed_vert_index + 1 < npolys) {
+      remainingFace[removed_vert_index] = remainingFace[removed_vert_index + 1];
+      removed_vert_index += 1;
+    }
+    remainingFace.pop_back();
+  }
 
-            size_t ovi = size_t(remainingFace.vertex_indices[idx].v_idx);
+  if (remainingFace.size() == 3) {
+    triangles->push_back(remainingFace[0]);
+    triangles->push_back(remainingFace[1]);
+    triangles->push_back(remainingFace[2]);
+  }
+}
 
-            if (((ovi * 3 + axes[0]) >= v.size()) ||
-                ((ovi * 3 + axes[1]) >= v.size())) {
-              // ???
-              continue;
-            }
-            real_t tx = v[ovi * 3 + axes[0]];
-            real_t ty = v[ovi * 3 + axes[1]];
-            if (pnpoly(3, vx, vy, tx, ty)) {
-              overlap = true;
-              break;
-            }
-          }
+// TODO(syoyo): refactor function.
+static bool exportGroupsToShape(shape_t *shape, const PrimGroup &prim_group,
+                                const std::vector<tag_t> &tags,
+                                const int material_id, const std::string &name,
+                                bool triangulate,
+                                const std::vector<real_t> &v,
+                                size_t v_size) {
+  if (prim_group.IsEmpty()) {
+    return false;
+  }
 
-          if (overlap) {
-            guess_vert += 1;
-            continue;
-          }
+  shape->name = name;
 
-          // this triangle is an ear
-          {
-            index_t idx0, idx1, idx2;
-            idx0.vertex_index = ind[0].v_idx;
-            idx0.normal_index = ind[0].vn_idx;
-            idx0.texcoord_index = ind[0].vt_idx;
-            idx1.vertex_index = ind[1].v_idx;
-            idx1.normal_index = ind[1].vn_idx;
-            idx1.texcoord_index = ind[1].vt_idx;
-            idx2.vertex_index = ind[2].v_idx;
-            idx2.normal_index = ind[2].vn_idx;
-            idx2.texcoord_index = ind[2].vt_idx;
-
-            shape->mesh.indices.push_back(idx0);
-            shape->mesh.indices.push_back(idx1);
-            shape->mesh.indices.push_back(idx2);
+  // polygon
+  if (!prim_group.faceGroup.empty()) {
+    // Flatten vertices and indices
+    std::vector<vertex_index_t> triangles;
+    for (size_t i = 0; i < prim_group.faceGroup.size(); i++) {
+      const face_t &face = prim_group.faceGroup[i];
 
-            shape->mesh.num_face_vertices.push_back(3);
-            shape->mesh.material_ids.push_back(material_id);
-            shape->mesh.smoothing_group_ids.push_back(face.smoothing_group_id);
-          }
+      size_t npolys = face.vertex_indices.size();
 
-          // remove v1 from the list
-          size_t removed_vert_index = (guess_vert + 1) % npolys;
-          while (removed_vert_index + 1 < npolys) {
-            remainingFace.vertex_indices[removed_vert_index] =
-                remainingFace.vertex_indices[removed_vert_index + 1];
-            removed_vert_index += 1;
-          }
-          remainingFace.vertex_indices.pop_back();
-        }
+      if (npolys < 3) {
+        // Face must have 3+ vertices.
+        continue;
+      }
 
-        if (remainingFace.vertex_indices.size() == 3) {
-          i0 = remainingFace.vertex_indices[0];
-          i1 = remainingFace.vertex_indices[1];
-          i2 = remainingFace.vertex_indices[2];
-          {
-            index_t idx0, idx1, idx2;
-            idx0.vertex_index = i0.v_idx;
-            idx0.normal_index = i0.vn_idx;
-            idx0.texcoord_index = i0.vt_idx;
-            idx1.vertex_index = i1.v_idx;
-            idx1.normal_index = i1.vn_idx;
-            idx1.texcoord_index = i1.vt_idx;
-            idx2.vertex_index = i2.v_idx;
-            idx2.normal_index = i2.vn_idx;
-            idx2.texcoord_index = i2.vt_idx;
-
-            shape->mesh.indices.push_back(idx0);
-            shape->mesh.indices.push_back(idx1);
-            shape->mesh.indices.push_back(idx2);
+      if (triangulate) {
+        triangles.clear();
+        triangulateFace(face.vertex_indices, v, v_size, &triangles);
+        for (size_t k = 0; k < triangles.size(); k++) {
+          index_t idx;
+          idx.vertex_index = triangles[k].v_idx;
+          idx.normal_index = triangles[k].vn_idx;
+          idx.texcoord_index = triangles[k].vt_idx;
+          shape->mesh.indices.push_back(idx);
 
+          if (k % 3 == 2) {
             shape->mesh.num_face_vertices.push_back(3);
             shape->mesh.material_ids.push_back(material_id);
             shape->mesh.smoothing_group_ids.push_back(face.smoothing_group_id);
@@ -2055,6 +2486,30 @@ void LoadMtl(std::map<std::string, int> *material_map,
   }
 }
 
+// Returns false when `filepath` cannot be opened.
+static bool LoadMtlFromFile(const std::string &filepath, bool use_mmap,
+                            std::vector<material_t> *materials,
+                            std::map<std::string, int> *matMap,
+                            std::string *warn, std::string *err) {
+  if (use_mmap) {
+    MappedFile file;
+    if (!file.Open(filepath.c_str())) {
+      return false;
+    }
+    MemoryStreamBuf buf(file.data(), file.data() + file.size());
+    std::istream matIStream(&buf);
+    LoadMtl(matMap, materials, &matIStream, warn, err);
+    return true;
+  }
+
+  std::ifstream matIStream(filepath.c_str());
+  if (!matIStream) {
+    return false;
+  }
+  LoadMtl(matMap, materials, &matIStream, warn, err);
+  return true;
+}
+
 bool MaterialFileReader::operator()(const std::string &matId,
                                     std::vector<material_t> *materials,
                                     std::map<std::string, int> *matMap,
@@ -2078,10 +2533,7 @@ bool MaterialFileReader::operator()(const std::string &matId,
     for (size_t i = 0; i < paths.size(); i++) {
       std::string filepath = JoinPath(paths[i], matId);
 
-      std::ifstream matIStream(filepath.c_str());
-      if (matIStream) {
-        LoadMtl(matMap, materials, &matIStream, warn, err);
-
+      if (LoadMtlFromFile(filepath, m_useMmap, materials, matMap, warn, err)) {
         return true;
       }
     }
@@ -2096,10 +2548,7 @@ bool MaterialFileReader::operator()(const std::string &matId,
 
   } else {
     std::string filepath = matId;
-    std::ifstream matIStream(filepath.c_str());
-    if (matIStream) {
-      LoadMtl(matMap, materials, &matIStream, warn, err);
-
+    if (LoadMtlFromFile(filepath, m_useMmap, materials, matMap, warn, err)) {
       return true;
     }
 
@@ -2134,27 +2583,7 @@ bool MaterialStreamReader::operator()(const std::string &matId,
   return true;
 }
 
-bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
-             std::vector<material_t> *materials, std::string *warn,
-             std::string *err, const char *filename, const char *mtl_basedir,
-             bool trianglulate, bool default_vcols_fallback) {
-  attrib->vertices.clear();
-  attrib->normals.clear();
-  attrib->texcoords.clear();
-  attrib->colors.clear();
-  shapes->clear();
-
-  std::stringstream errss;
-
-  std::ifstream ifs(filename);
-  if (!ifs) {
-    errss << "Cannot open file [" << filename << "]" << std::endl;
-    if (err) {
-      (*err) = errss.str();
-    }
-    return false;
-  }
-
+static std::string MtlBaseDir(const char *mtl_basedir) {
   std::string baseDir = mtl_basedir ? mtl_basedir : "";
   if (!baseDir.empty()) {
 #ifndef _WIN32
@@ -2164,19 +2593,12 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
 #endif
     if (baseDir[baseDir.length() - 1] != dirsep) baseDir += dirsep;
   }
-  MaterialFileReader matFileReader(baseDir);
-
-  return LoadObj(attrib, shapes, materials, warn, err, &ifs, &matFileReader,
-                 trianglulate, default_vcols_fallback);
+  return baseDir;
 }
 
-bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
-             std::vector<material_t> *materials, std::string *warn,
-             std::string *err, std::istream *inStream,
-             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
-             bool default_vcols_fallback) {
-  std::stringstream errss;
-
+// Parser state of `LoadObj`. Shared by the serial and the parallel loader, so
+// that both of them turn the same lines into the same shapes.
+struct obj_parse_state_t {
   std::vector<real_t> v;
   std::vector<real_t> vn;
   std::vector<real_t> vt;
@@ -2187,442 +2609,329 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
 
   // material
   std::map<std::string, int> material_map;
-  int material = -1;
+  int material;
 
   // smoothing group id
-  unsigned int current_smoothing_id =
-      0;  // Initial value. 0 means no smoothing.
+  unsigned int current_smoothing_id;
 
-  int greatest_v_idx = -1;
-  int greatest_vn_idx = -1;
-  int greatest_vt_idx = -1;
+  int greatest_v_idx;
+  int greatest_vn_idx;
+  int greatest_vt_idx;
 
   shape_t shape;
 
-  bool found_all_colors = true;
+  bool found_all_colors;
 
-  size_t line_num = 0;
-  std::string linebuf;
-  while (inStream->peek() != -1) {
-    safeGetline(*inStream, linebuf);
+  obj_parse_state_t()
+      : material(-1),
+        current_smoothing_id(0),  // Initial value. 0 means no smoothing.
+        greatest_v_idx(-1),
+        greatest_vn_idx(-1),
+        greatest_vt_idx(-1),
+        found_all_colors(true) {}
 
-    line_num++;
+  void AddFace(face_t *face);
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
-    }
+  // `v_size` is the number of `v` elements read before the current line.
+  bool ExportGroups(bool triangulate, size_t v_size) {
+    return exportGroupsToShape(&shape, prim_group, tags, material, name,
+                               triangulate, v, v_size);
+  }
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
-    }
+  void ParseStatement(const char *token, const char *line_end,
+                      size_t line_num, size_t v_size,
+                      std::vector<shape_t> *shapes,
+                      std::vector<material_t> *materials,
+                      MaterialReader *readMatFn, bool triangulate,
+                      std::string *warn, std::string *err);
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+  bool Finish(attrib_t *attrib, std::vector<shape_t> *shapes, size_t line_num,
+              bool triangulate, bool default_vcols_fallback,
+              std::string *warn, std::string *err);
+};
 
-    assert(token);
-    if (token[0] == '\0') continue;  // empty line
+// Parses the vertex indices of a `f`, `l` or `p` line.
+// `vsize`, `vnsize` and `vtsize` are the number of v/vn/vt read so far, for
+// relative(negative) indices.
+static bool parseIndices(const char **token, int vsize, int vnsize, int vtsize,
+                         std::vector<vertex_index_t> *indices) {
+  while (!IS_NEW_LINE((*token)[0])) {
+    vertex_index_t vi;
+    if (!parseTriple(token, vsize, vnsize, vtsize, &vi)) {
+      return false;
+    }
 
-    if (token[0] == '#') continue;  // comment line
+    indices->push_back(vi);
 
-    // vertex
-    if (token[0] == 'v' && IS_SPACE((token[1]))) {
-      token += 2;
-      real_t x, y, z;
-      real_t r, g, b;
+    // skip " \t\r". inlined, strspn() costs as much as parsing the triple.
+    while (IS_SPACE((*token)[0]) || (*token)[0] == '\r') (*token)++;
+  }
+  return true;
+}
 
-      found_all_colors &= parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+// Takes over the indices of `face`.
+void obj_parse_state_t::AddFace(face_t *face) {
+  for (size_t i = 0; i < face->vertex_indices.size(); i++) {
+    const vertex_index_t &vi = face->vertex_indices[i];
+    greatest_v_idx = greatest_v_idx > vi.v_idx ? greatest_v_idx : vi.v_idx;
+    greatest_vn_idx = greatest_vn_idx > vi.vn_idx ? greatest_vn_idx : vi.vn_idx;
+    greatest_vt_idx = greatest_vt_idx > vi.vt_idx ? greatest_vt_idx : vi.vt_idx;
+  }
 
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
+  prim_group.faceGroup.push_back(face_t());
+  face_t &added = prim_group.faceGroup.back();
+  added.smoothing_group_id = current_smoothing_id;
+  added.vertex_indices.swap(face->vertex_indices);
+}
 
-      if (found_all_colors || default_vcols_fallback) {
-        vc.push_back(r);
-        vc.push_back(g);
-        vc.push_back(b);
+// Handles the lines which change the parser state(`usemtl`, `mtllib`, `g`,
+// `o`, `t` and `s`). Unknown commands are ignored.
+void obj_parse_state_t::ParseStatement(
+    const char *token, const char *line_end, size_t line_num, size_t v_size,
+    std::vector<shape_t> *shapes, std::vector<material_t> *materials,
+    MaterialReader *readMatFn, bool triangulate, std::string *warn,
+    std::string *err) {
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6))) {
+    token += 6;
+    std::string namebuf = parseString(&token);
+
+    int newMaterialId = -1;
+    std::map<std::string, int>::const_iterator it = material_map.find(namebuf);
+    if (it != material_map.end()) {
+      newMaterialId = it->second;
+    } else {
+      // { error!! material not found }
+      if (warn) {
+        (*warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
       }
-
-      continue;
     }
 
-    // normal
-    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y, z;
-      parseReal3(&x, &y, &z, &token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
+    if (newMaterialId != material) {
+      // Create per-face material. Thus we don't add `shape` to `shapes` at
+      // this time.
+      // just clear `faceGroup` after `exportGroupsToShape()` call.
+      ExportGroups(triangulate, v_size);
+      prim_group.faceGroup.clear();
+      material = newMaterialId;
     }
 
-    // texcoord
-    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y;
-      parseReal2(&x, &y, &token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
-    }
+    return;
+  }
 
-    // line
-    if (token[0] == 'l' && IS_SPACE((token[1]))) {
-      token += 2;
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+    if (readMatFn) {
+      token += 7;
 
-      __line_t line;
+      std::vector<std::string> filenames;
+      SplitString(std::string(token, line_end), ' ', filenames);
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `l' line(e.g. zero value for vertex index. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
+      if (filenames.empty()) {
+        if (warn) {
+          std::stringstream ss;
+          ss << "Looks like empty filename for mtllib. Use default "
+                "material (line "
+             << line_num << ".)\n";
+
+          (*warn) += ss.str();
         }
+      } else {
+        bool found = false;
+        for (size_t s = 0; s < filenames.size(); s++) {
+          std::string warn_mtl;
+          std::string err_mtl;
+          bool ok = (*readMatFn)(filenames[s].c_str(), materials,
+                                 &material_map, &warn_mtl, &err_mtl);
+          if (warn && (!warn_mtl.empty())) {
+            (*warn) += warn_mtl;
+          }
 
-        line.vertex_indices.push_back(vi);
+          if (err && (!err_mtl.empty())) {
+            (*err) += err_mtl;
+          }
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+          if (ok) {
+            found = true;
+            break;
+          }
+        }
+
+        if (!found) {
+          if (warn) {
+            (*warn) +=
+                "Failed to load material file(s). Use default "
+                "material.\n";
+          }
+        }
       }
+    }
 
-      prim_group.lineGroup.push_back(line);
+    return;
+  }
 
-      continue;
+  // group name
+  if (token[0] == 'g' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = ExportGroups(triangulate, v_size);
+    (void)ret;  // return value not used.
+
+    if (shape.mesh.indices.size() > 0) {
+      shapes->push_back(shape);
     }
 
-    // points
-    if (token[0] == 'p' && IS_SPACE((token[1]))) {
-      token += 2;
+    shape = shape_t();
 
-      __points_t pts;
+    // material = -1;
+    prim_group.clear();
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `p' line(e.g. zero value for vertex index. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+    std::vector<std::string> names;
 
-        pts.vertex_indices.push_back(vi);
+    while (!IS_NEW_LINE(token[0])) {
+      std::string str = parseString(&token);
+      names.push_back(str);
+      token += strspn(token, " \t\r");  // skip tag
+    }
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    // names[0] must be 'g'
+
+    if (names.size() < 2) {
+      // 'g' with empty names
+      if (warn) {
+        std::stringstream ss;
+        ss << "Empty group name. line: " << line_num << "\n";
+        (*warn) += ss.str();
+        name = "";
       }
+    } else {
+      std::stringstream ss;
+      ss << names[1];
 
-      prim_group.pointsGroup.push_back(pts);
+      // tinyobjloader does not support multiple groups for a primitive.
+      // Currently we concatinate multiple group names with a space to get
+      // single group name.
 
-      continue;
+      for (size_t i = 2; i < names.size(); i++) {
+        ss << " " << names[i];
+      }
+
+      name = ss.str();
     }
 
-    // face
-    if (token[0] == 'f' && IS_SPACE((token[1]))) {
-      token += 2;
-      token += strspn(token, " \t");
+    return;
+  }
 
-      face_t face;
+  // object name
+  if (token[0] == 'o' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = ExportGroups(triangulate, v_size);
+    (void)ret;  // return value not used.
 
-      face.smoothing_group_id = current_smoothing_id;
-      face.vertex_indices.reserve(3);
+    if (shape.mesh.indices.size() > 0 || shape.lines.indices.size() > 0 ||
+        shape.points.indices.size() > 0) {
+      shapes->push_back(shape);
+    }
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `f' line(e.g. zero value for face index. line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+    // material = -1;
+    prim_group.clear();
+    shape = shape_t();
 
-        greatest_v_idx = greatest_v_idx > vi.v_idx ? greatest_v_idx : vi.v_idx;
-        greatest_vn_idx =
-            greatest_vn_idx > vi.vn_idx ? greatest_vn_idx : vi.vn_idx;
-        greatest_vt_idx =
-            greatest_vt_idx > vi.vt_idx ? greatest_vt_idx : vi.vt_idx;
+    // @todo { multiple object name? }
+    token += 2;
+    name = std::string(token, line_end);
 
-        face.vertex_indices.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
-      }
+    return;
+  }
 
-      // replace with emplace_back + std::move on C++11
-      prim_group.faceGroup.push_back(face);
+  if (token[0] == 't' && IS_SPACE(token[1])) {
+    const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
+    tag_t tag;
 
-      continue;
-    }
+    token += 2;
 
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6))) {
-      token += 6;
-      std::string namebuf = parseString(&token);
+    tag.name = parseString(&token);
 
-      int newMaterialId = -1;
-      std::map<std::string, int>::const_iterator it = material_map.find(namebuf);
-      if (it != material_map.end()) {
-        newMaterialId = it->second;
-      } else {
-        // { error!! material not found }
-        if (warn) {
-          (*warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
-        }
-      }
+    tag_sizes ts = parseTagTriple(&token);
 
-      if (newMaterialId != material) {
-        // Create per-face material. Thus we don't add `shape` to `shapes` at
-        // this time.
-        // just clear `faceGroup` after `exportGroupsToShape()` call.
-        exportGroupsToShape(&shape, prim_group, tags, material, name,
-                            triangulate, v);
-        prim_group.faceGroup.clear();
-        material = newMaterialId;
-      }
+    if (ts.num_ints < 0) {
+      ts.num_ints = 0;
+    }
+    if (ts.num_ints > max_tag_nums) {
+      ts.num_ints = max_tag_nums;
+    }
 
-      continue;
+    if (ts.num_reals < 0) {
+      ts.num_reals = 0;
+    }
+    if (ts.num_reals > max_tag_nums) {
+      ts.num_reals = max_tag_nums;
     }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
-      if (readMatFn) {
-        token += 7;
+    if (ts.num_strings < 0) {
+      ts.num_strings = 0;
+    }
+    if (ts.num_strings > max_tag_nums) {
+      ts.num_strings = max_tag_nums;
+    }
 
-        std::vector<std::string> filenames;
-        SplitString(std::string(token), ' ', filenames);
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
 
-        if (filenames.empty()) {
-          if (warn) {
-            std::stringstream ss;
-            ss << "Looks like empty filename for mtllib. Use default "
-                  "material (line "
-               << line_num << ".)\n";
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+      tag.intValues[i] = parseInt(&token);
+    }
 
-            (*warn) += ss.str();
-          }
-        } else {
-          bool found = false;
-          for (size_t s = 0; s < filenames.size(); s++) {
-            std::string warn_mtl;
-            std::string err_mtl;
-            bool ok = (*readMatFn)(filenames[s].c_str(), materials,
-                                   &material_map, &warn_mtl, &err_mtl);
-            if (warn && (!warn_mtl.empty())) {
-              (*warn) += warn_mtl;
-            }
+    tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
+      tag.floatValues[i] = parseReal(&token);
+    }
 
-            if (err && (!err_mtl.empty())) {
-              (*err) += err_mtl;
-            }
-
-            if (ok) {
-              found = true;
-              break;
-            }
-          }
-
-          if (!found) {
-            if (warn) {
-              (*warn) +=
-                  "Failed to load material file(s). Use default "
-                  "material.\n";
-            }
-          }
-        }
-      }
-
-      continue;
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+      tag.stringValues[i] = parseString(&token);
     }
 
-    // group name
-    if (token[0] == 'g' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v);
-      (void)ret;  // return value not used.
-
-      if (shape.mesh.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
-
-      shape = shape_t();
-
-      // material = -1;
-      prim_group.clear();
-
-      std::vector<std::string> names;
-
-      while (!IS_NEW_LINE(token[0])) {
-        std::string str = parseString(&token);
-        names.push_back(str);
-        token += strspn(token, " \t\r");  // skip tag
-      }
-
-      // names[0] must be 'g'
-
-      if (names.size() < 2) {
-        // 'g' with empty names
-        if (warn) {
-          std::stringstream ss;
-          ss << "Empty group name. line: " << line_num << "\n";
-          (*warn) += ss.str();
-          name = "";
-        }
-      } else {
-        std::stringstream ss;
-        ss << names[1];
-
-        // tinyobjloader does not support multiple groups for a primitive.
-        // Currently we concatinate multiple group names with a space to get
-        // single group name.
-
-        for (size_t i = 2; i < names.size(); i++) {
-          ss << " " << names[i];
-        }
-
-        name = ss.str();
-      }
-
-      continue;
-    }
+    tags.push_back(tag);
 
-    // object name
-    if (token[0] == 'o' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v);
-      (void)ret;  // return value not used.
-
-      if (shape.mesh.indices.size() > 0 || shape.lines.indices.size() > 0 ||
-          shape.points.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
-
-      // material = -1;
-      prim_group.clear();
-      shape = shape_t();
-
-      // @todo { multiple object name? }
-      token += 2;
-      std::stringstream ss;
-      ss << token;
-      name = ss.str();
-
-      continue;
-    }
-
-    if (token[0] == 't' && IS_SPACE(token[1])) {
-      const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
-      tag_t tag;
-
-      token += 2;
-
-      tag.name = parseString(&token);
-
-      tag_sizes ts = parseTagTriple(&token);
-
-      if (ts.num_ints < 0) {
-        ts.num_ints = 0;
-      }
-      if (ts.num_ints > max_tag_nums) {
-        ts.num_ints = max_tag_nums;
-      }
-
-      if (ts.num_reals < 0) {
-        ts.num_reals = 0;
-      }
-      if (ts.num_reals > max_tag_nums) {
-        ts.num_reals = max_tag_nums;
-      }
-
-      if (ts.num_strings < 0) {
-        ts.num_strings = 0;
-      }
-      if (ts.num_strings > max_tag_nums) {
-        ts.num_strings = max_tag_nums;
-      }
-
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
-
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = parseInt(&token);
-      }
-
-      tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
-        tag.floatValues[i] = parseReal(&token);
-      }
+    return;
+  }
 
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        tag.stringValues[i] = parseString(&token);
-      }
+  if (token[0] == 's' && IS_SPACE(token[1])) {
+    // smoothing group id
+    token += 2;
 
-      tags.push_back(tag);
+    // skip space.
+    token += strspn(token, " \t");  // skip space
 
-      continue;
+    if (token == line_end || IS_NEW_LINE(token[0])) {
+      return;
     }
 
-    if (token[0] == 's' && IS_SPACE(token[1])) {
-      // smoothing group id
-      token += 2;
-
-      // skip space.
-      token += strspn(token, " \t");  // skip space
-
-      if (token[0] == '\0') {
-        continue;
-      }
-
-      if (token[0] == '\r' || token[1] == '\n') {
-        continue;
-      }
-
-      if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
-          token[2] == 'f') {
+    if ((line_end - token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
+        token[2] == 'f') {
+      current_smoothing_id = 0;
+    } else {
+      // assume number
+      int smGroupId = parseInt(&token);
+      if (smGroupId < 0) {
+        // parse error. force set to 0.
+        // FIXME(syoyo): Report warning.
         current_smoothing_id = 0;
       } else {
-        // assume number
-        int smGroupId = parseInt(&token);
-        if (smGroupId < 0) {
-          // parse error. force set to 0.
-          // FIXME(syoyo): Report warning.
-          current_smoothing_id = 0;
-        } else {
-          current_smoothing_id = static_cast<unsigned int>(smGroupId);
-        }
+        current_smoothing_id = static_cast<unsigned int>(smGroupId);
       }
+    }
 
-      continue;
-    }  // smoothing group id
+    return;
+  }  // smoothing group id
 
-    // Ignore unknown command.
-  }
+  // Ignore unknown command.
+}
+
+bool obj_parse_state_t::Finish(attrib_t *attrib, std::vector<shape_t> *shapes,
+                               size_t line_num, bool triangulate,
+                               bool default_vcols_fallback, std::string *warn,
+                               std::string *err) {
+  std::stringstream errss;
 
   // not all vertices have colors, no default colors desired? -> clear colors
   if (!found_all_colors && !default_vcols_fallback) {
@@ -2654,8 +2963,7 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
     }
   }
 
-  bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                 triangulate, v);
+  bool ret = ExportGroups(triangulate, v.size());
   // exportGroupsToShape return false when `usemtl` is called in the last
   // line.
   // we also add `shape` to `shapes` when `shape.mesh` has already some
@@ -2680,11 +2988,570 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
   return true;
 }
 
-bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
-                         void *user_data /*= NULL*/,
-                         MaterialReader *readMatFn /*= NULL*/,
-                         std::string *warn, /* = NULL*/
-                         std::string *err /*= NULL*/) {
+template <typename LineReader>
+static bool LoadObjLines(attrib_t *attrib, std::vector<shape_t> *shapes,
+                         std::vector<material_t> *materials, std::string *warn,
+                         std::string *err, LineReader *reader,
+                         MaterialReader *readMatFn, bool triangulate,
+                         bool default_vcols_fallback) {
+  obj_parse_state_t st;
+
+  size_t line_num = 0;
+  const char *line_begin = NULL;
+  const char *line_end = NULL;
+  while (reader->Next(&line_begin, &line_end)) {
+    line_num++;
+
+    // Skip if empty line.
+    if (line_begin == line_end) {
+      continue;
+    }
+
+    // Skip leading space.
+    const char *token = line_begin;
+    while (IS_SPACE(*token)) token++;
+
+    assert(token);
+    if (token == line_end || token[0] == '\0') continue;  // empty line
+
+    if (token[0] == '#') continue;  // comment line
+
+    // vertex
+    if (token[0] == 'v' && IS_SPACE((token[1]))) {
+      token += 2;
+      real_t x, y, z;
+      real_t r, g, b;
+
+      st.found_all_colors &=
+          parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+
+      st.v.push_back(x);
+      st.v.push_back(y);
+      st.v.push_back(z);
+
+      if (st.found_all_colors || default_vcols_fallback) {
+        st.vc.push_back(r);
+        st.vc.push_back(g);
+        st.vc.push_back(b);
+      }
+
+      continue;
+    }
+
+    // normal
+    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y, z;
+      parseReal3(&x, &y, &z, &token);
+      st.vn.push_back(x);
+      st.vn.push_back(y);
+      st.vn.push_back(z);
+      continue;
+    }
+
+    // texcoord
+    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y;
+      parseReal2(&x, &y, &token);
+      st.vt.push_back(x);
+      st.vt.push_back(y);
+      continue;
+    }
+
+    const int vsize = static_cast<int>(st.v.size() / 3);
+    const int vnsize = static_cast<int>(st.vn.size() / 3);
+    const int vtsize = static_cast<int>(st.vt.size() / 2);
+
+    // line
+    if (token[0] == 'l' && IS_SPACE((token[1]))) {
+      token += 2;
+
+      __line_t line;
+      if (!parseIndices(&token, vsize, vnsize, vtsize, &line.vertex_indices)) {
+        if (err) {
+          std::stringstream ss;
+          ss << "Failed parse `l' line(e.g. zero value for vertex index. "
+                "line "
+             << line_num << ".)\n";
+          (*err) += ss.str();
+        }
+        return false;
+      }
+
+      st.prim_group.lineGroup.push_back(line);
+
+      continue;
+    }
+
+    // points
+    if (token[0] == 'p' && IS_SPACE((token[1]))) {
+      token += 2;
+
+      __points_t pts;
+      if (!parseIndices(&token, vsize, vnsize, vtsize, &pts.vertex_indices)) {
+        if (err) {
+          std::stringstream ss;
+          ss << "Failed parse `p' line(e.g. zero value for vertex index. "
+                "line "
+             << line_num << ".)\n";
+          (*err) += ss.str();
+        }
+        return false;
+      }
+
+      st.prim_group.pointsGroup.push_back(pts);
+
+      continue;
+    }
+
+    // face
+    if (token[0] == 'f' && IS_SPACE((token[1]))) {
+      token += 2;
+      while (IS_SPACE(*token)) token++;
+
+      face_t face;
+      face.vertex_indices.reserve(3);
+      if (!parseIndices(&token, vsize, vnsize, vtsize, &face.vertex_indices)) {
+        if (err) {
+          std::stringstream ss;
+          ss << "Failed parse `f' line(e.g. zero value for face index. line "
+             << line_num << ".)\n";
+          (*err) += ss.str();
+        }
+        return false;
+      }
+
+      st.AddFace(&face);
+
+      continue;
+    }
+
+    st.ParseStatement(token, line_end, line_num, st.v.size(), shapes,
+                      materials, readMatFn, triangulate, warn, err);
+  }
+
+  return st.Finish(attrib, shapes, line_num, triangulate,
+                   default_vcols_fallback, warn, err);
+}
+
+bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
+             std::vector<material_t> *materials, std::string *warn,
+             std::string *err, const char *filename, const char *mtl_basedir,
+             bool trianglulate, bool default_vcols_fallback) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  std::stringstream errss;
+
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    errss << "Cannot open file [" << filename << "]" << std::endl;
+    if (err) {
+      (*err) = errss.str();
+    }
+    return false;
+  }
+
+  MaterialFileReader matFileReader(MtlBaseDir(mtl_basedir));
+
+  return LoadObj(attrib, shapes, materials, warn, err, &ifs, &matFileReader,
+                 trianglulate, default_vcols_fallback);
+}
+
+bool LoadObjMapped(attrib_t *attrib, std::vector<shape_t> *shapes,
+                   std::vector<material_t> *materials, std::string *warn,
+                   std::string *err, const char *filename,
+                   const char *mtl_basedir, bool triangulate,
+                   bool default_vcols_fallback) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  MappedFile file;
+  if (!file.Open(filename)) {
+    if (err) {
+      std::stringstream errss;
+      errss << "Cannot open file [" << filename << "]" << std::endl;
+      (*err) = errss.str();
+    }
+    return false;
+  }
+
+  MaterialFileReader matFileReader(MtlBaseDir(mtl_basedir),
+                                   /* use_mmap */ true);
+  MappedLineReader reader(file.data(), file.data() + file.size());
+
+  return LoadObjLines(attrib, shapes, materials, warn, err, &reader,
+                      &matFileReader, triangulate, default_vcols_fallback);
+}
+
+bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
+             std::vector<material_t> *materials, std::string *warn,
+             std::string *err, std::istream *inStream,
+             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
+             bool default_vcols_fallback) {
+  StreamLineReader reader(*inStream);
+  return LoadObjLines(attrib, shapes, materials, warn, err, &reader,
+                      readMatFn, triangulate, default_vcols_fallback);
+}
+
+#ifdef TINYOBJLOADER_HAS_THREADS
+// A state changing line(`usemtl`, `g`, ...) recorded by a parser thread, to be
+// replayed in file order by `LoadObjParallel`.
+struct obj_statement_t {
+  std::string text;
+  size_t line_num;  // within the chunk
+  size_t v_size;    // number of `v` elements read before the line
+
+  // number of faces/lines/points of the chunk before the line
+  size_t num_faces;
+  size_t num_lines;
+  size_t num_points;
+};
+
+// A range of whole lines of the .obj file and what was parsed from it.
+struct obj_chunk_t {
+  const char *begin;
+  const char *end;
+
+  size_t num_lines;
+  size_t num_v;
+  size_t num_vn;
+  size_t num_vt;
+
+  // prefix sums of the counts of the preceding chunks
+  size_t line_base;
+  size_t v_base;
+  size_t vn_base;
+  size_t vt_base;
+
+  std::vector<face_t> faces;
+  std::vector<__line_t> lines;
+  std::vector<__points_t> points;
+  std::vector<obj_statement_t> statements;
+
+  bool found_all_colors;
+  bool ok;
+
+  obj_chunk_t()
+      : begin(NULL),
+        end(NULL),
+        num_lines(0),
+        num_v(0),
+        num_vn(0),
+        num_vt(0),
+        line_base(0),
+        v_base(0),
+        vn_base(0),
+        vt_base(0),
+        found_all_colors(true),
+        ok(true) {}
+};
+
+// Skips leading space, empty lines and comments the same way as
+// `LoadObjLines`. Returns NULL for lines to skip.
+static inline const char *objLineToken(const char *line_begin,
+                                       const char *line_end) {
+  if (line_begin == line_end) {
+    return NULL;
+  }
+
+  const char *token = line_begin;
+  while (IS_SPACE(*token)) token++;
+  if (token == line_end || token[0] == '\0' || token[0] == '#') {
+    return NULL;
+  }
+  return token;
+}
+
+// 1st pass: counts lines and `v`/`vn`/`vt` elements of a chunk.
+static void CountObjChunk(obj_chunk_t *chunk) {
+  MappedLineReader reader(chunk->begin, chunk->end);
+  const char *line_begin = NULL;
+  const char *line_end = NULL;
+  while (reader.Next(&line_begin, &line_end)) {
+    chunk->num_lines++;
+
+    const char *token = objLineToken(line_begin, line_end);
+    if (!token || token[0] != 'v') continue;
+
+    if (IS_SPACE(token[1])) {
+      chunk->num_v++;
+    } else if (token[1] == 'n' && IS_SPACE(token[2])) {
+      chunk->num_vn++;
+    } else if (token[1] == 't' && IS_SPACE(token[2])) {
+      chunk->num_vt++;
+    }
+  }
+}
+
+// 2nd pass: parses a chunk. `v`/`vn`/`vt` are written straight into the
+// arrays at the chunk's offsets, the rest is kept in the chunk.
+static void ParseObjChunk(obj_chunk_t *chunk, real_t *v, real_t *vc,
+                          real_t *vn, real_t *vt) {
+  v += 3 * chunk->v_base;
+  vc += 3 * chunk->v_base;
+  vn += 3 * chunk->vn_base;
+  vt += 2 * chunk->vt_base;
+
+  size_t nv = 0, nvn = 0, nvt = 0;
+  size_t line_num = 0;
+  MappedLineReader reader(chunk->begin, chunk->end);
+  const char *line_begin = NULL;
+  const char *line_end = NULL;
+  while (reader.Next(&line_begin, &line_end)) {
+    line_num++;
+
+    const char *token = objLineToken(line_begin, line_end);
+    if (!token) continue;
+
+    // vertex
+    if (token[0] == 'v' && IS_SPACE((token[1]))) {
+      token += 2;
+      chunk->found_all_colors &=
+          parseVertexWithColor(&v[3 * nv + 0], &v[3 * nv + 1], &v[3 * nv + 2],
+                               &vc[3 * nv + 0], &vc[3 * nv + 1],
+                               &vc[3 * nv + 2], &token);
+      nv++;
+      continue;
+    }
+
+    // normal
+    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+      token += 3;
+      parseReal3(&vn[3 * nvn + 0], &vn[3 * nvn + 1], &vn[3 * nvn + 2],
+                 &token);
+      nvn++;
+      continue;
+    }
+
+    // texcoord
+    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+      token += 3;
+      parseReal2(&vt[2 * nvt + 0], &vt[2 * nvt + 1], &token);
+      nvt++;
+      continue;
+    }
+
+    const int vsize = static_cast<int>(chunk->v_base + nv);
+    const int vnsize = static_cast<int>(chunk->vn_base + nvn);
+    const int vtsize = static_cast<int>(chunk->vt_base + nvt);
+
+    // line
+    if (token[0] == 'l' && IS_SPACE((token[1]))) {
+      token += 2;
+      chunk->lines.push_back(__line_t());
+      chunk->ok = parseIndices(&token, vsize, vnsize, vtsize,
+                               &chunk->lines.back().vertex_indices);
+      if (!chunk->ok) return;
+      continue;
+    }
+
+    // points
+    if (token[0] == 'p' && IS_SPACE((token[1]))) {
+      token += 2;
+      chunk->points.push_back(__points_t());
+      chunk->ok = parseIndices(&token, vsize, vnsize, vtsize,
+                               &chunk->points.back().vertex_indices);
+      if (!chunk->ok) return;
+      continue;
+    }
+
+    // face
+    if (token[0] == 'f' && IS_SPACE((token[1]))) {
+      token += 2;
+      while (IS_SPACE(*token)) token++;
+      chunk->faces.push_back(face_t());
+      face_t &face = chunk->faces.back();
+      face.vertex_indices.reserve(3);
+      chunk->ok = parseIndices(&token, vsize, vnsize, vtsize,
+                               &face.vertex_indices);
+      if (!chunk->ok) return;
+      continue;
+    }
+
+    chunk->statements.push_back(obj_statement_t());
+    obj_statement_t &stmt = chunk->statements.back();
+    stmt.text.assign(token, line_end);
+    stmt.line_num = line_num;
+    stmt.v_size = 3 * (chunk->v_base + nv);
+    stmt.num_faces = chunk->faces.size();
+    stmt.num_lines = chunk->lines.size();
+    stmt.num_points = chunk->points.size();
+  }
+}
+
+// Runs `fn` for each chunk, the first one on the calling thread.
+template <typename Fn>
+static void RunObjChunks(std::vector<obj_chunk_t> *chunks, Fn fn) {
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < chunks->size(); i++) {
+    workers.push_back(std::thread(fn, &(*chunks)[i]));
+  }
+  fn(&(*chunks)[0]);
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+// Moves the faces/lines/points of `chunk` up to the given counts into the
+// current group of `st`.
+static void FlushObjChunk(obj_parse_state_t *st, obj_chunk_t *chunk,
+                          size_t *face_idx, size_t *line_idx, size_t *point_idx,
+                          size_t num_faces, size_t num_lines,
+                          size_t num_points) {
+  for (; (*face_idx) < num_faces; (*face_idx)++) {
+    st->AddFace(&chunk->faces[(*face_idx)]);
+  }
+  for (; (*line_idx) < num_lines; (*line_idx)++) {
+    st->prim_group.lineGroup.push_back(__line_t());
+    st->prim_group.lineGroup.back().vertex_indices.swap(
+        chunk->lines[(*line_idx)].vertex_indices);
+  }
+  for (; (*point_idx) < num_points; (*point_idx)++) {
+    st->prim_group.pointsGroup.push_back(__points_t());
+    st->prim_group.pointsGroup.back().vertex_indices.swap(
+        chunk->points[(*point_idx)].vertex_indices);
+  }
+}
+
+bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                     std::vector<material_t> *materials, std::string *warn,
+                     std::string *err, const char *filename,
+                     const char *mtl_basedir, bool triangulate,
+                     bool default_vcols_fallback, unsigned int num_threads) {
+  // Chunks smaller than this are not worth a thread.
+  const size_t kMinChunkSize = 256 * 1024;
+
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  MappedFile file;
+  if (!file.Open(filename)) {
+    if (err) {
+      std::stringstream errss;
+      errss << "Cannot open file [" << filename << "]" << std::endl;
+      (*err) = errss.str();
+    }
+    return false;
+  }
+
+  MaterialFileReader matFileReader(MtlBaseDir(mtl_basedir),
+                                   /* use_mmap */ true);
+
+  if (num_threads == 0) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+  size_t num_chunks = file.size() / kMinChunkSize;
+  if (num_chunks > num_threads) {
+    num_chunks = num_threads;
+  }
+
+  if (num_chunks < 2) {
+    MappedLineReader reader(file.data(), file.data() + file.size());
+    return LoadObjLines(attrib, shapes, materials, warn, err, &reader,
+                        &matFileReader, triangulate, default_vcols_fallback);
+  }
+
+  // Split at line breaks('\n'), so that each chunk has whole lines.
+  std::vector<obj_chunk_t> chunks(num_chunks);
+  const char *file_end = file.data() + file.size();
+  const char *p = file.data();
+  for (size_t i = 0; i < num_chunks; i++) {
+    chunks[i].begin = p;
+    if (i + 1 < num_chunks) {
+      const char *target = file.data() + file.size() / num_chunks * (i + 1);
+      if (target < p) target = p;
+      const char *nl = static_cast<const char *>(
+          memchr(target, '\n', size_t(file_end - target)));
+      p = nl ? nl + 1 : file_end;
+    } else {
+      p = file_end;
+    }
+    chunks[i].end = p;
+  }
+
+  RunObjChunks(&chunks, CountObjChunk);
+
+  obj_parse_state_t st;
+  size_t line_num = 0, nv = 0, nvn = 0, nvt = 0;
+  for (size_t i = 0; i < num_chunks; i++) {
+    chunks[i].line_base = line_num;
+    chunks[i].v_base = nv;
+    chunks[i].vn_base = nvn;
+    chunks[i].vt_base = nvt;
+    line_num += chunks[i].num_lines;
+    nv += chunks[i].num_v;
+    nvn += chunks[i].num_vn;
+    nvt += chunks[i].num_vt;
+  }
+  st.v.resize(3 * nv);
+  st.vc.resize(3 * nv);
+  st.vn.resize(3 * nvn);
+  st.vt.resize(2 * nvt);
+
+  // Keep a valid pointer for empty arrays, chunks do not write through it.
+  real_t dummy = real_t(0);
+  real_t *v = st.v.empty() ? &dummy : &st.v[0];
+  real_t *vc = st.vc.empty() ? &dummy : &st.vc[0];
+  real_t *vn = st.vn.empty() ? &dummy : &st.vn[0];
+  real_t *vt = st.vt.empty() ? &dummy : &st.vt[0];
+  RunObjChunks(&chunks, [=](obj_chunk_t *chunk) {
+    ParseObjChunk(chunk, v, vc, vn, vt);
+  });
+
+  for (size_t i = 0; i < num_chunks; i++) {
+    if (!chunks[i].ok) {
+      // Parse again on this thread to report the same error as `LoadObj`.
+      MappedLineReader reader(file.data(), file.data() + file.size());
+      return LoadObjLines(attrib, shapes, materials, warn, err, &reader,
+                          &matFileReader, triangulate, default_vcols_fallback);
+    }
+    st.found_all_colors &= chunks[i].found_all_colors;
+  }
+
+  // Replay the chunks in file order.
+  for (size_t i = 0; i < num_chunks; i++) {
+    obj_chunk_t &chunk = chunks[i];
+    size_t face_idx = 0, line_idx = 0, point_idx = 0;
+    for (size_t s = 0; s < chunk.statements.size(); s++) {
+      const obj_statement_t &stmt = chunk.statements[s];
+      FlushObjChunk(&st, &chunk, &face_idx, &line_idx, &point_idx,
+                    stmt.num_faces, stmt.num_lines, stmt.num_points);
+      st.ParseStatement(stmt.text.c_str(),
+                        stmt.text.c_str() + stmt.text.size(),
+                        chunk.line_base + stmt.line_num, stmt.v_size, shapes,
+                        materials, &matFileReader, triangulate, warn, err);
+    }
+    FlushObjChunk(&st, &chunk, &face_idx, &line_idx, &point_idx,
+                  chunk.faces.size(), chunk.lines.size(),
+                  chunk.points.size());
+
+    // release memory early.
+    std::vector<face_t>().swap(chunk.faces);
+    std::vector<__line_t>().swap(chunk.lines);
+    std::vector<__points_t>().swap(chunk.points);
+  }
+
+  return st.Finish(attrib, shapes, line_num, triangulate,
+                   default_vcols_fallback, warn, err);
+}
+#endif  // TINYOBJLOADER_HAS_THREADS
+
+template <typename LineReader>
+static bool LoadObjWithCallbackLines(LineReader *reader,
+                                     const callback_t &callback,
+                                     void *user_data, MaterialReader *readMatFn,
+                                     std::string *warn, std::string *err) {
   std::stringstream errss;
 
   // material
@@ -2697,38 +3564,32 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
   names.reserve(2);
   std::vector<const char *> names_out;
 
-  std::string linebuf;
-  while (inStream.peek() != -1) {
-    safeGetline(inStream, linebuf);
-
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
-    }
-
+  const char *line_begin = NULL;
+  const char *line_end = NULL;
+  while (reader->Next(&line_begin, &line_end)) {
     // Skip if empty line.
-    if (linebuf.empty()) {
+    if (line_begin == line_end) {
       continue;
     }
 
     // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+    const char *token = line_begin;
+    while (IS_SPACE(*token)) token++;
 
     assert(token);
-    if (token[0] == '\0') continue;  // empty line
+    if (token == line_end || token[0] == '\0') continue;  // empty line
 
     if (token[0] == '#') continue;  // comment line
 
     // vertex
     if (token[0] == 'v' && IS_SPACE((token[1]))) {
       token += 2;
-      // TODO(syoyo): Support parsing vertex color extension.
+      if (callback.vertex_color_cb) {
+        real_t x, y, z, r, g, b;
+        parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+        callback.vertex_color_cb(user_data, x, y, z, r, g, b);
+        continue;
+      }
       real_t x, y, z, w;  // w is optional. default = 1.0
       parseV(&x, &y, &z, &w, &token);
       if (callback.vertex_cb) {
@@ -2789,9 +3650,7 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
     // use mtl
     if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
       token += 7;
-      std::stringstream ss;
-      ss << token;
-      std::string namebuf = ss.str();
+      std::string namebuf = parseString(&token);
 
       int newMaterialId = -1;
       std::map<std::string, int>::const_iterator it = material_map.find(namebuf);
@@ -2821,7 +3680,7 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
         token += 7;
 
         std::vector<std::string> filenames;
-        SplitString(std::string(token), ' ', filenames);
+        SplitString(std::string(token, line_end), ' ', filenames);
 
         if (filenames.empty()) {
           if (warn) {
@@ -2904,9 +3763,7 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
       // @todo { multiple object name? }
       token += 2;
 
-      std::stringstream ss;
-      ss << token;
-      std::string object_name = ss.str();
+      std::string object_name(token, line_end);
 
       if (callback.object_cb) {
         callback.object_cb(user_data, object_name.c_str());
@@ -2963,6 +3820,66 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
   return true;
 }
 
+bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
+                         void *user_data /*= NULL*/,
+                         MaterialReader *readMatFn /*= NULL*/,
+                         std::string *warn, /* = NULL*/
+                         std::string *err /*= NULL*/) {
+  StreamLineReader reader(inStream);
+  return LoadObjWithCallbackLines(&reader, callback, user_data, readMatFn, warn,
+                                  err);
+}
+
+bool LoadObjWithCallbackMapped(const char *filename,
+                               const callback_t &callback,
+                               void *user_data /*= NULL*/,
+                               const char *mtl_basedir /*= NULL*/,
+                               std::string *warn /*= NULL*/,
+                               std::string *err /*= NULL*/) {
+  MappedFile file;
+  if (!file.Open(filename)) {
+    if (err) {
+      std::stringstream errss;
+      errss << "Cannot open file [" << filename << "]" << std::endl;
+      (*err) = errss.str();
+    }
+    return false;
+  }
+
+  MaterialFileReader matFileReader(MtlBaseDir(mtl_basedir),
+                                   /* use_mmap */ true);
+  MappedLineReader reader(file.data(), file.data() + file.size());
+
+  return LoadObjWithCallbackLines(&reader, callback, user_data, &matFileReader,
+                                  warn, err);
+}
+
+void TriangulatePolygon(const index_t *indices, int num_indices,
+                        const std::vector<real_t> &vertices,
+                        std::vector<index_t> *triangles) {
+  if (num_indices < 3) {
+    return;
+  }
+
+  std::vector<vertex_index_t> face(static_cast<size_t>(num_indices));
+  for (size_t k = 0; k < face.size(); k++) {
+    face[k].v_idx = indices[k].vertex_index;
+    face[k].vn_idx = indices[k].normal_index;
+    face[k].vt_idx = indices[k].texcoord_index;
+  }
+
+  std::vector<vertex_index_t> corners;
+  triangulateFace(face, vertices, vertices.size(), &corners);
+
+  for (size_t k = 0; k < corners.size(); k++) {
+    index_t idx;
+    idx.vertex_index = corners[k].v_idx;
+    idx.normal_index = corners[k].vn_idx;
+    idx.texcoord_index = corners[k].vt_idx;
+    triangles->push_back(idx);
+  }
+}
+
 bool ObjReader::ParseFromFile(const std::string &filename,
                               const ObjReaderConfig &config) {
   std::string mtl_search_path;
@@ -15,6 +15,24 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 #include <functional>
+#include <cstdint>
+#include <chrono>
+#include <cfloat>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <set>
+#include <algorithm>
+#include <array>
+#if defined(__AVX__)
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+#endif
 
 #ifndef max
 # define max(a,b) (((a)>(b))?(a):(b))
@@ -85,22 +103,45 @@ typedef struct
     GLuint isEye;
     vector<Offset> offsets;
 
+    // its MaterialBlock, see UploadMaterialBlocks()
+    GLuint uniformBuffer;
+    GLintptr uniformOffset;
 } PhongMaterial;
 
+// A level of detail of a shape: `index_count` indices from `first_index` on, counted from the first
+// index of the shape. `error` is how far the surface moved, in normalized model units.
+struct MeshLod
+{
+    uint32_t first_index, index_count;
+    float error;
+};
+
+// Triangles `first_index` to `first_index + index_count` of a shape, counted like MeshLod. Every
+// triangle faces away from a camera at `eye` if dot(center - eye, axis) >= cutoff * |center - eye| + radius.
+struct MeshCluster
+{
+    uint32_t first_index, index_count;
+    GLfloat center[3], radius;
+    GLfloat axis[3], cutoff;
+};
+
 typedef struct
 {
     GLuint vao;
-    GLuint vbo;
+    GLuint vbo;             // interleaved, see GetVertexLayout()
     GLuint vboTex;
     GLuint ebo;
-    GLuint p_color;
     int vertex_count;
-    GLuint p_normal;
-    GLuint p_texCoord;
     PhongMaterial material;
     int indexCount;
+    GLenum indexType;
+    GLintptr indexOffset;   // in bytes, into ebo
+    vector<MeshLod> lods;   // see BuildLods(), indexCount is the one of level 0
+    vector<MeshCluster> clusters;   // see BuildClusters()
 } Shape;
 
+class Bvh;
+
 struct model
 {
     Vector3 position = Vector3(0, 0, 0);
@@ -108,12 +149,19 @@ struct model
     Vector3 rotation = Vector3(0, 0, 0);    // Euler form
 
     vector<Shape> shapes;
+    vector<GLuint> textures;    // from textureCache, one per material
+    bool loaded = false;    // false while lazy loading, a placeholder is drawn then
+    shared_ptr<Bvh> bvh;    // level 0 of all shapes, see BuildModelBvh()
+    vector<uint32_t> shapeFirstTriangle;    // the first triangle of every shape in bvh
+    GLuint tangentBuffer = 0;   // attribute 4 of all shapes with generateTangents, see BuildModelTangents()
+    GLuint materialBuffer = 0;  // the MaterialBlocks of the shapes, see UploadMaterialBlocks()
 
     bool hasEye = false;
     GLint max_eye_offset = 7;
     GLint cur_eye_offset_idx = 0;
 };
 vector<model> models;
+model placeholderModel;
 
 struct camera
 {
@@ -150,17 +198,6 @@ struct LightInfo
 };
 LightInfo lightSources[numOfLightSources];
 
-struct UniformLightInfo
-{
-    GLint iLocPosition;
-    GLint iLocAmbient;
-    GLint iLocDiffuse;
-    GLint iLocSpecular;
-    GLint iLocConstantAttenuation;
-    GLint iLocLinearAttenuation;
-    GLint iLocQuadraticAttenuation;
-};
-
 struct SpotLightInfo
 {
     Vector3 spotDirection;
@@ -169,20 +206,6 @@ struct SpotLightInfo
 };
 SpotLightInfo spotLightInfo;
 
-struct UniformSpotLight
-{
-    GLint iLocSpotDirection;
-    GLint iLocSpotExponent;
-    GLint iLocSpotCutOff;
-};
-
-struct UniformPhongMaterial
-{
-    GLint iLocKa;
-    GLint iLocKs;
-    GLint iLocKd;
-};
-
 enum ProjMode
 {
     Orthogonal = 0,
@@ -201,36 +224,381 @@ int cur_eye_offset_idx = 0;
 
 vector<string> model_list{ "../TextureModels/Fushigidane.obj", "../TextureModels/Mew.obj","../TextureModels/Nyarth.obj","../TextureModels/Zenigame.obj", "../TextureModels/laurana500.obj", "../TextureModels/Nala.obj", "../TextureModels/Square.obj" };
 
-GLuint program;
-
-
 // uniforms location
-GLuint iLocP;
-GLuint iLocV;
-GLuint iLocM;
-
 struct Uniform
 {
-    GLint iLocCameraPosition;
-    UniformLightInfo iLocLightInfo;
-    UniformPhongMaterial iLocMaterial;
-    UniformSpotLight iLocSpotLight;
-    GLint iLocShininess;
-    GLint iLocCurLightMode;
-    GLint iLocIsPerPixLighting;
-    
+    GLint iLocP;
+    GLint iLocV;
+    GLint iLocM;
+    GLint iLocN;
+    GLint iLocFirstView;
     /* For HW3 */
    GLint iLocDiffuseTexture;
-   GLint iLocIsEye;
    GLint iLocOffsetX;
    GLint iLocOffsetY;
     /* For HW3 */
 };
-Uniform uniform;
+
+// LIGHTING of the shaders
+enum ShaderLighting
+{
+    PER_VERTEX_LIGHTING = 0,
+    PER_PIXEL_LIGHTING = 1,
+    SIDE_BY_SIDE_LIGHTING = 2,  // per-vertex in the left, per-pixel in the right half
+};
+
+// A permutation of the shaders, see GetShaderProgram().
+struct ShaderProgram
+{
+    GLuint program;
+    Uniform uniform;
+};
 
 int curLightMode = 0;
 GLfloat shininess;
 
+//* GL state *//
+// RenderScene() sets its state through glState, which remembers what is bound and skips the calls
+// that would change nothing. The loaders bind VAOs and textures behind its back between frames, so
+// BeginFrame() forgets those.
+// Prints the GL state calls per frame about once a second; glState counts them either way.
+bool printGLStateStats = false;
+
+struct GLState
+{
+    static const GLuint UNKNOWN = ~0u;
+    static const int TEXTURE_UNITS = 4;
+    static const int BUFFER_BINDINGS = 3;
+
+    struct BufferRange
+    {
+        GLuint buffer = UNKNOWN;
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+    };
+
+    GLuint program = UNKNOWN;
+    GLuint vao = UNKNOWN;
+    GLuint activeTexture = UNKNOWN;
+    GLuint textures[TEXTURE_UNITS];
+    GLuint samplers[TEXTURE_UNITS];
+    BufferRange ranges[BUFFER_BINDINGS];
+    // values of the uniforms of each program by location, 1 float or a 3x3 or 4x4 matrix
+    unordered_map<GLuint, unordered_map<GLint, array<GLfloat, 16>>> uniforms;
+
+    // calls made and skipped this frame, and the sums since the last report
+    int issued = 0, skipped = 0;
+    long long issuedTotal = 0, skippedTotal = 0;
+    int frames = 0;
+    chrono::steady_clock::time_point reportTime = chrono::steady_clock::now();
+
+    GLState()
+    {
+        fill(textures, textures + TEXTURE_UNITS, UNKNOWN);
+        fill(samplers, samplers + TEXTURE_UNITS, UNKNOWN);
+    }
+
+    // True, and counted as skipped, when the call would not change the state.
+    bool Skip(bool same)
+    {
+        (same ? skipped : issued)++;
+        return same;
+    }
+
+    void BeginFrame()
+    {
+        vao = UNKNOWN;
+        fill(textures, textures + TEXTURE_UNITS, UNKNOWN);
+        issued = skipped = 0;
+    }
+
+    // Averages the calls per frame about once a second, printed with printGLStateStats.
+    void EndFrame()
+    {
+        issuedTotal += issued;
+        skippedTotal += skipped;
+        frames++;
+        auto now = chrono::steady_clock::now();
+        if (now - reportTime < chrono::seconds(1))
+            return;
+        if (printGLStateStats)
+            printf("GL state calls per frame: %.1f issued, %.1f skipped\n", (double)issuedTotal / frames, (double)skippedTotal / frames);
+        issuedTotal = skippedTotal = 0;
+        frames = 0;
+        reportTime = now;
+    }
+
+    void UseProgram(GLuint p)
+    {
+        if (Skip(p == program))
+            return;
+        glUseProgram(p);
+        program = p;
+    }
+
+    void BindVertexArray(GLuint v)
+    {
+        if (Skip(v == vao))
+            return;
+        glBindVertexArray(v);
+        vao = v;
+    }
+
+    void BindTexture(GLuint unit, GLuint texture)
+    {
+        if (Skip(textures[unit] == texture))
+            return;
+        if (activeTexture != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeTexture = unit;
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        textures[unit] = texture;
+    }
+
+    void BindSampler(GLuint unit, GLuint sampler)
+    {
+        if (Skip(samplers[unit] == sampler))
+            return;
+        glBindSampler(unit, sampler);
+        samplers[unit] = sampler;
+    }
+
+    void BindBufferRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        BufferRange& range = ranges[binding];
+        if (Skip(range.buffer == buffer && range.offset == offset && range.size == size))
+            return;
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+        range.buffer = buffer;
+        range.offset = offset;
+        range.size = size;
+    }
+
+    // Column-major like glUniformMatrix4fv(location, 1, GL_FALSE, m).
+    void UniformMatrix4fv(GLint location, const GLfloat* m)
+    {
+        auto& values = uniforms[program];
+        auto it = values.find(location);
+        if (Skip(it != values.end() && equal(m, m + 16, it->second.begin())))
+            return;
+        glUniformMatrix4fv(location, 1, GL_FALSE, m);
+        copy(m, m + 16, values[location].begin());
+    }
+
+    void UniformMatrix3fv(GLint location, const GLfloat* m)
+    {
+        auto& values = uniforms[program];
+        auto it = values.find(location);
+        if (Skip(it != values.end() && equal(m, m + 9, it->second.begin())))
+            return;
+        glUniformMatrix3fv(location, 1, GL_FALSE, m);
+        copy(m, m + 9, values[location].begin());
+    }
+
+    // Kept as a float with the others, exact for the small values used.
+    void Uniform1i(GLint location, GLint v)
+    {
+        auto& values = uniforms[program];
+        auto it = values.find(location);
+        if (Skip(it != values.end() && it->second[0] == (GLfloat)v))
+            return;
+        glUniform1i(location, v);
+        values[location][0] = (GLfloat)v;
+    }
+
+    void Uniform1f(GLint location, GLfloat v)
+    {
+        auto& values = uniforms[program];
+        auto it = values.find(location);
+        if (Skip(it != values.end() && it->second[0] == v))
+            return;
+        glUniform1f(location, v);
+        values[location][0] = v;
+    }
+};
+GLState glState;
+
+// Prebuilt sampler per [MagFilterMode][MinFilterMode], instead of setting the texture parameters
+// of every texture for every draw.
+GLuint samplers[2][2];
+
+void CreateSamplers()
+{
+    const GLenum mag_filters[] = { GL_NEAREST, GL_LINEAR };
+    const GLenum min_filters[] = { GL_NEAREST_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR };
+    for (int mag = 0; mag < 2; mag++)
+    {
+        for (int min_filter = 0; min_filter < 2; min_filter++)
+        {
+            GLuint& sampler = samplers[mag][min_filter];
+            glGenSamplers(1, &sampler);
+            glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, mag_filters[mag]);
+            glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, min_filters[min_filter]);
+            glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        }
+    }
+}
+//* GL state *//
+
+//* Uniform blocks *//
+// The lighting uniforms are std140 blocks. RenderScene() keeps the FrameBlock and the LightBlock in
+// uniform buffers and writes them only when they change; the MaterialBlocks of a model are written
+// once by UploadModel(), a shape just binds its range. The light mode and per-vertex or per-pixel
+// lighting are compiled into the program, see GetShaderProgram().
+enum UniformBlockBinding
+{
+    FRAME_BLOCK_BINDING = 0,
+    LIGHT_BLOCK_BINDING = 1,
+    MATERIAL_BLOCK_BINDING = 2,
+};
+
+// std140 mirrors of the blocks of the shaders: a vec3 takes 16 bytes unless a scalar follows in its
+// last 4, structs and blocks are padded to 16 bytes.
+struct FrameBlock
+{
+    GLfloat cameraPosition[3];
+    GLfloat shininess;
+};
+
+struct LightBlock
+{
+    // LightInfo lightSources
+    GLfloat position[4], ambient[4], diffuse[4];
+    GLfloat specular[3], constantAttenuation;
+    GLfloat linearAttenuation, quadraticAttenuation, pad0[2];
+    // SpotLightInfo spotLightInfo
+    GLfloat spotDirection[3], spotExponent;
+    GLfloat spotCutOff, pad1[3];
+};
+
+struct MaterialBlock
+{
+    // PhongMaterial material
+    GLfloat Ka[4], Kd[4], Ks[4];
+    GLint isEye;
+    GLfloat pad[3];
+};
+static_assert(sizeof(FrameBlock) == 16 && sizeof(LightBlock) == 112 && sizeof(MaterialBlock) == 64, "std140 layout");
+
+// The copies are what the buffers hold.
+struct UniformBuffers
+{
+    GLuint frameBuffer, lightBuffer;
+    GLint alignment = 256;  // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    FrameBlock frame;
+    LightBlock light;
+    bool frameWritten = false, lightWritten = false;
+};
+UniformBuffers uniformBuffers;
+
+// Distance between blocks of `size` bytes that are bound by range.
+static GLintptr UniformBlockStride(size_t size)
+{
+    GLintptr alignment = uniformBuffers.alignment;
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static void CopyVector3(const Vector3& v, GLfloat* out)
+{
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+}
+
+// Writes `block` to slot `slot` of `buffer` unless `written` already has it there.
+template <typename Block>
+static void WriteUniformBlock(GLuint buffer, int slot, const Block& block, Block* written, bool* valid)
+{
+    if (*valid && memcmp(&block, written, sizeof(Block)) == 0)
+        return;
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, slot * UniformBlockStride(sizeof(Block)), sizeof(Block), &block);
+    *written = block;
+    *valid = true;
+}
+
+// Writes the FrameBlock and the LightBlock for the next draws.
+void SetFrameUniforms()
+{
+    FrameBlock frame = FrameBlock();
+    CopyVector3(main_camera.position, frame.cameraPosition);
+    frame.shininess = shininess;
+    WriteUniformBlock(uniformBuffers.frameBuffer, 0, frame, &uniformBuffers.frame, &uniformBuffers.frameWritten);
+
+    const LightInfo& info = lightSources[curLightMode];
+    LightBlock light = LightBlock();
+    CopyVector3(info.position, light.position);
+    CopyVector3(info.ambient, light.ambient);
+    CopyVector3(info.diffuse, light.diffuse);
+    CopyVector3(info.specular, light.specular);
+    light.constantAttenuation = info.constantAttenuation;
+    light.linearAttenuation = info.linearAttenuation;
+    light.quadraticAttenuation = info.quadraticAttenuation;
+    CopyVector3(spotLightInfo.spotDirection, light.spotDirection);
+    light.spotExponent = spotLightInfo.spotExponent;
+    light.spotCutOff = spotLightInfo.spotCutOff;
+    WriteUniformBlock(uniformBuffers.lightBuffer, 0, light, &uniformBuffers.light, &uniformBuffers.lightWritten);
+}
+
+// One uniform buffer with the MaterialBlocks of `materials`, which get their range of it. Returns
+// the buffer, 0 without materials.
+GLuint UploadMaterialBlocks(vector<PhongMaterial>& materials)
+{
+    if (materials.empty())
+        return 0;
+    GLintptr stride = UniformBlockStride(sizeof(MaterialBlock));
+    vector<char> data(stride * materials.size());
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        PhongMaterial& material = materials[i];
+        MaterialBlock block = MaterialBlock();
+        CopyVector3(material.Ka, block.Ka);
+        CopyVector3(material.Kd, block.Kd);
+        CopyVector3(material.Ks, block.Ks);
+        block.isEye = material.isEye;
+        memcpy(&data[i * stride], &block, sizeof(block));
+        material.uniformBuffer = buffer;
+        material.uniformOffset = i * stride;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+    return buffer;
+}
+
+// Binds the blocks of `program` to their binding points.
+void BindUniformBlocks(GLuint program)
+{
+    const pair<const char*, GLuint> blocks[] = { { "FrameBlock", FRAME_BLOCK_BINDING }, { "LightBlock", LIGHT_BLOCK_BINDING },
+                                                 { "MaterialBlock", MATERIAL_BLOCK_BINDING } };
+    for (const auto& block : blocks)
+    {
+        GLuint index = glGetUniformBlockIndex(program, block.first);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, block.second);
+    }
+}
+
+// Creates the buffers of RenderScene().
+void SetupUniformBlocks()
+{
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformBuffers.alignment);
+    uniformBuffers.alignment = max(uniformBuffers.alignment, 16);
+    glGenBuffers(1, &uniformBuffers.frameBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers.frameBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, uniformBuffers.frameBuffer);
+    glGenBuffers(1, &uniformBuffers.lightBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers.lightBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, uniformBuffers.lightBuffer);
+}
+//* Uniform blocks *//
+
 static GLvoid Normalize(GLfloat v[3])
 {
     GLfloat l;
@@ -428,13 +796,50 @@ void transVec3ToShader(GLint iLoc, const Vector3 &v)
     glUniform3f(iLoc, v.x, v.y, v.z);
 }
 
-// Render function for display rendering
-void RenderScene(int per_vertex_or_per_pixel) {
+static size_t IndexSize(GLenum index_type);
+static float ModelPixelsPerUnit(const model& m);
+static const MeshLod* SelectLod(const Shape& shape, float pixels_per_unit);
+void DrawClusters(const Shape& shape, const Matrix4& model_matrix, GLint first_view_location, GLsizei views);
+const ShaderProgram& GetShaderProgram(int light_mode, int lighting, bool eye_offset);
+
+// Render both views with one instanced draw per shape instead of one RenderScene() per half of the
+// window, see shader.vs.glsl.
+bool sideBySideRendering = true;
+
+// glDrawElements() for one view, or instanced for both halves of the window.
+static void DrawViews(GLsizei count, GLenum type, const GLvoid* offset, GLsizei views)
+{
+    if (views == 1)
+        glDrawElements(GL_TRIANGLES, count, type, offset);
+    else
+        glDrawElementsInstanced(GL_TRIANGLES, count, type, offset, views);
+}
+
+// mat3(transpose(inverse(m))) for glUniformMatrix3fv(..., GL_FALSE, ...): the column-major inverse
+// transpose is the row-major inverse. The shaders normalize the normals, so the upper 3x3 is scaled
+// to keep small models clear of the determinant threshold of Matrix3::invert().
+static void NormalMatrix(const Matrix4& m, GLfloat normal_matrix[9])
+{
+    float largest = 0.0f;
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+            largest = max(largest, fabsf(m[row * 4 + col]));
+    }
+    float s = largest > 0.0f ? 1.0f / largest : 1.0f;
+    Matrix3 inverse(m[0] * s, m[1] * s, m[2] * s, m[4] * s, m[5] * s, m[6] * s, m[8] * s, m[9] * s, m[10] * s);
+    inverse.invert();
+    memcpy(normal_matrix, inverse.get(), 9 * sizeof(GLfloat));
+}
+
+// Render function for display rendering. `side_by_side` draws both views into a viewport covering
+// the whole window, per_vertex_or_per_pixel is ignored then. Every shape uses the program of the
+// light mode, the lighting and whether it is an eye.
+void RenderScene(int per_vertex_or_per_pixel, bool side_by_side = false) {
     //Vector3 modelPos = models[cur_idx].position;
     
-    // Cache the current model and light information
+    // Cache the current model
     const auto& currentModel = models.at(cur_idx);
-    const auto& currentLightInfo = lightSources[curLightMode];
     
     Matrix4 T, R, S;
     /*
@@ -448,64 +853,55 @@ void RenderScene(int per_vertex_or_per_pixel) {
     
     // render object
     Matrix4 model_matrix = T * R * S;
-    glUniformMatrix4fv(iLocM, 1, GL_FALSE, model_matrix.getTranspose());
-    glUniformMatrix4fv(iLocV, 1, GL_FALSE, view_matrix.getTranspose());
-    glUniformMatrix4fv(iLocP, 1, GL_FALSE, project_matrix.getTranspose());
+    const GLfloat* m = model_matrix.getTranspose();
+    const GLfloat* v = view_matrix.getTranspose();
+    const GLfloat* p = project_matrix.getTranspose();
+    GLfloat n[9];
+    NormalMatrix(model_matrix, n);
     
     // Reused uniform values
-    transVec3ToShader(uniform.iLocCameraPosition, main_camera.position);
-    transVec3ToShader(uniform.iLocLightInfo.iLocPosition, currentLightInfo.position);
-    transVec3ToShader(uniform.iLocLightInfo.iLocAmbient, currentLightInfo.ambient);
-    transVec3ToShader(uniform.iLocLightInfo.iLocDiffuse, currentLightInfo.diffuse);
-    transVec3ToShader(uniform.iLocLightInfo.iLocSpecular, currentLightInfo.specular);
-    
-    glUniform1f(uniform.iLocLightInfo.iLocConstantAttenuation, currentLightInfo.constantAttenuation);
-    glUniform1f(uniform.iLocLightInfo.iLocLinearAttenuation, currentLightInfo.linearAttenuation);
-    glUniform1f(uniform.iLocLightInfo.iLocQuadraticAttenuation, currentLightInfo.quadraticAttenuation);
-    
-    transVec3ToShader(uniform.iLocSpotLight.iLocSpotDirection, spotLightInfo.spotDirection);
-    glUniform1f(uniform.iLocSpotLight.iLocSpotExponent, spotLightInfo.spotExponent);
-    glUniform1f(uniform.iLocSpotLight.iLocSpotCutOff, spotLightInfo.spotCutOff);
-    
-    glUniform1i(uniform.iLocCurLightMode, curLightMode);
-    glUniform1f(uniform.iLocShininess, shininess);
-    glUniform1i(uniform.iLocIsPerPixLighting, !per_vertex_or_per_pixel);
+    SetFrameUniforms();
+    GLsizei views = side_by_side ? 2 : 1;
+    int lighting = side_by_side ? SIDE_BY_SIDE_LIGHTING : per_vertex_or_per_pixel ? PER_VERTEX_LIGHTING : PER_PIXEL_LIGHTING;
 
     // iterate over each shape in the current model
-    for (auto& shape : currentModel.shapes)
+    const auto& shapes = currentModel.loaded ? currentModel.shapes : placeholderModel.shapes;
+    float pixelsPerUnit = ModelPixelsPerUnit(currentModel);
+    for (auto& shape : shapes)
     {
-        transVec3ToShader(uniform.iLocMaterial.iLocKa, shape.material.Ka);
-        transVec3ToShader(uniform.iLocMaterial.iLocKd, shape.material.Kd);
-        transVec3ToShader(uniform.iLocMaterial.iLocKs, shape.material.Ks);
-        
-        glUniform1i(uniform.iLocIsEye, shape.material.isEye);
+        const ShaderProgram& shader = GetShaderProgram(curLightMode, lighting, shape.material.isEye == 1);
+        glState.UseProgram(shader.program);
+        glState.UniformMatrix4fv(shader.uniform.iLocM, m);
+        glState.UniformMatrix4fv(shader.uniform.iLocV, v);
+        glState.UniformMatrix4fv(shader.uniform.iLocP, p);
+        glState.UniformMatrix3fv(shader.uniform.iLocN, n);
+        glState.BindBufferRange(MATERIAL_BLOCK_BINDING, shape.material.uniformBuffer, shape.material.uniformOffset,
+                                sizeof(MaterialBlock));
         if (shape.material.isEye == 1)
         {
-            glUniform1f(uniform.iLocOffsetX, shape.material.offsets.at(cur_eye_offset_idx).x);
-            glUniform1f(uniform.iLocOffsetY, shape.material.offsets.at(cur_eye_offset_idx).y);
+            glState.Uniform1f(shader.uniform.iLocOffsetX, shape.material.offsets.at(cur_eye_offset_idx).x);
+            glState.Uniform1f(shader.uniform.iLocOffsetY, shape.material.offsets.at(cur_eye_offset_idx).y);
         }
         //glBindVertexArray(models[cur_idx].shapes[i].vao);
-        glBindVertexArray(shape.vao);
+        glState.BindVertexArray(shape.vao);
 
         // [TODO] Bind texture and modify texture filtering & wrapping mode
         // Hint: glActiveTexture, glBindTexture, glTexParameteri
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, shape.material.diffuseTexture);
-
-        if (curMagFilterMode == MagFilterMode::NEAREST)
-           glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        else if (curMagFilterMode == MagFilterMode::LINEAR)
-           glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (curMinFilterMode == MinFilterMode::NEAREST_MIPMAP_LINEAR)
-           glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-        else if (curMinFilterMode == MinFilterMode::LINEAR_MIPMAP_LINEAR)
-           glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glState.BindTexture(0, shape.material.diffuseTexture);
+        glState.BindSampler(0, samplers[(int)curMagFilterMode][(int)curMinFilterMode]);
         //glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
-        glDrawArrays(GL_TRIANGLES, 0, shape.vertex_count);
+        const MeshLod* lod = SelectLod(shape, pixelsPerUnit);
+        if (!shape.clusters.empty() && lod == &shape.lods[0])
+            DrawClusters(shape, model_matrix, shader.uniform.iLocFirstView, views);
+        else
+        {
+            if (views > 1)
+                glState.Uniform1i(shader.uniform.iLocFirstView, 0);
+            if (lod)
+                DrawViews(lod->index_count, shape.indexType, (GLvoid*)(shape.indexOffset + lod->first_index * IndexSize(shape.indexType)), views);
+            else
+                DrawViews(shape.indexCount, shape.indexType, (GLvoid*)shape.indexOffset, views);
+        }
 
     }
 }
@@ -659,9 +1055,19 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     }
 }
 
+void PickUnderCursor(double x, double y, int width, int height);
+
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
-    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS)
+    {
+        double x, y;
+        int width, height;
+        glfwGetCursorPos(window, &x, &y);
+        glfwGetWindowSize(window, &width, &height);
+        PickUnderCursor(x, y, width, height);
+    }
+    else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
         mouse_pressed = true;
     else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE)
     {
@@ -728,23 +1134,39 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
     }
 }
 
+// Sources of shader.vs.glsl and shader.fs.glsl, every program is compiled from them.
+string vertexShaderSource, fragmentShaderSource;
+
 void setShaders()
+{
+    char *vs = textFileRead("shader.vs.glsl");
+    char *fs = textFileRead("shader.fs.glsl");
+    vertexShaderSource = vs ? vs : "";
+    fragmentShaderSource = fs ? fs : "";
+    free(vs);
+    free(fs);
+}
+
+// `source` with `defines` inserted after its #version line, which has to stay the first.
+static void ShaderSourceWithDefines(GLuint shader, const string& source, const string& defines)
+{
+    size_t body = source.find('\n');
+    body = body == string::npos ? source.size() : body + 1;
+    string version = source.substr(0, body);
+    const GLchar* strings[] = { version.c_str(), defines.c_str(), source.c_str() + body };
+    glShaderSource(shader, 3, strings, NULL);
+}
+
+// Compiles and links the shaders with `defines`.
+GLuint CompileProgram(const string& defines)
 {
     GLuint v, f, p;
-    char *vs = NULL;
-    char *fs = NULL;
 
     v = glCreateShader(GL_VERTEX_SHADER);
     f = glCreateShader(GL_FRAGMENT_SHADER);
 
-    vs = textFileRead("shader.vs.glsl");
-    fs = textFileRead("shader.fs.glsl");
-
-    glShaderSource(v, 1, (const GLchar**)&vs, NULL);
-    glShaderSource(f, 1, (const GLchar**)&fs, NULL);
-
-    free(vs);
-    free(fs);
+    ShaderSourceWithDefines(v, vertexShaderSource, defines);
+    ShaderSourceWithDefines(f, fragmentShaderSource, defines);
 
     GLint success;
     char infoLog[1000];
@@ -787,120 +1209,253 @@ void setShaders()
     glDeleteShader(v);
     glDeleteShader(f);
 
-    if (success)
-        glUseProgram(p);
-    else
+    if (!success)
     {
         system("pause");
         exit(123);
     }
-
-    program = p;
+    return p;
 }
 
-void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, tinyobj::shape_t* shape)
+// Face corners with the same (vertex, normal, texcoord) indices share one vertex.
+struct IndexHash
 {
-    vector<float> xVector, yVector, zVector;
-    float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
-
-    // find out min and max value of X, Y and Z axis
-    for (int i = 0; i < attrib->vertices.size(); i++)
+    size_t operator()(const tinyobj::index_t& idx) const
     {
-        //maxs = max(maxs, attrib->vertices.at(i));
-        if (i % 3 == 0)
-        {
+        return (size_t)idx.vertex_index * 73856093u ^ (size_t)idx.normal_index * 19349663u ^ (size_t)idx.texcoord_index * 83492791u;
+    }
+};
 
-            xVector.push_back(attrib->vertices.at(i));
+struct IndexEqual
+{
+    bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const
+    {
+        return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+    }
+};
 
-            if (attrib->vertices.at(i) < minX)
-            {
-                minX = attrib->vertices.at(i);
-            }
+typedef unordered_map<tinyobj::index_t, GLuint, IndexHash, IndexEqual> VertexIdMap;
 
-            if (attrib->vertices.at(i) > maxX)
-            {
-                maxX = attrib->vertices.at(i);
-            }
-        }
-        else if (i % 3 == 1)
-        {
-            yVector.push_back(attrib->vertices.at(i));
+// 16 bit indices when they can address every vertex
+static GLenum IndexTypeFor(size_t vertex_count)
+{
+    return vertex_count <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
 
-            if (attrib->vertices.at(i) < minY)
-            {
-                minY = attrib->vertices.at(i);
-            }
+static size_t IndexSize(GLenum index_type)
+{
+    return index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
 
-            if (attrib->vertices.at(i) > maxY)
-            {
-                maxY = attrib->vertices.at(i);
-            }
-        }
-        else if (i % 3 == 2)
-        {
-            zVector.push_back(attrib->vertices.at(i));
+// Writes `count` indices as `index_type` to `dst`.
+static void StoreIndices(const GLuint* indices, size_t count, GLenum index_type, void* dst)
+{
+    if (index_type == GL_UNSIGNED_SHORT)
+    {
+        GLushort* out = (GLushort*)dst;
+        for (size_t i = 0; i < count; i++)
+            out[i] = (GLushort)indices[i];
+    }
+    else
+    {
+        memcpy(dst, indices, count * sizeof(GLuint));
+    }
+}
 
-            if (attrib->vertices.at(i) < minZ)
-            {
-                minZ = attrib->vertices.at(i);
-            }
+//* Position kernels *//
+// Used by normalization() on the interleaved xyz positions of a model. The SIMD loops read W vertices
+// (W = 8 with AVX, 4 with SSE2) as 3 registers, so float j of such a block always holds axis j % 3.
+// Results match the scalar loops.
+#if defined(__AVX__)
+typedef __m256 PosVec;
+const size_t POS_VEC_WIDTH = 8;
+# define POSITIONS_SIMD "AVX"
+# define PosLoad _mm256_loadu_ps
+# define PosStore _mm256_storeu_ps
+# define PosSet1 _mm256_set1_ps
+# define PosMin _mm256_min_ps
+# define PosMax _mm256_max_ps
+# define PosSub _mm256_sub_ps
+# define PosDiv _mm256_div_ps
+#elif defined(__SSE2__) || defined(_M_X64)
+typedef __m128 PosVec;
+const size_t POS_VEC_WIDTH = 4;
+# define POSITIONS_SIMD "SSE2"
+# define PosLoad _mm_loadu_ps
+# define PosStore _mm_storeu_ps
+# define PosSet1 _mm_set1_ps
+# define PosMin _mm_min_ps
+# define PosMax _mm_max_ps
+# define PosSub _mm_sub_ps
+# define PosDiv _mm_div_ps
+#endif
 
-            if (attrib->vertices.at(i) > maxZ)
-            {
-                maxZ = attrib->vertices.at(i);
-            }
+static void PositionBoundsScalar(const GLfloat* positions, size_t first, size_t count, float minPos[3], float maxPos[3])
+{
+    for (size_t i = first; i < count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            minPos[k] = min(minPos[k], positions[3 * i + k]);
+            maxPos[k] = max(maxPos[k], positions[3 * i + k]);
         }
     }
-    
-    float offsetX = (maxX + minX) / 2;
-    float offsetY = (maxY + minY) / 2;
-    float offsetZ = (maxZ + minZ) / 2;
+}
+
+static void RecenterAndScaleScalar(GLfloat* positions, size_t first, size_t count, const float offset[3], float scale)
+{
+    for (size_t i = first; i < count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+            positions[3 * i + k] = (positions[3 * i + k] - offset[k]) / scale;
+    }
+}
 
-    for (int i = 0; i < attrib->vertices.size(); i++)
+// Grows minPos/maxPos to contain `count` xyz positions.
+void PositionBounds(const GLfloat* positions, size_t count, float minPos[3], float maxPos[3])
+{
+    size_t i = 0;
+#ifdef POSITIONS_SIMD
+    if (count >= POS_VEC_WIDTH)
     {
-        if (offsetX != 0 && i % 3 == 0)
+        PosVec lo[3], hi[3];
+        for (int k = 0; k < 3; k++)
+            lo[k] = hi[k] = PosLoad(positions + k * POS_VEC_WIDTH);
+        for (; i + POS_VEC_WIDTH <= count; i += POS_VEC_WIDTH)
         {
-            attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
+            const GLfloat* block = positions + 3 * i;
+            for (int k = 0; k < 3; k++)
+            {
+                PosVec v = PosLoad(block + k * POS_VEC_WIDTH);
+                lo[k] = PosMin(lo[k], v);
+                hi[k] = PosMax(hi[k], v);
+            }
         }
-        else if (offsetY != 0 && i % 3 == 1)
+
+        float lanes[2][3 * POS_VEC_WIDTH];
+        for (int k = 0; k < 3; k++)
         {
-            attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
+            PosStore(lanes[0] + k * POS_VEC_WIDTH, lo[k]);
+            PosStore(lanes[1] + k * POS_VEC_WIDTH, hi[k]);
         }
-        else if (offsetZ != 0 && i % 3 == 2)
+        for (size_t j = 0; j < 3 * POS_VEC_WIDTH; j++)
         {
-            attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+            minPos[j % 3] = min(minPos[j % 3], lanes[0][j]);
+            maxPos[j % 3] = max(maxPos[j % 3], lanes[1][j]);
         }
     }
+#endif
+    PositionBoundsScalar(positions, i, count, minPos, maxPos);
+}
 
-    float greatestAxis = maxX - minX;
-    float distanceOfYAxis = maxY - minY;
-    float distanceOfZAxis = maxZ - minZ;
-
-    if (distanceOfYAxis > greatestAxis)
+// positions = (positions - offset) / scale for `count` xyz positions, in place.
+void RecenterAndScale(GLfloat* positions, size_t count, const float offset[3], float scale)
+{
+    size_t i = 0;
+#ifdef POSITIONS_SIMD
+    float pattern[3 * POS_VEC_WIDTH];
+    for (size_t j = 0; j < 3 * POS_VEC_WIDTH; j++)
+        pattern[j] = offset[j % 3];
+    PosVec off[3];
+    for (int k = 0; k < 3; k++)
+        off[k] = PosLoad(pattern + k * POS_VEC_WIDTH);
+    PosVec s = PosSet1(scale);
+
+    for (; i + POS_VEC_WIDTH <= count; i += POS_VEC_WIDTH)
     {
-        greatestAxis = distanceOfYAxis;
+        GLfloat* block = positions + 3 * i;
+        for (int k = 0; k < 3; k++)
+            PosStore(block + k * POS_VEC_WIDTH, PosDiv(PosSub(PosLoad(block + k * POS_VEC_WIDTH), off[k]), s));
     }
+#endif
+    RecenterAndScaleScalar(positions, i, count, offset, scale);
+}
+
+// Centers the bounding box of the whole model and scales its longest axis to [-1, 1]. Done once per
+// model, shapes share attrib->vertices and are indexed by IndexShape() afterwards.
+void normalization(tinyobj::attrib_t* attrib)
+{
+    vector<GLfloat>& positions = attrib->vertices;
+    float minPos[3] = { 10000, 10000, 10000 }, maxPos[3] = { -10000, -10000, -10000 };
+
+    // find out min and max value of X, Y and Z axis
+    PositionBounds(positions.data(), positions.size() / 3, minPos, maxPos);
 
-    if (distanceOfZAxis > greatestAxis)
+    float offset[3];
+    float greatestAxis = 0;
+    for (int k = 0; k < 3; k++)
     {
-        greatestAxis = distanceOfZAxis;
+        offset[k] = (maxPos[k] + minPos[k]) / 2;
+        greatestAxis = max(greatestAxis, maxPos[k] - minPos[k]);
     }
-
     float scale = greatestAxis / 2;
+    RecenterAndScale(positions.data(), positions.size() / 3, offset, scale);
+}
 
-    for (int i = 0; i < attrib->vertices.size(); i++)
+// Times the position kernels against their scalar loops on `vertex_count` random positions,
+// run with --bench-normalization [vertex count].
+void BenchmarkNormalization(size_t vertex_count)
+{
+    vector<GLfloat> positions(vertex_count * 3);
+    for (GLfloat& p : positions)
+        p = (rand() / (float)RAND_MAX - 0.5f) * 200.0f;
+    vector<GLfloat> reference = positions;
+    const int runs = 10;
+
+    // each run transforms the previous output again, both versions see the same values
+    double simd = 0, scalar = 0;
+    bool same = true;
+    for (int r = 0; r < runs; r++)
     {
-        //std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
-        attrib->vertices.at(i) = attrib->vertices.at(i)/ scale;
+        float minPos[3] = { 10000, 10000, 10000 }, maxPos[3] = { -10000, -10000, -10000 };
+        float refMin[3] = { 10000, 10000, 10000 }, refMax[3] = { -10000, -10000, -10000 };
+        float offset[3] = { 1.5f, -2.0f, 0.25f };
+
+        auto start = chrono::steady_clock::now();
+        PositionBounds(positions.data(), vertex_count, minPos, maxPos);
+        RecenterAndScale(positions.data(), vertex_count, offset, 1.01f);
+        simd += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        PositionBoundsScalar(reference.data(), 0, vertex_count, refMin, refMax);
+        RecenterAndScaleScalar(reference.data(), 0, vertex_count, offset, 1.01f);
+        scalar += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        same = same && memcmp(minPos, refMin, sizeof(minPos)) == 0 && memcmp(maxPos, refMax, sizeof(maxPos)) == 0;
     }
+    same = same && memcmp(positions.data(), reference.data(), positions.size() * sizeof(GLfloat)) == 0;
+
+#ifdef POSITIONS_SIMD
+    const char* kernel = POSITIONS_SIMD;
+#else
+    const char* kernel = "scalar";
+#endif
+    printf("normalization of %d vertices: %s %.2f ms, scalar %.2f ms (%.1fx), results %s\n", (int)vertex_count, kernel,
+           simd / runs, scalar / runs, scalar / simd, same ? "identical" : "DIFFER");
+}
+
+// Appends the vertices and indices of one shape of a normalized model.
+void IndexShape(const tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, vector<GLuint>& indices, const tinyobj::shape_t* shape)
+{
+    // corners are only shared between faces of the same material, SplitShapeByMaterial() splits by vertex
+    vector<VertexIdMap> vertex_ids;
     size_t index_offset = 0;
     for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++) {
         int fv = shape->mesh.num_face_vertices[f];
+        int material = shape->mesh.material_ids[f];
+        if (vertex_ids.size() <= material + 1)
+            vertex_ids.resize(material + 2);
 
         // Loop over vertices in the face.
         for (size_t v = 0; v < fv; v++) {
             // access to vertex
             tinyobj::index_t idx = shape->mesh.indices[index_offset + v];
+            auto found = vertex_ids[material + 1].insert(make_pair(idx, (GLuint)material_id.size()));
+            indices.push_back(found.first->second);
+            if (!found.second)
+                continue;
+
+            // first use of this vertex
             vertices.push_back(attrib->vertices[3 * idx.vertex_index + 0]);
             vertices.push_back(attrib->vertices[3 * idx.vertex_index + 1]);
             vertices.push_back(attrib->vertices[3 * idx.vertex_index + 2]);
@@ -908,15 +1463,23 @@ void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<
             colors.push_back(attrib->colors[3 * idx.vertex_index + 0]);
             colors.push_back(attrib->colors[3 * idx.vertex_index + 1]);
             colors.push_back(attrib->colors[3 * idx.vertex_index + 2]);
-            // Optional: vertex normals
-            normals.push_back(attrib->normals[3 * idx.normal_index + 0]);
-            normals.push_back(attrib->normals[3 * idx.normal_index + 1]);
-            normals.push_back(attrib->normals[3 * idx.normal_index + 2]);
+            // Optional: vertex normals, GenerateMissingNormals() gave every corner one
+            if (idx.normal_index >= 0) {
+                normals.push_back(attrib->normals[3 * idx.normal_index + 0]);
+                normals.push_back(attrib->normals[3 * idx.normal_index + 1]);
+                normals.push_back(attrib->normals[3 * idx.normal_index + 2]);
+            } else {
+                normals.insert(normals.end(), 3, 0.0f);
+            }
             // Optional: texture coordinate
-            textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 0]);
-            textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 1]);
+            if (idx.texcoord_index >= 0) {
+                textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 0]);
+                textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 1]);
+            } else {
+                textureCoords.insert(textureCoords.end(), 2, 0.0f);
+            }
             // The material of this vertex
-            material_id.push_back(shape->mesh.material_ids[f]);
+            material_id.push_back(material);
         }
         index_offset += fv;
     }
@@ -928,13 +1491,43 @@ static string GetBaseDir(const string& filepath) {
     return "";
 }
 
-GLuint LoadTextureImage(string image_path)
+static uint64_t HashBytes(const char* data, size_t size);
+
+// RGBA pixels of an image, decoded on a loader thread. `pixels` stays NULL when the texture cache
+// already has the image, UploadModel() shares that texture then.
+struct DecodedImage
+{
+    string path;
+    uint64_t hash = 0;      // of the file content, 0 if not read
+    int width = 0, height = 0;
+    stbi_uc* pixels = NULL;
+};
+
+// Reads and hashes the file of `image`, and decodes it unless `decode` says otherwise.
+static bool ReadTextureImage(DecodedImage* image, const function<bool(uint64_t)>& decode)
 {
-    int channel, width, height;
+    tinyobj::MappedFile file;
+    if (!file.Open(image->path.c_str()))
+    {
+        cout << "LoadTextureImage: Cannot load image from " << image->path << endl;
+        return false;
+    }
+    image->hash = HashBytes(file.data(), file.size());
+    if (!decode(image->hash))
+        return true;
+
+    int channel;
     int require_channel = 4;
-    stbi_set_flip_vertically_on_load(true);
-    stbi_uc *data = stbi_load(image_path.c_str(), &width, &height, &channel, require_channel);
-    if (data != NULL)
+    image->pixels = stbi_load_from_memory((const stbi_uc*)file.data(), (int)file.size(), &image->width, &image->height, &channel, require_channel);
+    if (image->pixels == NULL)
+        cout << "LoadTextureImage: Cannot load image from " << image->path << endl;
+    return image->pixels != NULL;
+}
+
+// Creates the texture and frees the pixels, -1 if the image could not be decoded.
+GLuint CreateTextureImage(DecodedImage& image)
+{
+    if (image.pixels != NULL)
     {
         GLuint tex = 0;
 
@@ -942,88 +1535,3081 @@ GLuint LoadTextureImage(string image_path)
         // Hint: glGenTextures, glBindTexture, glTexImage2D, glGenerateMipmap
         glGenTextures(1, &tex);
         glBindTexture(GL_TEXTURE_2D, tex);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
         glGenerateMipmap(GL_TEXTURE_2D);
         // free the image from memory after binding to texture
-        stbi_image_free(data);
+        stbi_image_free(image.pixels);
+        image.pixels = NULL;
         return tex;
     }
     else
     {
-        cout << "LoadTextureImage: Cannot load image from " << image_path << endl;
         return -1;
     }
 }
 
-vector<Shape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, vector<PhongMaterial>& materials)
+// Textures shared by all materials of all models, found by path or, for copies of an image under
+// another name, by content hash. Reference counted: every Acquire() needs a Release().
+// Loader threads only query it, textures are created and deleted on the context thread.
+class TextureCache
 {
-    vector<Shape> res;
-    for (int m = 0; m < materials.size(); m++)
+public:
+    bool HasPath(const string& path)
     {
-        vector<GLfloat> m_vertices, m_colors, m_normals, m_textureCoords;
-        for (int v = 0; v < material_id.size(); v++)
-        {
-            // extract all vertices with same material id and create a new shape for it.
-            if (material_id[v] == m)
-            {
-                m_vertices.push_back(vertices[v * 3 + 0]);
-                m_vertices.push_back(vertices[v * 3 + 1]);
-                m_vertices.push_back(vertices[v * 3 + 2]);
+        lock_guard<mutex> lock(m);
+        return byPath.count(path) != 0;
+    }
 
-                m_colors.push_back(colors[v * 3 + 0]);
-                m_colors.push_back(colors[v * 3 + 1]);
-                m_colors.push_back(colors[v * 3 + 2]);
+    bool HasContent(uint64_t hash)
+    {
+        lock_guard<mutex> lock(m);
+        return byHash.count(hash) != 0;
+    }
 
-                m_normals.push_back(normals[v * 3 + 0]);
-                m_normals.push_back(normals[v * 3 + 1]);
-                m_normals.push_back(normals[v * 3 + 2]);
+    // The texture of `image`, created from its pixels if the cache does not have it yet. -1 on failure.
+    GLuint Acquire(DecodedImage& image)
+    {
+        GLuint tex = Find(image);
+        if (tex == (GLuint)-1)
+        {
+            // it was freed after the loader thread checked, decode it here
+            if (image.pixels == NULL && !ReadTextureImage(&image, [](uint64_t) { return true; }))
+                return -1;
+            tex = CreateTextureImage(image);
+            if (tex == (GLuint)-1)
+                return -1;
+
+            lock_guard<mutex> lock(m);
+            byPath[image.path] = tex;
+            byHash[image.hash] = tex;
+            textures[tex] = Entry{ image.hash, 1 };
+            created++;
+            return tex;
+        }
+
+        if (image.pixels != NULL)
+        {
+            stbi_image_free(image.pixels);
+            image.pixels = NULL;
+        }
+        shared++;
+        return tex;
+    }
+
+    void Release(GLuint tex)
+    {
+        {
+            lock_guard<mutex> lock(m);
+            auto it = textures.find(tex);
+            if (it == textures.end() || --it->second.refs > 0)
+                return;
+            byHash.erase(it->second.hash);
+            for (auto p = byPath.begin(); p != byPath.end();)
+                p = p->second == tex ? byPath.erase(p) : next(p);
+            textures.erase(it);
+        }
+        glDeleteTextures(1, &tex);
+    }
+
+    void PrintStats()
+    {
+        lock_guard<mutex> lock(m);
+        printf("Texture cache: %d textures created, %d shared, %d alive\n", created, shared, (int)textures.size());
+    }
+
+private:
+    // takes a reference to the texture of `image` if there is one already
+    GLuint Find(const DecodedImage& image)
+    {
+        lock_guard<mutex> lock(m);
+        auto p = byPath.find(image.path);
+        GLuint tex = p != byPath.end() ? p->second : -1;
+        if (tex == (GLuint)-1 && image.hash != 0)
+        {
+            auto h = byHash.find(image.hash);
+            if (h != byHash.end())
+            {
+                tex = h->second;
+                byPath[image.path] = tex;
+            }
+        }
+        if (tex != (GLuint)-1)
+            textures[tex].refs++;
+        return tex;
+    }
+
+    struct Entry
+    {
+        uint64_t hash;
+        int refs;
+    };
+    mutex m;
+    unordered_map<string, GLuint> byPath;
+    unordered_map<uint64_t, GLuint> byHash;
+    unordered_map<GLuint, Entry> textures;
+    int created = 0, shared = 0;
+};
+TextureCache textureCache;
+
+// No GL calls, safe on any thread. The flip is set once in setupRC(), stbi keeps it in a global.
+// Images the texture cache already has are not decoded again.
+DecodedImage DecodeTextureImage(const string& image_path)
+{
+    DecodedImage image;
+    image.path = image_path;
+    if (!textureCache.HasPath(image_path))
+        ReadTextureImage(&image, [](uint64_t hash) { return !textureCache.HasContent(hash); });
+    return image;
+}
+
+GLuint LoadTextureImage(string image_path)
+{
+    stbi_set_flip_vertically_on_load(true);
+    DecodedImage image;
+    image.path = image_path;
+    ReadTextureImage(&image, [](uint64_t) { return true; });
+    return CreateTextureImage(image);
+}
+
+// A material whose texture is decoded but not created yet.
+struct PendingMaterial
+{
+    PhongMaterial material;
+    DecodedImage diffuseImage;
+};
+
+vector<PendingMaterial> DecodePhongMaterials(const vector<tinyobj::material_t>& materials, const string& base_dir)
+{
+    vector<PendingMaterial> allMaterial;
+    for (int i = 0; i < materials.size(); i++)
+    {
+        PendingMaterial pending = PendingMaterial();
+        PhongMaterial& material = pending.material;
+        material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
+        material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
+        material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
+
+        pending.diffuseImage = DecodeTextureImage(base_dir + string(materials[i].diffuse_texname));
+        allMaterial.push_back(pending);
+    }
+    return allMaterial;
+}
+
+vector<PhongMaterial> CreatePhongMaterials(vector<PendingMaterial>& materials)
+{
+    vector<PhongMaterial> allMaterial;
+    for (int i = 0; i < materials.size(); i++)
+    {
+        PhongMaterial material = materials[i].material;
+        material.diffuseTexture = textureCache.Acquire(materials[i].diffuseImage);
+        if (material.diffuseTexture == -1)
+        {
+            cout << "LoadTexturedModels: Fail to load model's material " << i << endl;
+            system("pause");
+            
+        }
+        
+        allMaterial.push_back(material);
+    }
+    return allMaterial;
+}
+
+//* Vertex layout *//
+// Every shape reads one interleaved buffer: position, normal and uv in 32 bytes per vertex. The color
+// is only stored with vertexColors, the shaders do not use it and attribute 1 stays disabled otherwise.
+// The mesh cache and SplitShapeByMaterial() keep planar streams, they are encoded on upload.
+bool vertexColors = false;
+// 16 bytes per vertex instead of 32: positions are in [-1, 1] after normalization() and stored as
+// 16 bit SNORM, normals as GL_INT_2_10_10_10_REV, uvs as half floats(and colors as RGBA8). The
+// shaders read them unchanged. UploadModel() prints the error of every model.
+bool quantizeVertices = false;
+
+// Offsets and stride in bytes, color is -1 when it is not stored.
+struct VertexLayout
+{
+    bool quantized;
+    int stride;
+    int position, normal, texCoord, color;
+};
+
+VertexLayout GetVertexLayout()
+{
+    VertexLayout layout = { false, 32, 0, 12, 24, -1 };
+    if (quantizeVertices)
+        layout = { true, 16, 0, 8, 12, -1 };
+    if (vertexColors)
+    {
+        layout.color = layout.stride;
+        layout.stride += quantizeVertices ? 4 : 12;
+    }
+    return layout;
+}
+
+// Where the attributes of consecutive float vertices go: four planar arrays or one interleaved buffer.
+// Strides are in floats, `colors` is NULL when the layout has no color.
+struct VertexStreams
+{
+    GLfloat *vertices, *colors, *normals, *textureCoords;
+    size_t vertexStride, colorStride, normalStride, texCoordStride;
+
+    static VertexStreams Planar(GLfloat* vertices, GLfloat* colors, GLfloat* normals, GLfloat* textureCoords)
+    {
+        return { vertices, colors, normals, textureCoords, 3, 3, 3, 2 };
+    }
+
+    // `layout` must not be quantized
+    static VertexStreams Interleaved(const VertexLayout& layout, GLfloat* buffer)
+    {
+        size_t stride = layout.stride / sizeof(GLfloat);
+        GLfloat* colors = layout.color >= 0 ? buffer + layout.color / sizeof(GLfloat) : NULL;
+        return { buffer + layout.position / sizeof(GLfloat), colors, buffer + layout.normal / sizeof(GLfloat), buffer + layout.texCoord / sizeof(GLfloat),
+                 stride, stride, stride, stride };
+    }
+
+    // the streams from vertex `first` on
+    VertexStreams From(size_t first) const
+    {
+        VertexStreams res = *this;
+        res.vertices += first * vertexStride;
+        if (res.colors)
+            res.colors += first * colorStride;
+        res.normals += first * normalStride;
+        res.textureCoords += first * texCoordStride;
+        return res;
+    }
+};
+
+// Largest differences between the float vertices and their quantized values, in the units of the
+// normalized model. The normal error is the angle between both directions.
+struct QuantizationError
+{
+    size_t vertices = 0;
+    double position = 0, normalDegrees = 0, texCoord = 0, color = 0;
+
+    void Print(const string& model_path) const
+    {
+        if (vertices == 0)
+            return;
+        printf("Quantized %s: %d vertices, max error position %.2g, normal %.3f deg, uv %.2g, color %.2g\n", model_path.c_str(), (int)vertices,
+               position, normalDegrees, texCoord, color);
+    }
+};
+
+// Round to nearest even, overflow becomes infinity.
+static GLushort FloatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+    if (((x >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    if (exp >= 31)
+        return sign | 0x7c00;
+    if (exp <= 0)
+    {
+        // subnormal half
+        if (exp < -10)
+            return sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t half = mant >> shift, rest = mant & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+    uint32_t half = sign | (exp << 10) | (mant >> 13), rest = mant & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return half;
+}
+
+static float HalfToFloat(GLushort h)
+{
+    int exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+    float v = exp == 0 ? ldexpf((float)mant, -24) : exp == 31 ? INFINITY : ldexpf((float)(mant | 0x400), exp - 25);
+    return (h & 0x8000) ? -v : v;
+}
+
+// Signed normalized with `bits`, decoded as c / (2^(bits-1) - 1) like GL 4.2 does. Older drivers
+// decode as (2c + 1) / (2^bits - 1), which is off by less than one more step.
+static int ToSnorm(float v, int bits)
+{
+    float scale = (float)((1 << (bits - 1)) - 1);
+    return (int)floorf(min(max(v, -1.0f), 1.0f) * scale + 0.5f);
+}
+
+// Writes `vertex_count` vertices of planar float streams into `out` in `layout`.
+static void EncodeVertices(const VertexLayout& layout, size_t vertex_count, const GLfloat* vertices, const GLfloat* colors, const GLfloat* normals,
+                           const GLfloat* textureCoords, char* out, QuantizationError* error)
+{
+    if (!layout.quantized)
+    {
+        VertexStreams to = VertexStreams::Interleaved(layout, (GLfloat*)out);
+        for (size_t i = 0; i < vertex_count; i++)
+        {
+            memcpy(to.vertices + i * to.vertexStride, vertices + i * 3, 3 * sizeof(GLfloat));
+            if (to.colors)
+                memcpy(to.colors + i * to.colorStride, colors + i * 3, 3 * sizeof(GLfloat));
+            memcpy(to.normals + i * to.normalStride, normals + i * 3, 3 * sizeof(GLfloat));
+            memcpy(to.textureCoords + i * to.texCoordStride, textureCoords + i * 2, 2 * sizeof(GLfloat));
+        }
+        return;
+    }
+
+    const float radToDeg = 180.0f / 3.14159265f;
+    for (size_t i = 0; i < vertex_count; i++)
+    {
+        char* vertex = out + i * layout.stride;
+        const GLfloat* p = vertices + i * 3;
+        GLshort position[4] = { 0, 0, 0, 0 };
+        for (int k = 0; k < 3; k++)
+        {
+            position[k] = (GLshort)ToSnorm(p[k], 16);
+            error->position = max(error->position, fabs(position[k] / 32767.0 - p[k]));
+        }
+        memcpy(vertex + layout.position, position, sizeof(position));
+
+        // only the direction matters, the shaders normalize it
+        const GLfloat* n = normals + i * 3;
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        uint32_t normal = 0;
+        if (length > 0)
+        {
+            int c[3];
+            float decoded[3], dot = 0, decodedLength = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                c[k] = ToSnorm(n[k] / length, 10);
+                normal |= (uint32_t)(c[k] & 0x3ff) << (10 * k);
+                decoded[k] = c[k] / 511.0f;
+                dot += decoded[k] * n[k] / length;
+                decodedLength += decoded[k] * decoded[k];
+            }
+            if (decodedLength > 0)
+                error->normalDegrees = max(error->normalDegrees, acos(min(dot / sqrtf(decodedLength), 1.0f)) * radToDeg);
+        }
+        memcpy(vertex + layout.normal, &normal, sizeof(normal));
+
+        GLushort texCoord[2];
+        for (int k = 0; k < 2; k++)
+        {
+            texCoord[k] = FloatToHalf(textureCoords[i * 2 + k]);
+            error->texCoord = max(error->texCoord, fabs(HalfToFloat(texCoord[k]) - textureCoords[i * 2 + k]));
+        }
+        memcpy(vertex + layout.texCoord, texCoord, sizeof(texCoord));
+
+        if (layout.color >= 0)
+        {
+            GLubyte color[4] = { 0, 0, 0, 255 };
+            for (int k = 0; k < 3; k++)
+            {
+                float c = min(max(colors[i * 3 + k], 0.0f), 1.0f);
+                color[k] = (GLubyte)floorf(c * 255 + 0.5f);
+                error->color = max(error->color, fabs(color[k] / 255.0 - colors[i * 3 + k]));
+            }
+            memcpy(vertex + layout.color, color, sizeof(color));
+        }
+    }
+    error->vertices += vertex_count;
+}
+
+// Points the attributes of the bound VAO at the vertices of `buffer` from `first` on.
+static void SetVertexAttributes(GLuint buffer, size_t first)
+{
+    VertexLayout layout = GetVertexLayout();
+    size_t base = first * layout.stride;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (layout.quantized)
+    {
+        glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, layout.stride, (GLvoid*)(base + layout.position));
+        glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, layout.stride, (GLvoid*)(base + layout.normal));
+        glVertexAttribPointer(3, 2, GL_HALF_FLOAT, GL_FALSE, layout.stride, (GLvoid*)(base + layout.texCoord));
+    }
+    else
+    {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid*)(base + layout.position));
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid*)(base + layout.normal));
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid*)(base + layout.texCoord));
+    }
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    if (layout.color >= 0)
+    {
+        if (layout.quantized)
+            glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, layout.stride, (GLvoid*)(base + layout.color));
+        else
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid*)(base + layout.color));
+        glEnableVertexAttribArray(1);
+    }
+}
+
+Shape CreateShape(int vertex_count, const GLfloat* vertices, const GLfloat* colors, const GLfloat* normals, const GLfloat* textureCoords,
+                  int index_count, GLenum index_type, const void* indices, const vector<MeshLod>& lods, const vector<MeshCluster>& clusters,
+                  const PhongMaterial& material, QuantizationError* error)
+{
+    Shape tmp_shape = Shape();
+    glGenVertexArrays(1, &tmp_shape.vao);
+    glBindVertexArray(tmp_shape.vao);
+
+    VertexLayout layout = GetVertexLayout();
+    vector<char> encoded(vertex_count * layout.stride);
+    EncodeVertices(layout, vertex_count, vertices, colors, normals, textureCoords, encoded.data(), error);
+    glGenBuffers(1, &tmp_shape.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
+    glBufferData(GL_ARRAY_BUFFER, encoded.size(), encoded.data(), GL_STATIC_DRAW);
+    SetVertexAttributes(tmp_shape.vbo, 0);
+    tmp_shape.vertex_count = vertex_count;
+
+    glGenBuffers(1, &tmp_shape.ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tmp_shape.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * IndexSize(index_type), indices, GL_STATIC_DRAW);
+    tmp_shape.indexCount = lods.empty() ? index_count : lods[0].index_count;
+    tmp_shape.indexType = index_type;
+    tmp_shape.indexOffset = 0;
+    tmp_shape.lods = lods;
+    tmp_shape.clusters = clusters;
+
+    tmp_shape.material = material;
+    return tmp_shape;
+}
+//* Vertex layout *//
+
+//* Mesh optimization *//
+// After loading, the triangles of every shape are reordered for the post-transform vertex cache
+// (Tipsify, Sander et al. 2007) and then the vertices in order of first use, so that the vertex
+// shader runs less often and fetches the vertex buffers front to back.
+bool optimizeMeshes = true;
+// FIFO size assumed for both the reordering and the reported statistics
+const int VERTEX_CACHE_SIZE = 16;
+
+// Post-transform cache misses of a model, before and after OptimizeMesh().
+struct VertexCacheStats
+{
+    size_t triangles = 0, vertices = 0;
+    size_t missesBefore = 0, missesAfter = 0;
+
+    // ACMR: misses per triangle(0.5 at best), ATVR: misses per vertex(1 at best)
+    void Print(const string& model_path) const
+    {
+        if (triangles == 0)
+            return;
+        printf("Vertex cache %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", model_path.c_str(),
+               (double)missesBefore / triangles, (double)missesAfter / triangles,
+               (double)missesBefore / vertices, (double)missesAfter / vertices);
+    }
+};
+
+static size_t CountCacheMisses(const GLuint* indices, size_t index_count, size_t vertex_count)
+{
+    // a vertex is in the FIFO while less than VERTEX_CACHE_SIZE misses happened after its own
+    vector<size_t> missedAt(vertex_count, 0);   // 1 based, 0: never
+    size_t misses = 0;
+    for (size_t i = 0; i < index_count; i++)
+    {
+        size_t& at = missedAt[indices[i]];
+        if (at == 0 || misses - at >= VERTEX_CACHE_SIZE)
+            at = ++misses;
+    }
+    return misses;
+}
+
+// Tipsify: fans around the last emitted vertex which is still in the cache and has triangles left.
+static void ReorderForVertexCache(vector<GLuint>& indices, size_t vertex_count)
+{
+    const size_t triangle_count = indices.size() / 3;
+
+    // triangles of every vertex
+    vector<GLuint> adjacencyStart(vertex_count + 1, 0);
+    for (GLuint v : indices)
+        adjacencyStart[v + 1]++;
+    for (size_t v = 0; v < vertex_count; v++)
+        adjacencyStart[v + 1] += adjacencyStart[v];
+    vector<GLuint> adjacency(indices.size());
+    vector<GLuint> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    vector<int> liveTriangles(vertex_count);
+    for (size_t v = 0; v < vertex_count; v++)
+        liveTriangles[v] = adjacencyStart[v + 1] - adjacencyStart[v];
+
+    vector<size_t> cachedAt(vertex_count, 0);
+    vector<char> emitted(triangle_count, 0);
+    vector<GLuint> deadEnds, candidates, res;
+    res.reserve(indices.size());
+    size_t time = VERTEX_CACHE_SIZE + 1;
+    size_t cursor = 0;
+
+    int fan = vertex_count > 0 ? 0 : -1;
+    while (fan >= 0)
+    {
+        candidates.clear();
+        for (GLuint a = adjacencyStart[fan]; a < adjacencyStart[fan + 1]; a++)
+        {
+            GLuint t = adjacency[a];
+            if (emitted[t])
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                GLuint v = indices[t * 3 + k];
+                res.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cachedAt[v] > VERTEX_CACHE_SIZE)
+                    cachedAt[v] = time++;
+            }
+            emitted[t] = 1;
+        }
+
+        // the candidate which stays in the cache for its remaining triangles and entered it first
+        fan = -1;
+        int best = -1;
+        for (GLuint v : candidates)
+        {
+            if (liveTriangles[v] <= 0)
+                continue;
+            int priority = 0;
+            if (time - cachedAt[v] + 2 * liveTriangles[v] <= VERTEX_CACHE_SIZE)
+                priority = (int)(time - cachedAt[v]);
+            if (priority > best)
+            {
+                best = priority;
+                fan = v;
+            }
+        }
+
+        // dead end: a recently used vertex with triangles left, else the next one in input order
+        while (fan < 0 && !deadEnds.empty())
+        {
+            GLuint v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0)
+                fan = v;
+        }
+        for (; fan < 0 && cursor < vertex_count; cursor++)
+        {
+            if (liveTriangles[cursor] > 0)
+                fan = cursor;
+        }
+    }
+
+    indices.swap(res);
+}
+
+// Renumbers the vertices in order of first use, `remap` maps the old ids to the new ones.
+static void ReorderForVertexFetch(vector<GLuint>& indices, size_t vertex_count, vector<GLuint>* remap)
+{
+    remap->assign(vertex_count, (GLuint)-1);
+    GLuint next = 0;
+    for (GLuint& v : indices)
+    {
+        if ((*remap)[v] == (GLuint)-1)
+            (*remap)[v] = next++;
+        v = (*remap)[v];
+    }
+    // vertices no triangle uses go last
+    for (GLuint& id : *remap)
+    {
+        if (id == (GLuint)-1)
+            id = next++;
+    }
+}
+
+// Reorders the triangles of a shape, the caller moves vertex `i` to `remap[i]`.
+void OptimizeMesh(vector<GLuint>& indices, size_t vertex_count, vector<GLuint>* remap, VertexCacheStats* stats)
+{
+    stats->triangles += indices.size() / 3;
+    stats->vertices += vertex_count;
+    stats->missesBefore += CountCacheMisses(indices.data(), indices.size(), vertex_count);
+
+    ReorderForVertexCache(indices, vertex_count);
+    ReorderForVertexFetch(indices, vertex_count, remap);
+
+    stats->missesAfter += CountCacheMisses(indices.data(), indices.size(), vertex_count);
+}
+
+// Moves the `N` component vertex `i` of `data` to `remap[i]`.
+template <int N>
+static void RemapVertices(GLfloat* data, const vector<GLuint>& remap)
+{
+    vector<GLfloat> res(remap.size() * N);
+    for (size_t i = 0; i < remap.size(); i++)
+        memcpy(&res[remap[i] * N], &data[i * N], N * sizeof(GLfloat));
+    memcpy(data, res.data(), res.size() * sizeof(GLfloat));
+}
+//* Mesh optimization *//
+
+//* Level of detail *//
+// Every shape gets up to LOD_COUNT - 1 simplified index lists after its own, made with quadric error
+// metrics(Garland and Heckbert 1997). Edges collapse into one of their vertices, so all levels share
+// the vertex buffer. Vertices on a border of the index buffer never move, which also keeps the uv and
+// normal seams. RenderScene() draws the coarsest level whose error projects to at most lodPixelError
+// pixels.
+bool buildLods = true;
+const int LOD_COUNT = 4;
+float lodPixelError = 1.0f;
+// collapses moving the surface further than this(in normalized model units) are not done
+const float LOD_MAX_ERROR = 0.05f;
+
+// Triangles drawn at every level of detail, summed over the shapes of a model. A shape with fewer
+// levels counts its coarsest one for the rest.
+struct LodStats
+{
+    size_t triangles[LOD_COUNT] = {};
+
+    void Add(const vector<MeshLod>& lods)
+    {
+        for (int i = 0; i < LOD_COUNT && !lods.empty(); i++)
+            triangles[i] += lods[min(i, (int)lods.size() - 1)].index_count / 3;
+    }
+
+    void Print(const string& model_path) const
+    {
+        if (triangles[0] == 0)
+            return;
+        printf("Level of detail %s: %d", model_path.c_str(), (int)triangles[0]);
+        for (int i = 1; i < LOD_COUNT; i++)
+            printf(" -> %d", (int)triangles[i]);
+        printf(" triangles\n");
+    }
+};
+
+// Sum of the squared distances to a set of planes, weighted by triangle area.
+struct Quadric
+{
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0, w = 0;
+
+    void AddPlane(double a, double b, double c, double d, double weight)
+    {
+        a2 += weight * a * a; ab += weight * a * b; ac += weight * a * c; ad += weight * a * d;
+        b2 += weight * b * b; bc += weight * b * c; bd += weight * b * d;
+        c2 += weight * c * c; cd += weight * c * d;
+        d2 += weight * d * d;
+        w += weight;
+    }
+
+    void Add(const Quadric& q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+        w += q.w;
+    }
+
+    // mean squared distance of `p` to the planes
+    double Error(const GLfloat* p) const
+    {
+        double x = p[0], y = p[1], z = p[2];
+        double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x + b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+                   c2 * z * z + 2 * cd * z + d2;
+        return w > 0 ? max(e, 0.0) / w : 0;
+    }
+};
+
+static void TriangleNormal(const GLfloat* p0, const GLfloat* p1, const GLfloat* p2, double n[3])
+{
+    double u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    double v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    n[0] = u[1] * v[2] - u[2] * v[1];
+    n[1] = u[2] * v[0] - u[0] * v[2];
+    n[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+// True if moving `from` onto `to` turns one of the triangles `tris` around `from` over.
+static bool CollapseFlips(const GLfloat* positions, const vector<GLuint>& indices, const GLuint* tris, size_t tri_count, GLuint from, GLuint to)
+{
+    for (size_t i = 0; i < tri_count; i++)
+    {
+        const GLuint* t = &indices[tris[i] * 3];
+        int k = t[0] == from ? 0 : t[1] == from ? 1 : 2;
+        GLuint b = t[(k + 1) % 3], c = t[(k + 2) % 3];
+        // the triangles on the collapsed edge go away
+        if (b == to || c == to)
+            continue;
+        double before[3], after[3];
+        TriangleNormal(&positions[from * 3], &positions[b * 3], &positions[c * 3], before);
+        TriangleNormal(&positions[to * 3], &positions[b * 3], &positions[c * 3], after);
+        if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0)
+            return true;
+    }
+    return false;
+}
+
+// Collapses edges of `indices` until at most `target` indices are left or every collapse costs more
+// than LOD_MAX_ERROR. Returns the largest squared error of a collapse done.
+static double SimplifyMesh(const GLfloat* positions, vector<Quadric>& quadrics, const vector<char>& locked, vector<GLuint>& indices, size_t target)
+{
+    struct Collapse
+    {
+        GLuint from, to;
+        double error;
+        bool operator<(const Collapse& rhs) const { return error < rhs.error; }
+    };
+
+    size_t vertex_count = quadrics.size();
+    double maxError = 0;
+    vector<GLuint> firstTri, tris, remap(vertex_count);
+    vector<char> touched(vertex_count);
+    vector<Collapse> collapses;
+    while (indices.size() > target)
+    {
+        // triangles around every vertex
+        firstTri.assign(vertex_count + 1, 0);
+        for (GLuint v : indices)
+            firstTri[v + 1]++;
+        for (size_t v = 0; v < vertex_count; v++)
+            firstTri[v + 1] += firstTri[v];
+        tris.resize(indices.size());
+        vector<GLuint> next(firstTri.begin(), firstTri.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            tris[next[indices[i]]++] = i / 3;
+
+        // both directions of every edge, cheapest first
+        collapses.clear();
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            GLuint a = indices[i], b = indices[i - i % 3 + (i + 1) % 3];
+            if (!locked[a])
+            {
+                Quadric q = quadrics[a];
+                q.Add(quadrics[b]);
+                collapses.push_back({ a, b, q.Error(&positions[b * 3]) });
+            }
+        }
+        sort(collapses.begin(), collapses.end());
+
+        // collapses of one pass do not share a triangle, every one removes about two of them
+        for (size_t v = 0; v < vertex_count; v++)
+            remap[v] = v;
+        touched.assign(vertex_count, 0);
+        size_t removable = (indices.size() - target) / 3, removed = 0;
+        for (const Collapse& c : collapses)
+        {
+            if (removed >= removable || c.error > LOD_MAX_ERROR * LOD_MAX_ERROR)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+            const GLuint* around = &tris[firstTri[c.from]];
+            size_t around_count = firstTri[c.from + 1] - firstTri[c.from];
+            if (CollapseFlips(positions, indices, around, around_count, c.from, c.to))
+                continue;
+
+            remap[c.from] = c.to;
+            quadrics[c.to].Add(quadrics[c.from]);
+            for (size_t i = 0; i < around_count; i++)
+            {
+                for (int k = 0; k < 3; k++)
+                    touched[indices[around[i] * 3 + k]] = 1;
+            }
+            maxError = max(maxError, c.error);
+            removed += 2;
+        }
+        if (removed == 0)
+            break;
+
+        size_t kept = 0;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            GLuint a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            indices[kept++] = a;
+            indices[kept++] = b;
+            indices[kept++] = c;
+        }
+        indices.resize(kept);
+    }
+    return maxError;
+}
+
+// Appends the simplified levels of a shape to its `indices` and describes all levels in `lods`,
+// level 0 being the shape itself. `positions` are the xyz of its vertices.
+void BuildLods(const GLfloat* positions, size_t vertex_count, vector<GLuint>& indices, vector<MeshLod>* lods)
+{
+    lods->assign(1, MeshLod{ 0, (uint32_t)indices.size(), 0 });
+    // not worth it for a few triangles
+    if (!buildLods || indices.size() < 3 * 256)
+        return;
+
+    vector<Quadric> quadrics(vertex_count);
+    unordered_map<uint64_t, int> edges;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        const GLuint* t = &indices[i];
+        double n[3];
+        TriangleNormal(&positions[t[0] * 3], &positions[t[1] * 3], &positions[t[2] * 3], n);
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length > 0)
+        {
+            const GLfloat* p = &positions[t[0] * 3];
+            double a = n[0] / length, b = n[1] / length, c = n[2] / length;
+            for (int k = 0; k < 3; k++)
+                quadrics[t[k]].AddPlane(a, b, c, -(a * p[0] + b * p[1] + c * p[2]), length / 2);
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            GLuint a = min(t[k], t[(k + 1) % 3]), b = max(t[k], t[(k + 1) % 3]);
+            edges[(uint64_t)a << 32 | b]++;
+        }
+    }
+    // an edge of one triangle(or of more than two) is a border
+    vector<char> locked(vertex_count, 0);
+    for (const auto& edge : edges)
+    {
+        if (edge.second != 2)
+        {
+            locked[edge.first >> 32] = 1;
+            locked[edge.first & 0xffffffff] = 1;
+        }
+    }
+
+    vector<GLuint> level(indices);
+    double error = 0;
+    for (int i = 1; i < LOD_COUNT; i++)
+    {
+        size_t previous = lods->back().index_count;
+        double levelError = SimplifyMesh(positions, quadrics, locked, level, lods->front().index_count >> i);
+        error = max(error, levelError);
+        // stop once a level would save less than a fifth of the previous one
+        if (level.size() > previous * 4 / 5)
+            break;
+        ReorderForVertexCache(level, vertex_count);
+        lods->push_back({ (uint32_t)indices.size(), (uint32_t)level.size(), (float)sqrt(error) });
+        indices.insert(indices.end(), level.begin(), level.end());
+    }
+}
+
+// Screen pixels per normalized model unit at the near side of the bounding sphere of `m`, which
+// has radius sqrt(3) after normalization().
+static float ModelPixelsPerUnit(const model& m)
+{
+    float scale = max(fabs(m.scale.x), max(fabs(m.scale.y), fabs(m.scale.z)));
+    float pixels = project_matrix[5] * screenHeight / 2 * scale;
+    if (cur_proj_mode == Perspective)
+    {
+        Vector3 forward = main_camera.center - main_camera.position;
+        forward.normalize();
+        float distance = (m.position - main_camera.position).dot(forward) - sqrtf(3.0f) * scale;
+        // the camera is inside the bounding sphere
+        if (distance <= proj.nearClip)
+            return FLT_MAX;
+        pixels /= distance;
+    }
+    return pixels;
+}
+
+// The coarsest level of `shape` moving the surface at most lodPixelError pixels on screen, NULL if
+// it has none.
+static const MeshLod* SelectLod(const Shape& shape, float pixels_per_unit)
+{
+    const MeshLod* lod = NULL;
+    for (const MeshLod& level : shape.lods)
+    {
+        if (level.error * pixels_per_unit <= lodPixelError)
+            lod = &level;
+    }
+    return lod;
+}
+//* Level of detail *//
+
+//* Clusters *//
+// Level 0 of every large shape is cut into clusters of CLUSTER_TRIANGLES consecutive triangles. After
+// OptimizeMesh() these are compact patches. Every cluster has a bounding sphere and a cone holding the
+// normals of its triangles. RenderScene() skips the clusters outside of the view frustum or facing
+// away from the camera and draws the rest with one glMultiDrawElements().
+bool cullClusters = true;
+const int CLUSTER_TRIANGLES = 128;
+
+static void ClusterBounds(const GLfloat* positions, const GLuint* indices, size_t index_count, MeshCluster* cluster)
+{
+    GLfloat minPos[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, maxPos[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < index_count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            minPos[k] = min(minPos[k], positions[indices[i] * 3 + k]);
+            maxPos[k] = max(maxPos[k], positions[indices[i] * 3 + k]);
+        }
+    }
+    double radius = 0;
+    for (int k = 0; k < 3; k++)
+        cluster->center[k] = (minPos[k] + maxPos[k]) / 2;
+    for (size_t i = 0; i < index_count; i++)
+    {
+        const GLfloat* p = &positions[indices[i] * 3];
+        double dx = p[0] - cluster->center[0], dy = p[1] - cluster->center[1], dz = p[2] - cluster->center[2];
+        radius = max(radius, dx * dx + dy * dy + dz * dz);
+    }
+    cluster->radius = sqrt(radius);
+
+    // the axis is the mean of the triangle normals, the cone opens to the one furthest away from it
+    vector<double> normals;
+    double axis[3] = { 0, 0, 0 };
+    for (size_t i = 0; i < index_count; i += 3)
+    {
+        double n[3];
+        TriangleNormal(&positions[indices[i] * 3], &positions[indices[i + 1] * 3], &positions[indices[i + 2] * 3], n);
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0)
+            continue;
+        for (int k = 0; k < 3; k++)
+        {
+            normals.push_back(n[k] / length);
+            axis[k] += n[k] / length;
+        }
+    }
+    double length = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    double minDot = 1;
+    for (size_t i = 0; i < normals.size() && length > 0; i += 3)
+        minDot = min(minDot, (normals[i] * axis[0] + normals[i + 1] * axis[1] + normals[i + 2] * axis[2]) / length);
+    for (int k = 0; k < 3; k++)
+        cluster->axis[k] = length > 0 ? axis[k] / length : 0;
+    // a cone wider than a half space never faces away as a whole
+    cluster->cutoff = length > 0 && minDot > 0 ? sqrt(1 - minDot * minDot) : 1;
+}
+
+// Back faces are drawn(there is no GL_CULL_FACE), so only the back of a closed surface is hidden. Returns
+// 1 for a closed surface wound counterclockwise seen from outside, -1 for one wound the other way and 0
+// for anything else. Vertices at the same position are one, seams do not open a surface.
+static int SurfaceOrientation(const GLfloat* positions, const vector<GLuint>& indices)
+{
+    struct PositionHash
+    {
+        size_t operator()(const array<GLfloat, 3>& p) const { return hash<GLfloat>()(p[0]) * 73856093 ^ hash<GLfloat>()(p[1]) * 19349663 ^ hash<GLfloat>()(p[2]) * 83492791; }
+    };
+    unordered_map<array<GLfloat, 3>, GLuint, PositionHash> welded;
+    unordered_map<GLuint, GLuint> weldedId;
+    for (GLuint v : indices)
+    {
+        if (weldedId.count(v))
+            continue;
+        array<GLfloat, 3> p = { positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2] };
+        weldedId[v] = welded.insert(make_pair(p, (GLuint)welded.size())).first->second;
+    }
+
+    // every edge once in each direction
+    unordered_map<uint64_t, int> edges;
+    double volume = 0;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        GLuint t[3] = { weldedId[indices[i]], weldedId[indices[i + 1]], weldedId[indices[i + 2]] };
+        // degenerate, not part of the surface
+        if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2])
+            continue;
+        for (int k = 0; k < 3; k++)
+        {
+            GLuint a = t[k], b = t[(k + 1) % 3];
+            edges[(uint64_t)min(a, b) << 32 | max(a, b)] += a < b ? 1 : 1 << 16;
+        }
+        const GLfloat *p0 = &positions[indices[i] * 3], *p1 = &positions[indices[i + 1] * 3], *p2 = &positions[indices[i + 2] * 3];
+        volume += p0[0] * (p1[1] * p2[2] - p1[2] * p2[1]) + p0[1] * (p1[2] * p2[0] - p1[0] * p2[2]) + p0[2] * (p1[0] * p2[1] - p1[1] * p2[0]);
+    }
+    for (const auto& edge : edges)
+    {
+        if (edge.second != (1 | 1 << 16))
+            return 0;
+    }
+    return volume > 0 ? 1 : volume < 0 ? -1 : 0;
+}
+
+// Clusters of level 0 of a shape, `indices` being that level. Small shapes get none.
+void BuildClusters(const GLfloat* positions, const vector<GLuint>& indices, vector<MeshCluster>* clusters)
+{
+    clusters->clear();
+    if (!cullClusters || indices.size() < 3 * 2 * CLUSTER_TRIANGLES)
+        return;
+    int orientation = SurfaceOrientation(positions, indices);
+    for (size_t first = 0; first < indices.size(); first += 3 * CLUSTER_TRIANGLES)
+    {
+        MeshCluster cluster;
+        cluster.first_index = first;
+        cluster.index_count = min(indices.size() - first, (size_t)3 * CLUSTER_TRIANGLES);
+        ClusterBounds(positions, &indices[first], cluster.index_count, &cluster);
+        for (int k = 0; k < 3; k++)
+            cluster.axis[k] *= orientation;
+        // the frustum test only
+        if (orientation == 0)
+            cluster.cutoff = 1;
+        clusters->push_back(cluster);
+    }
+}
+
+// The camera and the view frustum in the model space of a model.
+struct ClusterView
+{
+    GLfloat planes[6][4];   // inside where dot(plane.xyz, p) + plane.w >= 0
+    Vector3 eye;            // perspective
+    Vector3 forward;        // orthogonal: the direction of all view rays
+    bool perspective;
+};
+
+ClusterView MakeClusterView(const Matrix4& model_matrix)
+{
+    ClusterView view;
+    // the planes of the clip space cube, in model space(Gribb and Hartmann)
+    Matrix4 clip = project_matrix * view_matrix * model_matrix;
+    for (int i = 0; i < 6; i++)
+    {
+        int row = i / 2;
+        GLfloat sign = i % 2 == 0 ? 1.0f : -1.0f;
+        for (int k = 0; k < 4; k++)
+            view.planes[i][k] = clip[12 + k] + sign * clip[row * 4 + k];
+        GLfloat length = sqrtf(view.planes[i][0] * view.planes[i][0] + view.planes[i][1] * view.planes[i][1] + view.planes[i][2] * view.planes[i][2]);
+        for (int k = 0; k < 4 && length > 0; k++)
+            view.planes[i][k] /= length;
+    }
+
+    // facing is kept by an invertible affine map, so the cones are tested in model space too
+    Matrix4 inverse = model_matrix;
+    inverse.invert();
+    Vector3 eye = main_camera.position;
+    view.eye = inverse * eye + Vector3(inverse[3], inverse[7], inverse[11]);
+    view.forward = inverse * (main_camera.center - main_camera.position);
+    view.forward.normalize();
+    view.perspective = cur_proj_mode == Perspective;
+    return view;
+}
+
+static bool ClusterVisible(const MeshCluster& cluster, const ClusterView& view)
+{
+    const GLfloat* c = cluster.center;
+    for (int i = 0; i < 6; i++)
+    {
+        const GLfloat* plane = view.planes[i];
+        if (plane[0] * c[0] + plane[1] * c[1] + plane[2] * c[2] + plane[3] < -cluster.radius)
+            return false;
+    }
+
+    // written so that a degenerate camera(NaN) keeps the cluster
+    Vector3 axis(cluster.axis[0], cluster.axis[1], cluster.axis[2]);
+    if (!view.perspective)
+        return !(view.forward.dot(axis) >= cluster.cutoff);
+    Vector3 toCenter = Vector3(c[0], c[1], c[2]) - view.eye;
+    return !(toCenter.dot(axis) >= cluster.cutoff * toCenter.length() + cluster.radius);
+}
+
+// Draws the visible clusters of level 0 of `shape`, neighbouring ones as one range. With more than
+// one view the ranges are drawn once per view, `first_view_location` is the firstView uniform.
+void DrawClusters(const Shape& shape, const Matrix4& model_matrix, GLint first_view_location, GLsizei views)
+{
+    ClusterView view = MakeClusterView(model_matrix);
+    static vector<GLsizei> counts;
+    static vector<const GLvoid*> offsets;
+    counts.clear();
+    offsets.clear();
+    size_t indexSize = IndexSize(shape.indexType);
+    uint32_t end = UINT32_MAX;
+    for (const MeshCluster& cluster : shape.clusters)
+    {
+        if (!ClusterVisible(cluster, view))
+            continue;
+        if (cluster.first_index == end)
+        {
+            counts.back() += cluster.index_count;
+        }
+        else
+        {
+            counts.push_back(cluster.index_count);
+            offsets.push_back((const GLvoid*)(shape.indexOffset + cluster.first_index * indexSize));
+        }
+        end = cluster.first_index + cluster.index_count;
+    }
+    if (counts.empty())
+        return;
+    // there is no instanced glMultiDrawElements(), each view takes one
+    for (GLsizei i = 0; i < views; i++)
+    {
+        if (views > 1)
+            glState.Uniform1i(first_view_location, i);
+        glMultiDrawElements(GL_TRIANGLES, counts.data(), shape.indexType, offsets.data(), counts.size());
+    }
+}
+//* Clusters *//
+
+//* Ray queries *//
+// A bounding volume hierarchy over the level 0 triangles of a model, in normalized model space, for
+// queries on the CPU. A right click picks the shape and the triangle under the cursor with it. Built
+// with binned SAH(Wald 2007) on the loader thread of the model, the halves of large nodes on threads
+// of their own. A leaf holds up to 4 triangles, tested at once with SSE.
+const int BVH_LEAF_TRIANGLES = 4;
+const int BVH_BINS = 16;
+// nodes with more triangles build one half on another thread, at most 2^BVH_PARALLEL_DEPTH threads
+const size_t BVH_PARALLEL_TRIANGLES = 8192;
+const int BVH_PARALLEL_DEPTH = 3;
+// deeper nodes are split at the median, which bounds the depth of the tree and the traversal stacks
+const int BVH_SAH_DEPTH = 40;
+const int BVH_MAX_DEPTH = 96;
+
+#if defined(__SSE2__) || defined(_M_X64)
+# define BVH_SSE 1
+#endif
+
+struct RayHit
+{
+    float t;            // the hit point is origin + t * direction
+    uint32_t triangle;  // as passed to Bvh::Build()
+    float u, v;         // barycentric coordinates of the hit point
+};
+
+class Bvh
+{
+public:
+    // `triangles` holds the 3 corners(9 floats) of every triangle, the id of a triangle is its position in it.
+    void Build(const vector<GLfloat>& triangles)
+    {
+        size_t count = triangles.size() / 9;
+        nodes.clear();
+        packets.clear();
+        triangleCount = count;
+        if (count == 0)
+            return;
+        vector<TriangleBounds> bounds(count);
+        vector<uint32_t> ids(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const GLfloat* p = &triangles[i * 9];
+            for (int k = 0; k < 3; k++)
+            {
+                bounds[i].min[k] = min(p[k], min(p[3 + k], p[6 + k]));
+                bounds[i].max[k] = max(p[k], max(p[3 + k], p[6 + k]));
+                bounds[i].centroid[k] = (bounds[i].min[k] + bounds[i].max[k]) / 2;
+            }
+            ids[i] = i;
+        }
+        BuildNode(triangles, bounds, ids.data(), count, 0);
+    }
+
+    size_t TriangleCount() const { return triangleCount; }
+    size_t NodeCount() const { return nodes.size(); }
+
+    // The closest hit with t in [0, t_max), `direction` needs not be normalized. Triangles are hit from both sides.
+    bool Intersect(const Vector3& origin, const Vector3& direction, RayHit* hit, float t_max = FLT_MAX) const
+    {
+        if (nodes.empty())
+            return false;
+        Ray ray;
+        GLfloat o[3] = { origin.x, origin.y, origin.z }, d[3] = { direction.x, direction.y, direction.z };
+        for (int k = 0; k < 3; k++)
+        {
+            ray.origin[k] = o[k];
+            ray.direction[k] = d[k];
+            // no 0 * inf in the slab test
+            ray.invDirection[k] = 1 / (fabs(d[k]) > 1e-20f ? d[k] : copysignf(1e-20f, d[k]));
+        }
+
+        hit->t = t_max;
+        bool found = false;
+        // nodes hit by the ray and where it enters them
+        struct Entry
+        {
+            uint32_t node;
+            float t;
+        };
+        Entry stack[BVH_MAX_DEPTH];
+        int top = 0;
+        float t_root;
+        if (RayBox(nodes[0], ray, hit->t, &t_root))
+            stack[top++] = { 0, t_root };
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            // a closer hit was found meanwhile
+            if (entry.t >= hit->t)
+                continue;
+            const Node& node = nodes[entry.node];
+            if (node.count > 0)
+            {
+                found = IntersectPacket(packets[node.packet], ray, hit) || found;
+                continue;
+            }
+            // the nearer child is popped first
+            float t_left, t_right;
+            bool left = RayBox(nodes[node.children[0]], ray, hit->t, &t_left);
+            bool right = RayBox(nodes[node.children[1]], ray, hit->t, &t_right);
+            if (left && right)
+            {
+                bool leftFirst = t_left <= t_right;
+                stack[top++] = leftFirst ? Entry{ node.children[1], t_right } : Entry{ node.children[0], t_left };
+                stack[top++] = leftFirst ? Entry{ node.children[0], t_left } : Entry{ node.children[1], t_right };
+            }
+            else if (left || right)
+            {
+                stack[top++] = left ? Entry{ node.children[0], t_left } : Entry{ node.children[1], t_right };
+            }
+        }
+        return found;
+    }
+
+    // Calls `visit` with every triangle whose bounding box overlaps the box from `box_min` to `box_max`.
+    void QueryBox(const GLfloat box_min[3], const GLfloat box_max[3], const function<void(uint32_t)>& visit) const
+    {
+        if (nodes.empty())
+            return;
+        uint32_t stack[BVH_MAX_DEPTH];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            if (!Overlaps(node.min, node.max, box_min, box_max))
+                continue;
+            if (node.count == 0)
+            {
+                stack[top++] = node.children[0];
+                stack[top++] = node.children[1];
+                continue;
+            }
+            const Packet& packet = packets[node.packet];
+            for (uint32_t i = 0; i < node.count; i++)
+            {
+                GLfloat triMin[3], triMax[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    GLfloat v0 = packet.v0[k][i], v1 = v0 + packet.e1[k][i], v2 = v0 + packet.e2[k][i];
+                    triMin[k] = min(v0, min(v1, v2));
+                    triMax[k] = max(v0, max(v1, v2));
+                }
+                if (Overlaps(triMin, triMax, box_min, box_max))
+                    visit(packet.id[i]);
+            }
+        }
+    }
+
+private:
+    // `min` and `max` are each followed by 4 bytes, so both load as one SSE register
+    struct Node
+    {
+        GLfloat min[3];
+        uint32_t count;         // triangles in packets[packet], 0 for an inner node
+        GLfloat max[3];
+        uint32_t packet;
+        uint32_t children[2];
+    };
+
+    // up to 4 triangles as structure of arrays: corner 0 and the two edges from it
+    struct alignas(16) Packet
+    {
+        GLfloat v0[3][4], e1[3][4], e2[3][4];
+        uint32_t id[4];
+    };
+
+    struct TriangleBounds
+    {
+        GLfloat min[3], max[3], centroid[3];
+    };
+
+    struct alignas(16) Ray
+    {
+        GLfloat origin[4], direction[4], invDirection[4];
+    };
+
+    vector<Node> nodes;     // the root first
+    vector<Packet> packets;
+    size_t triangleCount = 0;
+
+    static bool Overlaps(const GLfloat* a_min, const GLfloat* a_max, const GLfloat* b_min, const GLfloat* b_max)
+    {
+        return a_min[0] <= b_max[0] && a_max[0] >= b_min[0] && a_min[1] <= b_max[1] && a_max[1] >= b_min[1] &&
+               a_min[2] <= b_max[2] && a_max[2] >= b_min[2];
+    }
+
+    static float Area(const GLfloat* box_min, const GLfloat* box_max)
+    {
+        float x = box_max[0] - box_min[0], y = box_max[1] - box_min[1], z = box_max[2] - box_min[2];
+        return x * y + y * z + z * x;
+    }
+
+    // Appends the subtree of `count` triangles from `ids` on and returns its root. Reorders `ids`.
+    uint32_t BuildNode(const vector<GLfloat>& triangles, const vector<TriangleBounds>& bounds, uint32_t* ids, size_t count, int depth)
+    {
+        uint32_t index = nodes.size();
+        nodes.push_back(Node());
+        Node node = Node();
+        GLfloat centroidMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, centroidMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (int k = 0; k < 3; k++)
+        {
+            node.min[k] = FLT_MAX;
+            node.max[k] = -FLT_MAX;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            const TriangleBounds& b = bounds[ids[i]];
+            for (int k = 0; k < 3; k++)
+            {
+                node.min[k] = min(node.min[k], b.min[k]);
+                node.max[k] = max(node.max[k], b.max[k]);
+                centroidMin[k] = min(centroidMin[k], b.centroid[k]);
+                centroidMax[k] = max(centroidMax[k], b.centroid[k]);
+            }
+        }
+
+        if (count <= BVH_LEAF_TRIANGLES)
+        {
+            node.count = count;
+            node.packet = packets.size();
+            packets.push_back(MakePacket(triangles, ids, count));
+            nodes[index] = node;
+            return index;
+        }
+
+        size_t half = depth < BVH_SAH_DEPTH ? SplitSah(bounds, ids, count, centroidMin, centroidMax) : SplitMedian(bounds, ids, count, centroidMin, centroidMax);
+        if (count >= BVH_PARALLEL_TRIANGLES && depth < BVH_PARALLEL_DEPTH)
+        {
+            Bvh first;
+            future<void> built = async(launch::async, [&]() { first.BuildNode(triangles, bounds, ids, half, depth + 1); });
+            node.children[1] = BuildNode(triangles, bounds, ids + half, count - half, depth + 1);
+            built.get();
+            node.children[0] = Append(first);
+        }
+        else
+        {
+            node.children[0] = BuildNode(triangles, bounds, ids, half, depth + 1);
+            node.children[1] = BuildNode(triangles, bounds, ids + half, count - half, depth + 1);
+        }
+        nodes[index] = node;
+        return index;
+    }
+
+    // Moves the nodes and packets of `other` behind ours, returns the new index of its root.
+    uint32_t Append(const Bvh& other)
+    {
+        uint32_t nodeOffset = nodes.size(), packetOffset = packets.size();
+        for (Node node : other.nodes)
+        {
+            if (node.count > 0)
+                node.packet += packetOffset;
+            else
+            {
+                node.children[0] += nodeOffset;
+                node.children[1] += nodeOffset;
+            }
+            nodes.push_back(node);
+        }
+        packets.insert(packets.end(), other.packets.begin(), other.packets.end());
+        return nodeOffset;
+    }
+
+    // Partitions `ids` at the cheapest of the bin borders of all axes, returns the size of the first part.
+    static size_t SplitSah(const vector<TriangleBounds>& bounds, uint32_t* ids, size_t count, const GLfloat* centroidMin, const GLfloat* centroidMax)
+    {
+        struct Bin
+        {
+            GLfloat min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            size_t count = 0;
+
+            void Grow(const GLfloat* box_min, const GLfloat* box_max)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    min[k] = min(min[k], box_min[k]);
+                    max[k] = max(max[k], box_max[k]);
+                }
+            }
+        };
+
+        int bestAxis = -1, bestBin = 0;
+        float bestCost = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0)
+                continue;
+            Bin bins[BVH_BINS];
+            float scale = BVH_BINS / extent;
+            for (size_t i = 0; i < count; i++)
+            {
+                const TriangleBounds& b = bounds[ids[i]];
+                int bin = min((int)((b.centroid[axis] - centroidMin[axis]) * scale), BVH_BINS - 1);
+                bins[bin].Grow(b.min, b.max);
+                bins[bin].count++;
+            }
+            // cost of splitting after bin i: area * count of both sides
+            float rightCost[BVH_BINS];
+            Bin right;
+            for (int i = BVH_BINS - 1; i > 0; i--)
+            {
+                right.Grow(bins[i].min, bins[i].max);
+                right.count += bins[i].count;
+                rightCost[i - 1] = right.count > 0 ? Area(right.min, right.max) * right.count : 0;
+            }
+            Bin left;
+            for (int i = 0; i < BVH_BINS - 1; i++)
+            {
+                left.Grow(bins[i].min, bins[i].max);
+                left.count += bins[i].count;
+                if (left.count == 0 || left.count == count)
+                    continue;
+                float cost = Area(left.min, left.max) * left.count + rightCost[i];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = i;
+                }
+            }
+        }
+
+        // all centroids in one bin: any split is as good
+        if (bestAxis < 0)
+            return count / 2;
+        float scale = BVH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        uint32_t* mid = partition(ids, ids + count, [&](uint32_t id) {
+            return min((int)((bounds[id].centroid[bestAxis] - centroidMin[bestAxis]) * scale), BVH_BINS - 1) <= bestBin;
+        });
+        return mid - ids;
+    }
+
+    static size_t SplitMedian(const vector<TriangleBounds>& bounds, uint32_t* ids, size_t count, const GLfloat* centroidMin, const GLfloat* centroidMax)
+    {
+        int axis = 0;
+        for (int k = 1; k < 3; k++)
+        {
+            if (centroidMax[k] - centroidMin[k] > centroidMax[axis] - centroidMin[axis])
+                axis = k;
+        }
+        nth_element(ids, ids + count / 2, ids + count, [&](uint32_t a, uint32_t b) { return bounds[a].centroid[axis] < bounds[b].centroid[axis]; });
+        return count / 2;
+    }
+
+    static Packet MakePacket(const vector<GLfloat>& triangles, const uint32_t* ids, size_t count)
+    {
+        // unused lanes are degenerate and never hit
+        Packet packet = Packet();
+        for (size_t i = 0; i < 4; i++)
+        {
+            packet.id[i] = i < count ? ids[i] : UINT32_MAX;
+            if (i >= count)
+                continue;
+            const GLfloat* p = &triangles[ids[i] * 9];
+            for (int k = 0; k < 3; k++)
+            {
+                packet.v0[k][i] = p[k];
+                packet.e1[k][i] = p[3 + k] - p[k];
+                packet.e2[k][i] = p[6 + k] - p[k];
+            }
+        }
+        return packet;
+    }
+
+#ifdef BVH_SSE
+    // slab test, `t_near` is where the ray enters the box
+    static bool RayBox(const Node& node, const Ray& ray, float t_max, float* t_near)
+    {
+        __m128 origin = _mm_load_ps(ray.origin), invDirection = _mm_load_ps(ray.invDirection);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min), origin), invDirection);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max), origin), invDirection);
+        __m128 lo = _mm_min_ps(t1, t2), hi = _mm_max_ps(t1, t2);
+        // lane 3 is not a coordinate, make it a copy of lane 0
+        lo = _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(0, 2, 1, 0));
+        hi = _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(0, 2, 1, 0));
+        lo = _mm_max_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)));
+        lo = _mm_max_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 0, 3, 2)));
+        hi = _mm_min_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 3, 0, 1)));
+        hi = _mm_min_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1, 0, 3, 2)));
+        float enter = _mm_cvtss_f32(lo), exit = _mm_cvtss_f32(hi);
+        *t_near = enter;
+        return enter <= exit && exit >= 0 && enter < t_max;
+    }
+
+    // Moller-Trumbore on the 4 triangles of `packet` at once, updates `hit` with the closest one.
+    static bool IntersectPacket(const Packet& packet, const Ray& ray, RayHit* hit)
+    {
+        __m128 d[3], o[3], v0[3], e1[3], e2[3];
+        for (int k = 0; k < 3; k++)
+        {
+            d[k] = _mm_set1_ps(ray.direction[k]);
+            o[k] = _mm_set1_ps(ray.origin[k]);
+            v0[k] = _mm_load_ps(packet.v0[k]);
+            e1[k] = _mm_load_ps(packet.e1[k]);
+            e2[k] = _mm_load_ps(packet.e2[k]);
+        }
+        // p = d x e2, s = o - v0, q = s x e1
+        __m128 p[3] = { _mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])),
+                        _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2])),
+                        _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0])) };
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], p[0]), _mm_mul_ps(e1[1], p[1])), _mm_mul_ps(e1[2], p[2]));
+        __m128 s[3] = { _mm_sub_ps(o[0], v0[0]), _mm_sub_ps(o[1], v0[1]), _mm_sub_ps(o[2], v0[2]) };
+        __m128 q[3] = { _mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])),
+                        _mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2])),
+                        _mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0])) };
+        __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], p[0]), _mm_mul_ps(s[1], p[1])), _mm_mul_ps(s[2], p[2])), invDet);
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], q[0]), _mm_mul_ps(d[1], q[1])), _mm_mul_ps(d[2], q[2])), invDet);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], q[0]), _mm_mul_ps(e2[1], q[1])), _mm_mul_ps(e2[2], q[2])), invDet);
+
+        __m128 zero = _mm_setzero_ps();
+        __m128 absDet = _mm_max_ps(det, _mm_sub_ps(zero, det));
+        __m128 mask = _mm_and_ps(_mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f)), _mm_cmpge_ps(u, zero));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(t, zero));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(hit->t)));
+        int lanes = _mm_movemask_ps(mask);
+        if (lanes == 0)
+            return false;
+
+        alignas(16) float ts[4], us[4], vs[4];
+        _mm_store_ps(ts, t);
+        _mm_store_ps(us, u);
+        _mm_store_ps(vs, v);
+        for (int i = 0; i < 4; i++)
+        {
+            if ((lanes >> i & 1) && ts[i] < hit->t)
+                *hit = { ts[i], packet.id[i], us[i], vs[i] };
+        }
+        return true;
+    }
+#else
+    static bool RayBox(const Node& node, const Ray& ray, float t_max, float* t_near)
+    {
+        float enter = -FLT_MAX, exit = FLT_MAX;
+        for (int k = 0; k < 3; k++)
+        {
+            float t1 = (node.min[k] - ray.origin[k]) * ray.invDirection[k];
+            float t2 = (node.max[k] - ray.origin[k]) * ray.invDirection[k];
+            enter = max(enter, min(t1, t2));
+            exit = min(exit, max(t1, t2));
+        }
+        *t_near = enter;
+        return enter <= exit && exit >= 0 && enter < t_max;
+    }
+
+    static bool IntersectPacket(const Packet& packet, const Ray& ray, RayHit* hit)
+    {
+        bool found = false;
+        const GLfloat *d = ray.direction, *o = ray.origin;
+        for (int i = 0; i < 4; i++)
+        {
+            GLfloat e1[3] = { packet.e1[0][i], packet.e1[1][i], packet.e1[2][i] };
+            GLfloat e2[3] = { packet.e2[0][i], packet.e2[1][i], packet.e2[2][i] };
+            GLfloat s[3] = { o[0] - packet.v0[0][i], o[1] - packet.v0[1][i], o[2] - packet.v0[2][i] };
+            GLfloat p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+            GLfloat q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+            float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            if (fabs(det) <= 1e-12f)
+                continue;
+            float invDet = 1 / det;
+            float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+            float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+            float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+            if (u >= 0 && v >= 0 && u + v <= 1 && t >= 0 && t < hit->t)
+            {
+                *hit = { t, packet.id[i], u, v };
+                found = true;
+            }
+        }
+        return found;
+    }
+#endif
+};
+
+struct PickResult
+{
+    int shape;
+    uint32_t triangle;  // of level 0 of the shape
+    Vector3 position;   // in world space
+};
+
+// The shape and the triangle of `m` under the cursor at `x`, `y` (coordinates in a `width` x `height`
+// viewport showing the scene). False over the background.
+bool PickModel(const model& m, double x, double y, int width, int height, PickResult* result)
+{
+    if (!m.loaded || !m.bvh || width <= 0 || height <= 0)
+        return false;
+
+    // the cursor from the near to the far plane, in normalized model space
+    Matrix4 model_matrix = translate(m.position) * rotate(m.rotation) * scaling(m.scale);
+    Matrix4 unproject = project_matrix * view_matrix * model_matrix;
+    unproject.invert();
+    float ndcX = 2 * x / width - 1, ndcY = 1 - 2 * y / height;
+    Vector4 nearPoint = unproject * Vector4(ndcX, ndcY, -1, 1), farPoint = unproject * Vector4(ndcX, ndcY, 1, 1);
+    Vector3 origin = Vector3(nearPoint.x, nearPoint.y, nearPoint.z) / nearPoint.w;
+    Vector3 direction = Vector3(farPoint.x, farPoint.y, farPoint.z) / farPoint.w - origin;
+
+    RayHit hit;
+    if (!m.bvh->Intersect(origin, direction, &hit, 1.0f))
+        return false;
+    const vector<uint32_t>& first = m.shapeFirstTriangle;
+    result->shape = upper_bound(first.begin(), first.end(), hit.triangle) - first.begin() - 1;
+    result->triangle = hit.triangle - first[result->shape];
+    Vector3 p = origin + direction * hit.t;
+    Vector4 world = model_matrix * Vector4(p.x, p.y, p.z, 1);
+    result->position = Vector3(world.x, world.y, world.z);
+    return true;
+}
+
+void PickUnderCursor(double x, double y, int width, int height)
+{
+    auto start = chrono::steady_clock::now();
+    // both views show the whole scene in their half of the window, pick in the half under the cursor
+    int half = width / 2;
+    double view_x = x < half ? x : x - half;
+    PickResult pick;
+    bool picked = PickModel(models.at(cur_idx), view_x, y, half, height, &pick);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (picked)
+        printf("Picked shape %d triangle %d at ( %f , %f , %f ) in %.3f ms\n", pick.shape, (int)pick.triangle, pick.position.x, pick.position.y, pick.position.z, ms);
+    else
+        printf("Picked nothing in %.3f ms\n", ms);
+}
+//* Ray queries *//
+
+//* Generated attributes *//
+// .obj files without vn lines get smooth normals: the normal of a position is the sum of the normals
+// of the triangles around it, weighted by their area and by their angle at the position. Both loaders
+// generate them right after parsing. With generateTangents every vertex also gets a tangent for normal
+// mapping in attribute 4, see BuildModelTangents().
+bool generateTangents = false;
+const size_t ACCUMULATE_THREAD_TRIANGLES = 1 << 16;
+
+// Runs task(0) .. task(count - 1) on `count` threads, task(0) on the calling one.
+static void RunParallel(size_t count, const function<void(size_t)>& task)
+{
+    vector<future<void>> tasks;
+    for (size_t i = 1; i < count; i++)
+        tasks.push_back(async(launch::async, task, i));
+    task(0);
+    for (future<void>& t : tasks)
+        t.get();
+}
+
+// Sums C floats per vertex over the corners of `triangle_count` triangles(`corners` holds 3 vertex ids
+// each) without atomics: every thread adds a range of triangles into its own buffer, covering only the
+// vertex ids of its range, then every thread sums a range of vertices over these buffers. The order of
+// the sums does not depend on the timing. weigh(triangle, w) writes C floats per corner of `triangle`
+// to w, or returns false to skip it.
+template <int C, typename Weigh>
+static void AccumulateCorners(const uint32_t* corners, size_t triangle_count, size_t vertex_count, const Weigh& weigh, vector<float>* sums)
+{
+    size_t threads = (triangle_count + ACCUMULATE_THREAD_TRIANGLES - 1) / ACCUMULATE_THREAD_TRIANGLES;
+    size_t cores = thread::hardware_concurrency();
+    threads = max((size_t)1, min(threads, max((size_t)1, cores)));
+
+    struct Chunk
+    {
+        uint32_t low = 1, high = 0;     // vertex ids in sums, none by default
+        vector<float> sums;
+    };
+    vector<Chunk> chunks(threads);
+    RunParallel(threads, [&](size_t c) {
+        size_t first = triangle_count * c / threads, last = triangle_count * (c + 1) / threads;
+        if (first == last)
+            return;
+        Chunk& chunk = chunks[c];
+        uint32_t low = UINT32_MAX, high = 0;
+        for (size_t i = first * 3; i < last * 3; i++)
+        {
+            low = min(low, corners[i]);
+            high = max(high, corners[i]);
+        }
+        chunk.low = low;
+        chunk.high = high;
+        chunk.sums.assign((size_t)(high - low + 1) * C, 0.0f);
+
+        float w[3 * C];
+        for (size_t t = first; t < last; t++)
+        {
+            if (!weigh(t, w))
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                float* sum = &chunk.sums[(size_t)(corners[t * 3 + k] - low) * C];
+                for (int j = 0; j < C; j++)
+                    sum[j] += w[k * C + j];
+            }
+        }
+    });
+
+    sums->assign(vertex_count * C, 0.0f);
+    RunParallel(threads, [&](size_t c) {
+        size_t first = vertex_count * c / threads, last = vertex_count * (c + 1) / threads;
+        for (const Chunk& chunk : chunks)
+        {
+            size_t from = max(first, (size_t)chunk.low), to = min(last, (size_t)chunk.high + 1);
+            for (size_t v = from; v < to; v++)
+            {
+                for (int j = 0; j < C; j++)
+                    (*sums)[v * C + j] += chunk.sums[(v - chunk.low) * C + j];
+            }
+        }
+    });
+}
+
+static void Subtract3(const GLfloat* a, const GLfloat* b, float out[3])
+{
+    for (int k = 0; k < 3; k++)
+        out[k] = a[k] - b[k];
+}
+
+static void Cross3(const float a[3], const float b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float Dot3(const float a[3], const float b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Scales `v` to length 1, a zero vector stays zero.
+static void Normalize3(float v[3])
+{
+    float length = sqrtf(Dot3(v, v));
+    if (length > 0)
+    {
+        for (int k = 0; k < 3; k++)
+            v[k] /= length;
+    }
+}
+
+// The angles of a triangle at its corners. `cross_length` is the length of its normal(p1 - p0) x (p2 - p0).
+static void CornerAngles(const GLfloat* const p[3], float cross_length, float angles[3])
+{
+    for (int k = 0; k < 3; k++)
+    {
+        float a[3], b[3];
+        Subtract3(p[(k + 1) % 3], p[k], a);
+        Subtract3(p[(k + 2) % 3], p[k], b);
+        angles[k] = atan2f(cross_length, Dot3(a, b));
+    }
+}
+
+// One unit normal per position of `positions`, from the triangles of `triangles`(3 position ids each).
+// Positions without a triangle get a zero normal.
+void GenerateSmoothNormals(const GLfloat* positions, size_t position_count, const vector<uint32_t>& triangles, vector<GLfloat>* normals)
+{
+    AccumulateCorners<3>(triangles.data(), triangles.size() / 3, position_count, [&](size_t t, float* w) {
+        const GLfloat* p[3] = { &positions[triangles[t * 3] * 3], &positions[triangles[t * 3 + 1] * 3], &positions[triangles[t * 3 + 2] * 3] };
+        float u[3], v[3], n[3], angles[3];
+        Subtract3(p[1], p[0], u);
+        Subtract3(p[2], p[0], v);
+        Cross3(u, v, n);
+        float length = sqrtf(Dot3(n, n));
+        if (!(length > 0))
+            return false;
+        // the length of n is twice the area
+        CornerAngles(p, length, angles);
+        for (int k = 0; k < 3; k++)
+        {
+            for (int j = 0; j < 3; j++)
+                w[k * 3 + j] = n[j] * angles[k];
+        }
+        return true;
+    }, normals);
+
+    size_t threads = min(max((size_t)1, (size_t)thread::hardware_concurrency()), position_count / ACCUMULATE_THREAD_TRIANGLES + 1);
+    RunParallel(threads, [&](size_t c) {
+        for (size_t i = position_count * c / threads; i < position_count * (c + 1) / threads; i++)
+            Normalize3(&(*normals)[i * 3]);
+    });
+}
+
+// Tangents in the MikkTSpace convention for the vertices of `triangles`(3 vertex ids each): xyz is the
+// direction of increasing u orthogonal to the normal, w the sign of the bitangent, which is
+// w * cross(normal, tangent). Like MikkTSpace the per corner directions are projected onto the plane of
+// the vertex normal and weighted by the corner angle, vertices are already split at uv and normal seams.
+void GenerateTangents(const GLfloat* positions, const GLfloat* normals, const GLfloat* textureCoords, size_t vertex_count,
+                      const vector<uint32_t>& triangles, vector<GLfloat>* tangents)
+{
+    vector<float> sums;
+    AccumulateCorners<6>(triangles.data(), triangles.size() / 3, vertex_count, [&](size_t t, float* w) {
+        const uint32_t* ids = &triangles[t * 3];
+        const GLfloat* p[3] = { &positions[ids[0] * 3], &positions[ids[1] * 3], &positions[ids[2] * 3] };
+        const GLfloat *uv0 = &textureCoords[ids[0] * 2], *uv1 = &textureCoords[ids[1] * 2], *uv2 = &textureCoords[ids[2] * 2];
+        float e1[3], e2[3], n[3], angles[3];
+        Subtract3(p[1], p[0], e1);
+        Subtract3(p[2], p[0], e2);
+        Cross3(e1, e2, n);
+        float du1 = uv1[0] - uv0[0], dv1 = uv1[1] - uv0[1], du2 = uv2[0] - uv0[0], dv2 = uv2[1] - uv0[1];
+        float det = du1 * dv2 - du2 * dv1;
+        float length = sqrtf(Dot3(n, n));
+        if (!(length > 0) || det == 0)
+            return false;
+        CornerAngles(p, length, angles);
+
+        float s[3], b[3];
+        for (int j = 0; j < 3; j++)
+        {
+            s[j] = (e1[j] * dv2 - e2[j] * dv1) / det;
+            b[j] = (e2[j] * du1 - e1[j] * du2) / det;
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            float vn[3] = { normals[ids[k] * 3], normals[ids[k] * 3 + 1], normals[ids[k] * 3 + 2] };
+            Normalize3(vn);
+            float ts[3], tb[3], ds = Dot3(vn, s), db = Dot3(vn, b);
+            for (int j = 0; j < 3; j++)
+            {
+                ts[j] = s[j] - vn[j] * ds;
+                tb[j] = b[j] - vn[j] * db;
+            }
+            Normalize3(ts);
+            Normalize3(tb);
+            for (int j = 0; j < 3; j++)
+            {
+                w[k * 6 + j] = ts[j] * angles[k];
+                w[k * 6 + 3 + j] = tb[j] * angles[k];
+            }
+        }
+        return true;
+    }, &sums);
+
+    tangents->resize(vertex_count * 4);
+    size_t threads = min(max((size_t)1, (size_t)thread::hardware_concurrency()), vertex_count / ACCUMULATE_THREAD_TRIANGLES + 1);
+    RunParallel(threads, [&](size_t c) {
+        for (size_t i = vertex_count * c / threads; i < vertex_count * (c + 1) / threads; i++)
+        {
+            float n[3] = { normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2] };
+            Normalize3(n);
+            float* t = &sums[i * 6];
+            float d = Dot3(n, t);
+            for (int j = 0; j < 3; j++)
+                t[j] -= n[j] * d;
+            Normalize3(t);
+            if (Dot3(t, t) == 0)
+            {
+                // no uv gradient: any direction in the tangent plane
+                float axis[3] = { 0, 0, 0 };
+                axis[fabsf(n[0]) < 0.9f ? 0 : 1] = 1;
+                Cross3(n, axis, t);
+                Normalize3(t);
+            }
+            float nt[3];
+            Cross3(n, t, nt);
+            memcpy(&(*tangents)[i * 4], t, 3 * sizeof(GLfloat));
+            (*tangents)[i * 4 + 3] = Dot3(nt, t + 3) < 0 ? -1.0f : 1.0f;
+        }
+    });
+}
+
+// Gives the corners of `shapes` without normal the smooth normal of their position, appended to
+// attrib->normals. The faces without material are left out like SplitShapeByMaterial() drops them,
+// so the streaming loader gets the same normals.
+void GenerateMissingNormals(tinyobj::attrib_t* attrib, vector<tinyobj::shape_t>& shapes, const string& model_path)
+{
+    auto start = chrono::steady_clock::now();
+    vector<uint32_t> triangles;
+    for (const tinyobj::shape_t& shape : shapes)
+    {
+        size_t index_offset = 0;
+        for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++)
+        {
+            int fv = shape.mesh.num_face_vertices[f];
+            const tinyobj::index_t* face = &shape.mesh.indices[index_offset];
+            index_offset += fv;
+            if (shape.mesh.material_ids[f] < 0)
+                continue;
+            bool missing = false;
+            for (int v = 0; v < fv; v++)
+                missing = missing || face[v].normal_index < 0;
+            if (!missing)
+                continue;
+            // faces are triangulated, a fan otherwise
+            for (int v = 2; v < fv; v++)
+            {
+                triangles.push_back(face[0].vertex_index);
+                triangles.push_back(face[v - 1].vertex_index);
+                triangles.push_back(face[v].vertex_index);
+            }
+        }
+    }
+    if (triangles.empty())
+        return;
+
+    vector<GLfloat> generated;
+    size_t position_count = attrib->vertices.size() / 3;
+    GenerateSmoothNormals(attrib->vertices.data(), position_count, triangles, &generated);
+    int base = attrib->normals.size() / 3;
+    attrib->normals.insert(attrib->normals.end(), generated.begin(), generated.end());
+    for (tinyobj::shape_t& shape : shapes)
+    {
+        for (tinyobj::index_t& idx : shape.mesh.indices)
+        {
+            if (idx.normal_index < 0)
+                idx.normal_index = base + idx.vertex_index;
+        }
+    }
+    printf("Normals %s: generated for %d positions from %d triangles in %.1f ms\n", model_path.c_str(), (int)position_count,
+           (int)(triangles.size() / 3), chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+}
+//* Generated attributes *//
+
+// All faces of a model with the same material are one shape, whatever .obj shape(g/o) they are in: a
+// model takes a draw per material instead of one per (.obj shape, material). Vertices are still not
+// shared between .obj shapes.
+bool mergeMaterialShapes = true;
+
+// A shape of a CachedMesh: its vertices and indices are contiguous, the indices count from firstVertex.
+// The simplified levels of BuildLods() follow in lodIndices.
+struct CachedShape
+{
+    int material;
+    size_t firstVertex, vertexCount, firstIndex, indexCount;
+    vector<MeshLod> lods;
+    vector<GLuint> lodIndices;
+    vector<MeshCluster> clusters;
+};
+
+// Vertex streams of all shapes of a model after SplitShapeByMaterial(), uploaded by UploadModel()
+// into one set of buffers and kept for the mesh cache.
+struct CachedMesh
+{
+    vector<GLfloat> vertices, colors, normals, textureCoords;
+    vector<GLuint> indices;
+    vector<CachedShape> shapes;
+};
+
+// Appends a shape per material to `mesh`, no GL calls. A counting sort by material: one pass counts
+// the vertices and indices of every material, one pass moves them to their range of `mesh`.
+void SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, vector<GLuint>& indices, int material_count, CachedMesh* mesh, VertexCacheStats* stats)
+{
+    // ranges of every material, relative to the end of `mesh`. Vertices without a valid material are dropped
+    vector<size_t> vertexStart(material_count + 1, 0), indexStart(material_count + 1, 0);
+    for (int m : material_id)
+    {
+        if (m >= 0 && m < material_count)
+            vertexStart[m + 1]++;
+    }
+    // the vertices of a face all have the material of the face
+    for (GLuint v : indices)
+    {
+        int m = material_id[v];
+        if (m >= 0 && m < material_count)
+            indexStart[m + 1]++;
+    }
+    for (int m = 0; m < material_count; m++)
+    {
+        vertexStart[m + 1] += vertexStart[m];
+        indexStart[m + 1] += indexStart[m];
+    }
+
+    size_t baseVertex = mesh->vertices.size() / 3, baseIndex = mesh->indices.size();
+    size_t vertexCount = baseVertex + vertexStart[material_count], indexCount = baseIndex + indexStart[material_count];
+    mesh->vertices.resize(vertexCount * 3);
+    mesh->colors.resize(vertexCount * 3);
+    mesh->normals.resize(vertexCount * 3);
+    mesh->textureCoords.resize(vertexCount * 2);
+    mesh->indices.resize(indexCount);
+
+    vector<size_t> next(vertexStart.begin(), vertexStart.end() - 1);
+    vector<GLuint> new_id(material_id.size());
+    for (size_t v = 0; v < material_id.size(); v++)
+    {
+        int m = material_id[v];
+        if (m < 0 || m >= material_count)
+            continue;
+        size_t dst = next[m]++;
+        new_id[v] = dst - vertexStart[m];
+        dst += baseVertex;
+        memcpy(&mesh->vertices[dst * 3], &vertices[v * 3], 3 * sizeof(GLfloat));
+        memcpy(&mesh->colors[dst * 3], &colors[v * 3], 3 * sizeof(GLfloat));
+        memcpy(&mesh->normals[dst * 3], &normals[v * 3], 3 * sizeof(GLfloat));
+        memcpy(&mesh->textureCoords[dst * 2], &textureCoords[v * 2], 2 * sizeof(GLfloat));
+    }
+
+    next.assign(indexStart.begin(), indexStart.end() - 1);
+    for (GLuint v : indices)
+    {
+        int m = material_id[v];
+        if (m >= 0 && m < material_count)
+            mesh->indices[baseIndex + next[m]++] = new_id[v];
+    }
+
+    vector<GLuint> m_indices, remap;
+    for (int m = 0; m < material_count; m++)
+    {
+        CachedShape shape = { m, baseVertex + vertexStart[m], vertexStart[m + 1] - vertexStart[m],
+                              baseIndex + indexStart[m], indexStart[m + 1] - indexStart[m] };
+        if (shape.indexCount == 0)
+            continue;
+
+        GLuint* first = &mesh->indices[shape.firstIndex];
+        m_indices.assign(first, first + shape.indexCount);
+        if (optimizeMeshes)
+        {
+            OptimizeMesh(m_indices, shape.vertexCount, &remap, stats);
+            memcpy(first, m_indices.data(), shape.indexCount * sizeof(GLuint));
+            RemapVertices<3>(&mesh->vertices[shape.firstVertex * 3], remap);
+            RemapVertices<3>(&mesh->colors[shape.firstVertex * 3], remap);
+            RemapVertices<3>(&mesh->normals[shape.firstVertex * 3], remap);
+            RemapVertices<2>(&mesh->textureCoords[shape.firstVertex * 2], remap);
+        }
+        BuildClusters(&mesh->vertices[shape.firstVertex * 3], m_indices, &shape.clusters);
+        BuildLods(&mesh->vertices[shape.firstVertex * 3], shape.vertexCount, m_indices, &shape.lods);
+        shape.lodIndices.assign(m_indices.begin() + shape.indexCount, m_indices.end());
+        mesh->shapes.push_back(move(shape));
+    }
+}
+
+// Writes all levels of `shape` as `index_type` to `dst`.
+static void StoreCachedShapeIndices(const CachedMesh& mesh, const CachedShape& shape, GLenum index_type, char* dst)
+{
+    StoreIndices(&mesh.indices[shape.firstIndex], shape.indexCount, index_type, dst);
+    StoreIndices(shape.lodIndices.data(), shape.lodIndices.size(), index_type, dst + shape.indexCount * IndexSize(index_type));
+}
+
+struct ObjStream;
+
+// A shape of the mesh cache, pointing into the mapped file.
+struct MappedShape
+{
+    uint32_t material, vertex_count, index_count, index_type;
+    vector<MeshLod> lods;
+    vector<MeshCluster> clusters;
+    const GLfloat *vertices, *colors, *normals, *textureCoords;
+    const void* indices;
+};
+
+// A model loaded on a loader thread, without any GL object yet: UploadModel() creates them on the
+// context thread. The shapes come from one of the three loaders.
+struct PendingModel
+{
+    string model_path;
+    vector<PendingMaterial> materials;
+
+    // LoadMeshCache()
+    shared_ptr<tinyobj::MappedFile> cacheFile;
+    vector<MappedShape> mappedShapes;
+    // LoadStreamedModel()
+    shared_ptr<ObjStream> stream;
+    // the attrib_t loader
+    CachedMesh cachedMesh;
+
+    shared_ptr<Bvh> bvh;
+    vector<uint32_t> shapeFirstTriangle;
+    vector<GLfloat> tangents;
+    // the .obj did not load, UploadModel() exits: exit() on a loader thread would join it from the pool's destructor
+    bool failed = false;
+};
+
+//* Mesh cache *//
+// The shapes of a model after normalization() and SplitShapeByMaterial() are
+// stored in "<model>.obj.cache" next to the .obj, keyed by a hash of the .obj
+// and its .mtl files. On later runs the cache is mapped and uploaded directly.
+//
+// Layout(little endian, every field 4 byte aligned):
+//   header  : magic[8], version, flags(MeshCacheFlags()), .obj size(u64), .obj hash(u64)
+//   .mtl    : count, { path, size(u64), hash(u64) } * count
+//   material: count, { Ka[3], Kd[3], Ks[3], diffuse texture name } * count
+//   stats   : triangles, vertices, cache misses before and after OptimizeMesh()(u64 each)
+//   shape   : count, { material, vertex_count, index_count, index_type, lod count, { first, count, error } * lod count,
+//                      cluster count, { first, count, center[3], radius, axis[3], cutoff } * cluster count,
+//                      vertices[3n], colors[3n], normals[3n], texcoords[2n], indices } * count
+// Strings and indices are padded to 4 bytes, strings are stored as a length followed by the characters.
+const char MESH_CACHE_MAGIC[8] = { 'H', 'W', '3', 'M', 'E', 'S', 'H', '\0' };
+// bump when normalization(), GenerateMissingNormals(), IndexShape(), SplitShapeByMaterial(), OptimizeMesh(), BuildLods()
+// or BuildClusters() change their output
+const uint32_t MESH_CACHE_VERSION = 10;
+
+// The switches that change what the loaders build. A cache written with other settings is a miss.
+static uint32_t MeshCacheFlags()
+{
+    return (mergeMaterialShapes ? 1 : 0) | (optimizeMeshes ? 2 : 0) | (buildLods ? 4 : 0) | (cullClusters ? 8 : 0);
+}
+
+// 64 bit hash of a file's content, xxHash64 style (4 lanes of 8 bytes).
+static uint64_t HashBytes(const char* data, size_t size)
+{
+    const uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL;
+    const uint64_t P3 = 1609587929392839161ULL, P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto mix = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; };
+    auto read64 = [](const char* p) { uint64_t v; memcpy(&v, p, 8); return v; };
+
+    const char* p = data;
+    const char* end = data + size;
+    uint64_t h;
+    if (size >= 32)
+    {
+        uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = 0 - P1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = mix(v1, read64(p));
+            v2 = mix(v2, read64(p + 8));
+            v3 = mix(v3, read64(p + 16));
+            v4 = mix(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        for (uint64_t v : { v1, v2, v3, v4 })
+            h = (h ^ mix(0, v)) * P1 + P4;
+    }
+    else
+    {
+        h = P5;
+    }
+    h += size;
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ mix(0, read64(p)), 27) * P1 + P4;
+    for (; p < end; p++)
+        h = rotl(h ^ (uint8_t(*p) * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+struct FileStamp
+{
+    string path;
+    uint64_t size = 0;
+    uint64_t hash = 0;
+};
+
+static bool StampFile(const string& path, FileStamp* stamp)
+{
+    tinyobj::MappedFile file;
+    if (!file.Open(path.c_str()))
+        return false;
+    stamp->path = path;
+    stamp->size = file.size();
+    stamp->hash = HashBytes(file.data(), file.size());
+    return true;
+}
+
+// .mtl files named by the `mtllib` lines of an .obj
+static vector<string> FindMtlFiles(const string& model_path, const string& base_dir)
+{
+    vector<string> res;
+    tinyobj::MappedFile file;
+    if (!file.Open(model_path.c_str()))
+        return res;
+
+    const char* p = file.data();
+    const char* end = p + file.size();
+    while (p < end)
+    {
+        const char* line_end = (const char*)memchr(p, '\n', end - p);
+        if (!line_end)
+            line_end = end;
+        while (p < line_end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (line_end - p > 7 && strncmp(p, "mtllib", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))
+        {
+            string names(p + 7, line_end);
+            size_t begin = 0;
+            while (begin < names.size())
+            {
+                size_t e = names.find_first_of(" \t\r", begin);
+                if (e == string::npos)
+                    e = names.size();
+                if (e > begin)
+                    res.push_back(base_dir + names.substr(begin, e - begin));
+                begin = e + 1;
+            }
+        }
+        p = line_end + 1;
+    }
+    return res;
+}
+
+static string MeshCachePath(const string& model_path)
+{
+    return model_path + ".cache";
+}
+
+class MeshCacheWriter
+{
+public:
+    template <typename T> void Put(const T& v) { buf.append((const char*)&v, sizeof(T)); }
+    void PutString(const string& str)
+    {
+        Put<uint32_t>(str.size());
+        buf.append(str);
+        buf.append((4 - str.size() % 4) % 4, '\0');
+    }
+    // room for `count` floats, valid until the next Put
+    GLfloat* PutFloats(size_t count)
+    {
+        size_t offset = buf.size();
+        buf.resize(offset + count * sizeof(GLfloat));
+        return (GLfloat*)&buf[offset];
+    }
+    // room for `size` bytes padded to 4, valid until the next Put
+    void* PutBytes(size_t size)
+    {
+        size_t offset = buf.size();
+        buf.resize(offset + size + (4 - size % 4) % 4, '\0');
+        return &buf[offset];
+    }
+    // appends what was put to `os`, the buffer keeps its memory for the next shape
+    void Flush(ostream& os)
+    {
+        os.write(buf.data(), buf.size());
+        buf.clear();
+    }
+
+    string buf;
+};
+
+class MeshCacheReader
+{
+public:
+    MeshCacheReader(const char* data, size_t size) : p(data), end(data + size) {}
+
+    template <typename T> bool Get(T* v)
+    {
+        if (end - p < (ptrdiff_t)sizeof(T))
+            return false;
+        memcpy(v, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+    bool GetString(string* str)
+    {
+        uint32_t len;
+        if (!Get(&len) || (size_t)(end - p) < len + (4 - len % 4) % 4)
+            return false;
+        str->assign(p, len);
+        p += len + (4 - len % 4) % 4;
+        return true;
+    }
+    // floats are returned in place, the file is mapped
+    const GLfloat* GetFloats(size_t count)
+    {
+        if ((size_t)(end - p) / sizeof(GLfloat) < count)
+            return NULL;
+        const GLfloat* res = (const GLfloat*)p;
+        p += count * sizeof(GLfloat);
+        return res;
+    }
+    const void* GetBytes(size_t size)
+    {
+        size_t padded = size + (4 - size % 4) % 4;
+        if ((size_t)(end - p) < padded)
+            return NULL;
+        const void* res = p;
+        p += padded;
+        return res;
+    }
+
+private:
+    const char* p;
+    const char* end;
+};
+
+struct MeshCacheShape
+{
+    int material;
+    int vertex_count;
+    int index_count;    // of all levels of detail
+    GLenum index_type;
+    vector<MeshLod> lods;
+    vector<MeshCluster> clusters;
+};
+
+// `fillShape` writes the vertices and the indices(as `index_type`) of a shape. The file is written
+// a shape at a time, only the largest shape is held in memory besides the caller's data.
+void WriteMeshCache(const string& model_path, const string& base_dir, const vector<tinyobj::material_t>& materials,
+                    const VertexCacheStats& cacheStats, const vector<MeshCacheShape>& shapeInfo, const function<void(size_t, GLfloat*, GLfloat*, GLfloat*, GLfloat*, void*)>& fillShape)
+{
+    FileStamp objStamp;
+    if (!StampFile(model_path, &objStamp))
+        return;
+
+    vector<FileStamp> mtlStamps;
+    for (const string& mtl_path : FindMtlFiles(model_path, base_dir))
+    {
+        FileStamp stamp;
+        if (StampFile(mtl_path, &stamp))
+            mtlStamps.push_back(stamp);
+    }
+
+    // write to a temporary file first, a half written cache must not be picked up
+    string cache_path = MeshCachePath(model_path);
+    string tmp_path = cache_path + ".tmp";
+    ofstream ofs(tmp_path, ios::binary | ios::trunc);
+    if (!ofs)
+        return;
+
+    MeshCacheWriter w;
+    w.buf.append(MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+    w.Put<uint32_t>(MESH_CACHE_VERSION);
+    w.Put<uint32_t>(MeshCacheFlags());
+    w.Put<uint64_t>(objStamp.size);
+    w.Put<uint64_t>(objStamp.hash);
+
+    w.Put<uint32_t>(mtlStamps.size());
+    for (const FileStamp& stamp : mtlStamps)
+    {
+        w.PutString(stamp.path);
+        w.Put<uint64_t>(stamp.size);
+        w.Put<uint64_t>(stamp.hash);
+    }
+
+    w.Put<uint32_t>(materials.size());
+    for (const tinyobj::material_t& material : materials)
+    {
+        for (int k = 0; k < 3; k++) w.Put<GLfloat>(material.ambient[k]);
+        for (int k = 0; k < 3; k++) w.Put<GLfloat>(material.diffuse[k]);
+        for (int k = 0; k < 3; k++) w.Put<GLfloat>(material.specular[k]);
+        w.PutString(material.diffuse_texname);
+    }
+
+    w.Put<uint64_t>(cacheStats.triangles);
+    w.Put<uint64_t>(cacheStats.vertices);
+    w.Put<uint64_t>(cacheStats.missesBefore);
+    w.Put<uint64_t>(cacheStats.missesAfter);
+
+    w.Put<uint32_t>(shapeInfo.size());
+    w.Flush(ofs);
+    for (size_t i = 0; i < shapeInfo.size() && ofs; i++)
+    {
+        const MeshCacheShape& shape = shapeInfo[i];
+        size_t vertex_count = shape.vertex_count;
+        w.Put<uint32_t>(shape.material);
+        w.Put<uint32_t>(vertex_count);
+        w.Put<uint32_t>(shape.index_count);
+        w.Put<uint32_t>(shape.index_type);
+        w.Put<uint32_t>(shape.lods.size());
+        for (const MeshLod& lod : shape.lods)
+        {
+            w.Put<uint32_t>(lod.first_index);
+            w.Put<uint32_t>(lod.index_count);
+            w.Put<GLfloat>(lod.error);
+        }
+        w.Put<uint32_t>(shape.clusters.size());
+        for (const MeshCluster& cluster : shape.clusters)
+            w.Put(cluster);
+        // reserve both first, the buffer may move on every Put
+        size_t offset = w.buf.size();
+        w.PutFloats(vertex_count * (3 + 3 + 3 + 2));
+        w.PutBytes(shape.index_count * IndexSize(shape.index_type));
+        GLfloat* vertices = (GLfloat*)&w.buf[offset];
+        fillShape(i, vertices, vertices + vertex_count * 3, vertices + vertex_count * 6, vertices + vertex_count * 9, vertices + vertex_count * 11);
+        w.Flush(ofs);
+    }
+
+    ofs.close();
+    if (!ofs)
+    {
+        remove(tmp_path.c_str());
+        return;
+    }
+    remove(cache_path.c_str());
+    if (rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+        remove(tmp_path.c_str());
+}
+
+// Returns false when there is no valid cache for the model, `out` is unchanged then.
+bool LoadMeshCache(const string& model_path, const string& base_dir, PendingModel* out)
+{
+    shared_ptr<tinyobj::MappedFile> file = make_shared<tinyobj::MappedFile>();
+    if (!file->Open(MeshCachePath(model_path).c_str()))
+        return false;
+
+    MeshCacheReader r(file->data(), file->size());
+    char magic[sizeof(MESH_CACHE_MAGIC)];
+    uint32_t version, flags;
+    uint64_t objSize, objHash;
+    if (!r.Get(&magic) || memcmp(magic, MESH_CACHE_MAGIC, sizeof(magic)) != 0 ||
+        !r.Get(&version) || version != MESH_CACHE_VERSION ||
+        !r.Get(&flags) || flags != MeshCacheFlags() ||
+        !r.Get(&objSize) || !r.Get(&objHash))
+        return false;
+
+    FileStamp objStamp;
+    if (!StampFile(model_path, &objStamp) || objStamp.size != objSize || objStamp.hash != objHash)
+        return false;
+
+    uint32_t mtlCount;
+    if (!r.Get(&mtlCount))
+        return false;
+    for (uint32_t i = 0; i < mtlCount; i++)
+    {
+        FileStamp cached, current;
+        if (!r.GetString(&cached.path) || !r.Get(&cached.size) || !r.Get(&cached.hash))
+            return false;
+        if (!StampFile(cached.path, &current) || current.size != cached.size || current.hash != cached.hash)
+            return false;
+    }
+
+    struct CachedMaterial
+    {
+        GLfloat K[9];
+        string diffuse_texname;
+    };
+    uint32_t materialCount;
+    if (!r.Get(&materialCount))
+        return false;
+    vector<CachedMaterial> cachedMaterials(materialCount);
+    for (CachedMaterial& material : cachedMaterials)
+    {
+        if (!r.Get(&material.K) || !r.GetString(&material.diffuse_texname))
+            return false;
+    }
+
+    uint64_t cacheStats[4];
+    if (!r.Get(&cacheStats))
+        return false;
+
+    uint32_t shapeCount;
+    if (!r.Get(&shapeCount))
+        return false;
+    vector<MappedShape> mappedShapes(shapeCount);
+    for (MappedShape& shape : mappedShapes)
+    {
+        if (!r.Get(&shape.material) || shape.material >= materialCount || !r.Get(&shape.vertex_count) || shape.vertex_count == 0 ||
+            !r.Get(&shape.index_count) || !r.Get(&shape.index_type) ||
+            (shape.index_type != GL_UNSIGNED_SHORT && shape.index_type != GL_UNSIGNED_INT))
+            return false;
+        uint32_t lodCount;
+        if (!r.Get(&lodCount) || lodCount > LOD_COUNT)
+            return false;
+        shape.lods.resize(lodCount);
+        for (MeshLod& lod : shape.lods)
+        {
+            if (!r.Get(&lod.first_index) || !r.Get(&lod.index_count) || !r.Get(&lod.error) ||
+                lod.first_index > shape.index_count || lod.index_count > shape.index_count - lod.first_index)
+                return false;
+        }
+        uint32_t clusterCount;
+        if (!r.Get(&clusterCount) || clusterCount > shape.index_count)
+            return false;
+        shape.clusters.resize(clusterCount);
+        for (MeshCluster& cluster : shape.clusters)
+        {
+            if (!r.Get(&cluster) || shape.lods.empty() ||
+                cluster.first_index > shape.lods[0].index_count || cluster.index_count > shape.lods[0].index_count - cluster.first_index)
+                return false;
+        }
+        shape.vertices = r.GetFloats(shape.vertex_count * 3);
+        shape.colors = r.GetFloats(shape.vertex_count * 3);
+        shape.normals = r.GetFloats(shape.vertex_count * 3);
+        shape.textureCoords = r.GetFloats(shape.vertex_count * 2);
+        shape.indices = r.GetBytes((size_t)shape.index_count * IndexSize(shape.index_type));
+        if (!shape.vertices || !shape.colors || !shape.normals || !shape.textureCoords || !shape.indices)
+            return false;
+
+        // an index past the vertices would read out of the buffer on the GPU
+        for (uint32_t i = 0; i < shape.index_count; i++)
+        {
+            uint32_t index = shape.index_type == GL_UNSIGNED_SHORT ? ((const GLushort*)shape.indices)[i] : ((const GLuint*)shape.indices)[i];
+            if (index >= shape.vertex_count)
+                return false;
+        }
+    }
+
+    // the cache is valid, decode the textures, the shapes stay in the mapped file until UploadModel()
+    vector<tinyobj::material_t> materials(cachedMaterials.size());
+    for (int i = 0; i < cachedMaterials.size(); i++)
+    {
+        const CachedMaterial& cached = cachedMaterials[i];
+        for (int k = 0; k < 3; k++)
+        {
+            materials[i].ambient[k] = cached.K[k];
+            materials[i].diffuse[k] = cached.K[3 + k];
+            materials[i].specular[k] = cached.K[6 + k];
+        }
+        materials[i].diffuse_texname = cached.diffuse_texname;
+    }
+    out->materials = DecodePhongMaterials(materials, base_dir);
+    out->cacheFile = file;
+    out->mappedShapes.swap(mappedShapes);
+
+    printf("Load Models from cache ! Shapes size %d Material size %d\n", (int)out->mappedShapes.size(), (int)cachedMaterials.size());
+    VertexCacheStats stats;
+    stats.triangles = cacheStats[0];
+    stats.vertices = cacheStats[1];
+    stats.missesBefore = cacheStats[2];
+    stats.missesAfter = cacheStats[3];
+    stats.Print(model_path);
+    LodStats lodStats;
+    for (const MappedShape& shape : out->mappedShapes)
+        lodStats.Add(shape.lods);
+    lodStats.Print(model_path);
+    return true;
+}
+//* Mesh cache *//
+
+//* Streaming loader *//
+// Loads a model without going through attrib_t, normalization(), IndexShape() and SplitShapeByMaterial(),
+// which copy every vertex several times before it reaches the GPU. Two passes:
+//   1. parse: tinyobj::LoadObjWithCallbackMapped() keeps the positions, normals and texcoords
+//      indexed, triangulates the faces into one indexed vertex list per (shape, material) and
+//      accumulates the bounding box.
+//   2. emit: every vertex is normalized and written straight into vertex buffers mapped with
+//      glMapBufferRange(). The shapes of the model are ranges of these buffers.
+// The first pass runs on a loader thread, the second one in UploadModel().
+bool streamModelLoading = true;
+
+struct StreamedShape
+{
+    int material;
+    vector<tinyobj::index_t> corners;   // unique (v, vn, vt) of the shape
+    vector<GLuint> indices;             // into corners, all levels of detail
+    vector<MeshLod> lods;
+    vector<MeshCluster> clusters;
+};
+
+struct ObjStream
+{
+    vector<tinyobj::real_t> positions;
+    vector<GLfloat> colors, normals, textureCoords;
+    vector<tinyobj::material_t> materials;
+    GLfloat minPos[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    GLfloat maxPos[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    // the finished shapes in draw order
+    vector<StreamedShape> shapes;
+    // the current shape, split by material
+    vector<StreamedShape> current;
+    vector<VertexIdMap> currentIds;
+    int material = -1;
+    bool badIndex = false;
+    string warn;
+
+    vector<tinyobj::index_t> polygon, triangles;
+
+    // layout of the buffers, set once parsed
+    GLfloat offset[3] = { 0, 0, 0 };
+    GLfloat scale = 0;
+    vector<MeshCacheShape> shapeInfo;
+    vector<GLintptr> indexOffsets;
+    size_t vertexCount = 0, indexBytes = 0;
+
+    // same order as SplitShapeByMaterial(): by shape, then by material. With mergeMaterialShapes the
+    // shapes of the .obj only stop sharing vertices, the model has one shape per material at the end.
+    void FlushShape(bool end)
+    {
+        for (VertexIdMap& ids : currentIds)
+            ids.clear();
+        if (mergeMaterialShapes && !end)
+            return;
+        for (int m = 0; m < current.size(); m++)
+        {
+            if (!current[m].indices.empty())
+            {
+                shapes.push_back(StreamedShape());
+                shapes.back().material = m;
+                shapes.back().corners.swap(current[m].corners);
+                shapes.back().indices.swap(current[m].indices);
+            }
+        }
+    }
+};
+
+static void StreamVertex(void* user_data, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t r, tinyobj::real_t g, tinyobj::real_t b)
+{
+    ObjStream* s = (ObjStream*)user_data;
+    const tinyobj::real_t p[3] = { x, y, z };
+    for (int k = 0; k < 3; k++)
+    {
+        s->positions.push_back(p[k]);
+        s->minPos[k] = min(s->minPos[k], (GLfloat)p[k]);
+        s->maxPos[k] = max(s->maxPos[k], (GLfloat)p[k]);
+    }
+    s->colors.push_back(r);
+    s->colors.push_back(g);
+    s->colors.push_back(b);
+}
+
+static void StreamNormal(void* user_data, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z)
+{
+    ObjStream* s = (ObjStream*)user_data;
+    s->normals.push_back(x);
+    s->normals.push_back(y);
+    s->normals.push_back(z);
+}
+
+static void StreamTexCoord(void* user_data, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z)
+{
+    ObjStream* s = (ObjStream*)user_data;
+    s->textureCoords.push_back(x);
+    s->textureCoords.push_back(y);
+}
+
+static void StreamFace(void* user_data, tinyobj::index_t* indices, int num_indices)
+{
+    ObjStream* s = (ObjStream*)user_data;
+    // SplitShapeByMaterial() drops the faces without material
+    if (s->badIndex || s->material < 0)
+        return;
+
+    // indices come as written in the .obj: 1 based, negative ones relative to the end, 0 if missing
+    auto fix = [](int idx, size_t count) { return idx > 0 ? idx - 1 : idx < 0 ? (int)count + idx : -1; };
+    const size_t vertex_count = s->positions.size() / 3;
+    s->polygon.resize(num_indices);
+    for (int i = 0; i < num_indices; i++)
+    {
+        tinyobj::index_t& idx = s->polygon[i];
+        idx.vertex_index = fix(indices[i].vertex_index, vertex_count);
+        idx.normal_index = fix(indices[i].normal_index, s->normals.size() / 3);
+        idx.texcoord_index = fix(indices[i].texcoord_index, s->textureCoords.size() / 2);
+        if (idx.vertex_index < 0 || idx.vertex_index >= vertex_count ||
+            idx.normal_index >= (int)(s->normals.size() / 3) || idx.texcoord_index >= (int)(s->textureCoords.size() / 2))
+        {
+            s->badIndex = true;
+            return;
+        }
+    }
+
+    s->triangles.clear();
+    tinyobj::TriangulatePolygon(s->polygon.data(), num_indices, s->positions, &s->triangles);
+    if (s->current.size() <= s->material)
+    {
+        s->current.resize(s->material + 1);
+        s->currentIds.resize(s->material + 1);
+    }
+    StreamedShape& shape = s->current[s->material];
+    VertexIdMap& ids = s->currentIds[s->material];
+    for (const tinyobj::index_t& idx : s->triangles)
+    {
+        auto found = ids.insert(make_pair(idx, (GLuint)shape.corners.size()));
+        if (found.second)
+            shape.corners.push_back(idx);
+        shape.indices.push_back(found.first->second);
+    }
+}
+
+static void StreamUseMtl(void* user_data, const char* name, int material_id)
+{
+    ObjStream* s = (ObjStream*)user_data;
+    s->material = material_id;
+    if (material_id < 0)
+        s->warn += "material [ '" + string(name) + "' ] not found in .mtl\n";
+}
+
+static void StreamMtlLib(void* user_data, const tinyobj::material_t* materials, int num_materials)
+{
+    ((ObjStream*)user_data)->materials.assign(materials, materials + num_materials);
+}
+
+static void StreamGroup(void* user_data, const char** names, int num_names)
+{
+    ((ObjStream*)user_data)->FlushShape(false);
+}
 
-                m_textureCoords.push_back(textureCoords[v * 2 + 0]);
-                m_textureCoords.push_back(textureCoords[v * 2 + 1]);
-            }
+static void StreamObject(void* user_data, const char* name)
+{
+    ((ObjStream*)user_data)->FlushShape(false);
+}
+
+// Writes the normalized vertices of `corners`, the same values as SplitShapeByMaterial() gives.
+static void EmitCorners(const ObjStream& s, const vector<tinyobj::index_t>& corners, const GLfloat offset[3], GLfloat scale,
+                        const VertexStreams& out)
+{
+    GLfloat *vertices = out.vertices, *colors = out.colors, *normals = out.normals, *textureCoords = out.textureCoords;
+    for (const tinyobj::index_t& idx : corners)
+    {
+        const size_t v = idx.vertex_index;
+        for (int k = 0; k < 3; k++)
+            vertices[k] = ((GLfloat)s.positions[v * 3 + k] - offset[k]) / scale;
+        if (colors)
+        {
+            memcpy(colors, &s.colors[v * 3], 3 * sizeof(GLfloat));
+            colors += out.colorStride;
+        }
+
+        if (idx.normal_index >= 0)
+        {
+            memcpy(normals, &s.normals[idx.normal_index * 3], 3 * sizeof(GLfloat));
+        }
+        else
+        {
+            normals[0] = 0;
+            normals[1] = 0;
+            normals[2] = 0;
+        }
+
+        if (idx.texcoord_index >= 0)
+        {
+            textureCoords[0] = s.textureCoords[idx.texcoord_index * 2 + 0];
+            textureCoords[1] = s.textureCoords[idx.texcoord_index * 2 + 1];
+        }
+        else
+        {
+            textureCoords[0] = 0;
+            textureCoords[1] = 0;
         }
 
-        if (!m_vertices.empty())
+        vertices += out.vertexStride;
+        normals += out.normalStride;
+        textureCoords += out.texCoordStride;
+    }
+}
+
+// GenerateMissingNormals() for the shapes of `s`, which leave out the faces without material.
+static void GenerateStreamNormals(ObjStream* s, const string& model_path)
+{
+    auto start = chrono::steady_clock::now();
+    vector<uint32_t> triangles;
+    for (const StreamedShape& shape : s->shapes)
+    {
+        for (size_t i = 0; i < shape.indices.size(); i += 3)
         {
-            Shape tmp_shape;
-            glGenVertexArrays(1, &tmp_shape.vao);
-            glBindVertexArray(tmp_shape.vao);
+            const tinyobj::index_t* c[3] = { &shape.corners[shape.indices[i]], &shape.corners[shape.indices[i + 1]], &shape.corners[shape.indices[i + 2]] };
+            if (c[0]->normal_index >= 0 && c[1]->normal_index >= 0 && c[2]->normal_index >= 0)
+                continue;
+            for (int k = 0; k < 3; k++)
+                triangles.push_back(c[k]->vertex_index);
+        }
+    }
+    if (triangles.empty())
+        return;
+
+    vector<GLfloat> generated;
+    size_t position_count = s->positions.size() / 3;
+    GenerateSmoothNormals(s->positions.data(), position_count, triangles, &generated);
+    int base = s->normals.size() / 3;
+    s->normals.insert(s->normals.end(), generated.begin(), generated.end());
+    // (v, -1, vt) becomes (v, base + v, vt): the corners of a shape stay unique
+    for (StreamedShape& shape : s->shapes)
+    {
+        for (tinyobj::index_t& idx : shape.corners)
+        {
+            if (idx.normal_index < 0)
+                idx.normal_index = base + idx.vertex_index;
+        }
+    }
+    printf("Normals %s: generated for %d positions from %d triangles in %.1f ms\n", model_path.c_str(), (int)position_count,
+           (int)(triangles.size() / 3), chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+}
+
+// Buffers are filled through GL_ARRAY_BUFFER, also the index buffer: binding GL_ELEMENT_ARRAY_BUFFER
+// would change the VAO which is bound.
+static GLuint CreateBuffer(size_t size, const void* data = NULL)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+    return buffer;
+}
+
+static void* MapBuffer(GLuint buffer, size_t size)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    return glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
 
-            glGenBuffers(1, &tmp_shape.vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
-            glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(GL_FLOAT), &m_vertices.at(0), GL_STATIC_DRAW);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-            tmp_shape.vertex_count = m_vertices.size() / 3;
+static bool UnmapBuffer(GLuint buffer)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    return glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+}
 
-            glGenBuffers(1, &tmp_shape.p_color);
-            glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
-            glBufferData(GL_ARRAY_BUFFER, m_colors.size() * sizeof(GL_FLOAT), &m_colors.at(0), GL_STATIC_DRAW);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+// A shape using the vertices from `first` on of the buffers of `buffers`, and `index_count`
+// indices at `index_offset` of its index buffer, holding all of its `lods`.
+Shape CreateShapeInBuffers(const Shape& buffers, int first, int vertex_count, int index_count, GLenum index_type, GLintptr index_offset,
+                           const vector<MeshLod>& lods, const vector<MeshCluster>& clusters, const PhongMaterial& material)
+{
+    Shape tmp_shape = buffers;
+    glGenVertexArrays(1, &tmp_shape.vao);
+    glBindVertexArray(tmp_shape.vao);
+
+    SetVertexAttributes(tmp_shape.vbo, first);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tmp_shape.ebo);
+
+    tmp_shape.vertex_count = vertex_count;
+    tmp_shape.indexCount = lods.empty() ? index_count : lods[0].index_count;
+    tmp_shape.indexType = index_type;
+    tmp_shape.indexOffset = index_offset;
+    tmp_shape.lods = lods;
+    tmp_shape.clusters = clusters;
+    tmp_shape.material = material;
+    return tmp_shape;
+}
 
-            glGenBuffers(1, &tmp_shape.p_normal);
-            glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_normal);
-            glBufferData(GL_ARRAY_BUFFER, m_normals.size() * sizeof(GL_FLOAT), &m_normals.at(0), GL_STATIC_DRAW);
-            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+// Returns false when the .obj can not be streamed, `out` is unchanged then.
+bool LoadStreamedModel(const string& model_path, const string& base_dir, PendingModel* out)
+{
+    shared_ptr<ObjStream> stream = make_shared<ObjStream>();
+    ObjStream& s = *stream;
+    tinyobj::callback_t cb;
+    cb.vertex_color_cb = StreamVertex;
+    cb.normal_cb = StreamNormal;
+    cb.texcoord_cb = StreamTexCoord;
+    cb.index_cb = StreamFace;
+    cb.usemtl_cb = StreamUseMtl;
+    cb.mtllib_cb = StreamMtlLib;
+    cb.group_cb = StreamGroup;
+    cb.object_cb = StreamObject;
+
+    string warn, err;
+    bool ret = tinyobj::LoadObjWithCallbackMapped(model_path.c_str(), cb, &s, base_dir.c_str(), &warn, &err);
+    s.FlushShape(true);
+    // let the full loader report the errors
+    if (!ret || !err.empty() || s.badIndex)
+        return false;
+
+    warn += s.warn;
+    if (!warn.empty()) {
+        cout << warn << std::endl;
+    }
 
-            glGenBuffers(1, &tmp_shape.p_texCoord);
-            glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_texCoord);
-            glBufferData(GL_ARRAY_BUFFER, m_textureCoords.size() * sizeof(GL_FLOAT), &m_textureCoords.at(0), GL_STATIC_DRAW);
-            glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    // same transform as normalization(): center the bounding box, longest axis from -1 to 1
+    for (int k = 0; k < 3; k++)
+    {
+        s.offset[k] = (s.maxPos[k] + s.minPos[k]) / 2;
+        s.scale = max(s.scale, (s.maxPos[k] - s.minPos[k]) / 2);
+    }
+    GenerateStreamNormals(&s, model_path);
 
-            glEnableVertexAttribArray(0);
-            glEnableVertexAttribArray(1);
-            glEnableVertexAttribArray(2);
-            glEnableVertexAttribArray(3);
+    VertexCacheStats cacheStats;
+    if (optimizeMeshes)
+    {
+        vector<GLuint> remap;
+        vector<tinyobj::index_t> corners;
+        for (StreamedShape& shape : s.shapes)
+        {
+            OptimizeMesh(shape.indices, shape.corners.size(), &remap, &cacheStats);
+            corners.resize(shape.corners.size());
+            for (size_t i = 0; i < remap.size(); i++)
+                corners[remap[i]] = shape.corners[i];
+            shape.corners.swap(corners);
+        }
+    }
 
-            tmp_shape.material = materials[m];
-            res.push_back(tmp_shape);
+    LodStats lodStats;
+    vector<GLfloat> positions;
+    for (StreamedShape& shape : s.shapes)
+    {
+        positions.resize(shape.corners.size() * 3);
+        for (size_t i = 0; i < shape.corners.size(); i++)
+        {
+            for (int k = 0; k < 3; k++)
+                positions[i * 3 + k] = ((GLfloat)s.positions[shape.corners[i].vertex_index * 3 + k] - s.offset[k]) / s.scale;
         }
+        BuildClusters(positions.data(), shape.indices, &shape.clusters);
+        BuildLods(positions.data(), shape.corners.size(), shape.indices, &shape.lods);
+        lodStats.Add(shape.lods);
     }
 
-    return res;
+    // every shape has its own index type, offsets stay 4 byte aligned
+    size_t totalIndices = 0;
+    for (const StreamedShape& shape : s.shapes)
+    {
+        GLenum index_type = IndexTypeFor(shape.corners.size());
+        s.shapeInfo.push_back({ shape.material, (int)shape.corners.size(), (int)shape.indices.size(), index_type, shape.lods, shape.clusters });
+        s.indexOffsets.push_back(s.indexBytes);
+        s.vertexCount += shape.corners.size();
+        s.indexBytes += (shape.indices.size() * IndexSize(index_type) + 3) / 4 * 4;
+        totalIndices += shape.lods[0].index_count;
+    }
+
+    printf("Stream Models Success ! Shapes size %d Material size %d\n", (int)s.shapes.size(), (int)s.materials.size());
+    printf("Indexed %d face corners into %d vertices\n", (int)totalIndices, (int)s.vertexCount);
+    cacheStats.Print(model_path);
+    lodStats.Print(model_path);
+
+    WriteMeshCache(model_path, base_dir, s.materials, cacheStats, s.shapeInfo, [&](size_t i, GLfloat* vertices, GLfloat* colors, GLfloat* normals, GLfloat* textureCoords, void* indices) {
+        EmitCorners(s, s.shapes[i].corners, s.offset, s.scale, VertexStreams::Planar(vertices, colors, normals, textureCoords));
+        StoreIndices(s.shapes[i].indices.data(), s.shapes[i].indices.size(), s.shapeInfo[i].index_type, indices);
+    });
+
+    out->materials = DecodePhongMaterials(s.materials, base_dir);
+    out->stream = stream;
+    return true;
 }
 
-void LoadTexturedModels(string model_path)
+// Second pass of the streaming loader, on the context thread.
+void UploadStreamedModel(const ObjStream& s, const string& model_path, const vector<PhongMaterial>& allMaterial, model* out,
+                         QuantizationError* error)
+{
+    if (s.vertexCount == 0)
+        return;
+
+    VertexLayout layout = GetVertexLayout();
+    size_t vertexBytes = s.vertexCount * layout.stride;
+    Shape buffers = Shape();
+    buffers.vbo = CreateBuffer(vertexBytes);
+    buffers.ebo = CreateBuffer(s.indexBytes);
+
+    // glUnmapBuffer() fails when the content got lost meanwhile(e.g. on a video mode change), write it again then
+    bool uploaded = false;
+    for (int attempt = 0; attempt < 2 && !uploaded; attempt++)
+    {
+        char* vertices = (char*)MapBuffer(buffers.vbo, vertexBytes);
+        char* indices = (char*)MapBuffer(buffers.ebo, s.indexBytes);
+        uploaded = vertices && indices;
+        if (uploaded)
+        {
+            // float vertices are written in place, quantized ones go through planar streams first
+            vector<GLfloat> planar;
+            QuantizationError retried;
+            size_t first = 0;
+            for (int i = 0; i < s.shapes.size(); i++)
+            {
+                const StreamedShape& shape = s.shapes[i];
+                if (layout.quantized)
+                {
+                    size_t count = shape.corners.size();
+                    planar.resize(count * 11);
+                    GLfloat* p = planar.data();
+                    EmitCorners(s, shape.corners, s.offset, s.scale, VertexStreams::Planar(p, p + count * 3, p + count * 6, p + count * 9));
+                    EncodeVertices(layout, count, p, p + count * 3, p + count * 6, p + count * 9, vertices + first * layout.stride,
+                                   attempt == 0 ? error : &retried);
+                }
+                else
+                {
+                    EmitCorners(s, shape.corners, s.offset, s.scale, VertexStreams::Interleaved(layout, (GLfloat*)vertices).From(first));
+                }
+                StoreIndices(shape.indices.data(), shape.indices.size(), s.shapeInfo[i].index_type, indices + s.indexOffsets[i]);
+                first += shape.corners.size();
+            }
+        }
+
+        uploaded = (vertices && UnmapBuffer(buffers.vbo)) && uploaded;
+        uploaded = (indices && UnmapBuffer(buffers.ebo)) && uploaded;
+    }
+    if (!uploaded)
+        cout << "LoadStreamedModel: Fail to upload the vertices of " << model_path << endl;
+
+    int first = 0;
+    for (int i = 0; i < s.shapes.size(); i++)
+    {
+        const MeshCacheShape& info = s.shapeInfo[i];
+        out->shapes.push_back(CreateShapeInBuffers(buffers, first, info.vertex_count, info.index_count, info.index_type, s.indexOffsets[i],
+                                                   info.lods, info.clusters, allMaterial[info.material]));
+        first += info.vertex_count;
+    }
+}
+//* Streaming loader *//
+
+// One vertex and one index buffer for all shapes of `mesh`, every shape draws its range of them.
+void UploadCachedMesh(const CachedMesh& mesh, const vector<PhongMaterial>& allMaterial, model* out, QuantizationError* error)
+{
+    // every shape has its own index type, offsets stay 4 byte aligned
+    vector<GLintptr> indexOffsets;
+    size_t indexBytes = 0;
+    for (const CachedShape& shape : mesh.shapes)
+    {
+        indexOffsets.push_back(indexBytes);
+        indexBytes += ((shape.indexCount + shape.lodIndices.size()) * IndexSize(IndexTypeFor(shape.vertexCount)) + 3) / 4 * 4;
+    }
+    vector<char> packed_indices(indexBytes);
+    for (size_t i = 0; i < mesh.shapes.size(); i++)
+    {
+        const CachedShape& shape = mesh.shapes[i];
+        StoreCachedShapeIndices(mesh, shape, IndexTypeFor(shape.vertexCount), &packed_indices[indexOffsets[i]]);
+    }
+
+    VertexLayout layout = GetVertexLayout();
+    size_t vertexCount = mesh.vertices.size() / 3;
+    vector<char> encoded(vertexCount * layout.stride);
+    EncodeVertices(layout, vertexCount, mesh.vertices.data(), mesh.colors.data(), mesh.normals.data(), mesh.textureCoords.data(), encoded.data(), error);
+
+    Shape buffers = Shape();
+    buffers.vbo = CreateBuffer(encoded.size(), encoded.data());
+    buffers.ebo = CreateBuffer(indexBytes, packed_indices.data());
+
+    for (size_t i = 0; i < mesh.shapes.size(); i++)
+    {
+        const CachedShape& shape = mesh.shapes[i];
+        out->shapes.push_back(CreateShapeInBuffers(buffers, shape.firstVertex, shape.vertexCount, shape.indexCount + shape.lodIndices.size(),
+                                                   IndexTypeFor(shape.vertexCount), indexOffsets[i], shape.lods, shape.clusters,
+                                                   allMaterial[shape.material]));
+    }
+}
+
+// Appends the corners of `index_count` indices(as `index_type`) of `positions` to `triangles`.
+static void AppendTriangles(const GLfloat* positions, const void* indices, GLenum index_type, size_t index_count, vector<GLfloat>* triangles)
+{
+    for (size_t i = 0; i < index_count; i++)
+    {
+        size_t v = index_type == GL_UNSIGNED_SHORT ? ((const GLushort*)indices)[i] : ((const GLuint*)indices)[i];
+        triangles->insert(triangles->end(), &positions[v * 3], &positions[v * 3 + 3]);
+    }
+}
+
+// The BVH of the level 0 triangles of `pending`, shape by shape in the order UploadModel() creates them.
+void BuildModelBvh(PendingModel* pending, const string& model_path)
+{
+    auto start = chrono::steady_clock::now();
+    vector<GLfloat> triangles, positions;
+    vector<uint32_t>& first = pending->shapeFirstTriangle;
+    if (pending->stream)
+    {
+        const ObjStream& s = *pending->stream;
+        for (const StreamedShape& shape : s.shapes)
+        {
+            first.push_back(triangles.size() / 9);
+            positions.resize(shape.corners.size() * 3);
+            for (size_t i = 0; i < shape.corners.size(); i++)
+            {
+                for (int k = 0; k < 3; k++)
+                    positions[i * 3 + k] = ((GLfloat)s.positions[shape.corners[i].vertex_index * 3 + k] - s.offset[k]) / s.scale;
+            }
+            AppendTriangles(positions.data(), shape.indices.data(), GL_UNSIGNED_INT, shape.lods[0].index_count, &triangles);
+        }
+    }
+    for (const MappedShape& shape : pending->mappedShapes)
+    {
+        first.push_back(triangles.size() / 9);
+        AppendTriangles(shape.vertices, shape.indices, shape.index_type, shape.lods.empty() ? shape.index_count : shape.lods[0].index_count, &triangles);
+    }
+    const CachedMesh& mesh = pending->cachedMesh;
+    for (const CachedShape& shape : mesh.shapes)
+    {
+        first.push_back(triangles.size() / 9);
+        AppendTriangles(&mesh.vertices[shape.firstVertex * 3], &mesh.indices[shape.firstIndex], GL_UNSIGNED_INT, shape.indexCount, &triangles);
+    }
+
+    pending->bvh = make_shared<Bvh>();
+    pending->bvh->Build(triangles);
+    printf("BVH %s: %d triangles, %d nodes in %.1f ms\n", model_path.c_str(), (int)pending->bvh->TriangleCount(), (int)pending->bvh->NodeCount(),
+           chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+}
+
+// Tangents of all vertices of `pending` with the level 0 triangles, shape by shape in the order
+// UploadModel() creates them. See GenerateTangents().
+void BuildModelTangents(PendingModel* pending, const string& model_path)
+{
+    auto start = chrono::steady_clock::now();
+    vector<GLfloat> vertices, normals, textureCoords;
+    vector<uint32_t> triangles;
+    auto addTriangles = [&](size_t first, const void* indices, GLenum index_type, size_t index_count) {
+        for (size_t i = 0; i < index_count; i++)
+            triangles.push_back(first + (index_type == GL_UNSIGNED_SHORT ? ((const GLushort*)indices)[i] : ((const GLuint*)indices)[i]));
+    };
+    auto addVertices = [&](size_t vertex_count, const GLfloat* v, const GLfloat* n, const GLfloat* uv) {
+        vertices.insert(vertices.end(), v, v + vertex_count * 3);
+        normals.insert(normals.end(), n, n + vertex_count * 3);
+        textureCoords.insert(textureCoords.end(), uv, uv + vertex_count * 2);
+    };
+
+    if (pending->stream)
+    {
+        const ObjStream& s = *pending->stream;
+        for (const StreamedShape& shape : s.shapes)
+        {
+            size_t first = vertices.size() / 3, count = shape.corners.size();
+            vertices.resize((first + count) * 3);
+            normals.resize((first + count) * 3);
+            textureCoords.resize((first + count) * 2);
+            EmitCorners(s, shape.corners, s.offset, s.scale, VertexStreams::Planar(&vertices[first * 3], NULL, &normals[first * 3], &textureCoords[first * 2]));
+            addTriangles(first, shape.indices.data(), GL_UNSIGNED_INT, shape.lods[0].index_count);
+        }
+    }
+    for (const MappedShape& shape : pending->mappedShapes)
+    {
+        size_t first = vertices.size() / 3;
+        addVertices(shape.vertex_count, shape.vertices, shape.normals, shape.textureCoords);
+        addTriangles(first, shape.indices, shape.index_type, shape.lods.empty() ? shape.index_count : shape.lods[0].index_count);
+    }
+    const CachedMesh& mesh = pending->cachedMesh;
+    for (const CachedShape& shape : mesh.shapes)
+    {
+        size_t first = vertices.size() / 3;
+        addVertices(shape.vertexCount, &mesh.vertices[shape.firstVertex * 3], &mesh.normals[shape.firstVertex * 3], &mesh.textureCoords[shape.firstVertex * 2]);
+        addTriangles(first, &mesh.indices[shape.firstIndex], GL_UNSIGNED_INT, shape.indexCount);
+    }
+
+    GenerateTangents(vertices.data(), normals.data(), textureCoords.data(), vertices.size() / 3, triangles, &pending->tangents);
+    printf("Tangents %s: %d vertices in %.1f ms\n", model_path.c_str(), (int)(vertices.size() / 3),
+           chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+}
+
+// CPU side of loading a model, no GL calls: safe on a loader thread.
+PendingModel PrepareTexturedModel(string model_path)
 {
     vector<tinyobj::shape_t> shapes;
     vector<tinyobj::material_t> materials;
@@ -1033,6 +4619,7 @@ void LoadTexturedModels(string model_path)
     vector<GLfloat> normals;
     vector<GLfloat> textureCoords;
     vector<int> material_id;
+    vector<GLuint> indices;
 
     string err;
     string warn;
@@ -1045,7 +4632,18 @@ void LoadTexturedModels(string model_path)
     base_dir += "/";
 #endif
 
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
+    PendingModel tmp_model;
+    tmp_model.model_path = model_path;
+    if (LoadMeshCache(model_path, base_dir, &tmp_model) ||
+        (streamModelLoading && LoadStreamedModel(model_path, base_dir, &tmp_model)))
+    {
+        BuildModelBvh(&tmp_model, model_path);
+        if (generateTangents)
+            BuildModelTangents(&tmp_model, model_path);
+        return tmp_model;
+    }
+
+    bool ret = tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
 
     if (!warn.empty()) {
         cout << warn << std::endl;
@@ -1056,53 +4654,371 @@ void LoadTexturedModels(string model_path)
     }
 
     if (!ret) {
-        exit(1);
+        tmp_model.failed = true;
+        return tmp_model;
     }
 
     printf("Load Models Success ! Shapes size %d Material size %d\n", shapes.size(), materials.size());
+    VertexCacheStats cacheStats;
+
+    normalization(&attrib);
+    GenerateMissingNormals(&attrib, shapes, model_path);
+    for (int i = 0; i < shapes.size(); i++)
+    {
+        if (!mergeMaterialShapes || i == 0)
+        {
+            vertices.clear();
+            colors.clear();
+            normals.clear();
+            textureCoords.clear();
+            material_id.clear();
+            indices.clear();
+        }
+
+        IndexShape(&attrib, vertices, colors, normals, textureCoords, material_id, indices, &shapes[i]);
+        // printf("Vertices size: %d", vertices.size() / 3);
+
+        // split current shape into multiple shapes base on material_id, all shapes at once with mergeMaterialShapes.
+        if (!mergeMaterialShapes || i + 1 == shapes.size())
+            SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, indices, materials.size(), &tmp_model.cachedMesh, &cacheStats);
+    }
+    const CachedMesh& mesh = tmp_model.cachedMesh;
+    vector<MeshCacheShape> shapeInfo;
+    size_t cornerCount = 0, vertexCount = 0;
+    LodStats lodStats;
+    for (const CachedShape& shape : mesh.shapes)
+    {
+        shapeInfo.push_back({ shape.material, (int)shape.vertexCount, (int)(shape.indexCount + shape.lodIndices.size()), IndexTypeFor(shape.vertexCount),
+                              shape.lods, shape.clusters });
+        cornerCount += shape.indexCount;
+        vertexCount += shape.vertexCount;
+        lodStats.Add(shape.lods);
+    }
+    printf("Indexed %d face corners into %d vertices\n", (int)cornerCount, (int)vertexCount);
+    cacheStats.Print(model_path);
+    lodStats.Print(model_path);
+    WriteMeshCache(model_path, base_dir, materials, cacheStats, shapeInfo, [&](size_t i, GLfloat* vertices, GLfloat* colors, GLfloat* normals, GLfloat* textureCoords, void* indices) {
+        const CachedShape& shape = mesh.shapes[i];
+        memcpy(vertices, &mesh.vertices[shape.firstVertex * 3], shape.vertexCount * 3 * sizeof(GLfloat));
+        memcpy(colors, &mesh.colors[shape.firstVertex * 3], shape.vertexCount * 3 * sizeof(GLfloat));
+        memcpy(normals, &mesh.normals[shape.firstVertex * 3], shape.vertexCount * 3 * sizeof(GLfloat));
+        memcpy(textureCoords, &mesh.textureCoords[shape.firstVertex * 2], shape.vertexCount * 2 * sizeof(GLfloat));
+        StoreCachedShapeIndices(mesh, shape, shapeInfo[i].index_type, (char*)indices);
+    });
+
+    tmp_model.materials = DecodePhongMaterials(materials, base_dir);
+    BuildModelBvh(&tmp_model, model_path);
+    if (generateTangents)
+        BuildModelTangents(&tmp_model, model_path);
+    return tmp_model;
+}
+
+// Points attribute 4 of every shape of `m` at its range of `tangents`, in one buffer for the model.
+static void UploadTangents(model* m, const vector<GLfloat>& tangents)
+{
+    glGenBuffers(1, &m->tangentBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m->tangentBuffer);
+    glBufferData(GL_ARRAY_BUFFER, tangents.size() * sizeof(GLfloat), tangents.data(), GL_STATIC_DRAW);
+    size_t first = 0;
+    for (const Shape& shape : m->shapes)
+    {
+        glBindVertexArray(shape.vao);
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(first * 4 * sizeof(GLfloat)));
+        glEnableVertexAttribArray(4);
+        first += shape.vertex_count;
+    }
+}
+
+// GL side of loading a model, on the context thread. Frees the CPU copies of `pending`.
+model UploadModel(PendingModel& pending)
+{
+    if (pending.failed)
+        exit(1);
+
     model tmp_model;
+    tmp_model.loaded = true;
+    vector<PhongMaterial> allMaterial = CreatePhongMaterials(pending.materials);
+    tmp_model.materialBuffer = UploadMaterialBlocks(allMaterial);
+    for (const PhongMaterial& material : allMaterial)
+    {
+        if (material.diffuseTexture != (GLuint)-1)
+            tmp_model.textures.push_back(material.diffuseTexture);
+    }
 
-    vector<PhongMaterial> allMaterial;
-    for (int i = 0; i < materials.size(); i++)
+    QuantizationError error;
+    if (pending.stream)
+        UploadStreamedModel(*pending.stream, pending.model_path, allMaterial, &tmp_model, &error);
+
+    for (const MappedShape& shape : pending.mappedShapes)
     {
-        PhongMaterial material;
-        material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
-        material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
-        material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
+        tmp_model.shapes.push_back(CreateShape(shape.vertex_count, shape.vertices, shape.colors, shape.normals, shape.textureCoords,
+                                               shape.index_count, shape.index_type, shape.indices, shape.lods, shape.clusters,
+                                               allMaterial[shape.material], &error));
+    }
 
-        material.diffuseTexture = LoadTextureImage(base_dir + string(materials[i].diffuse_texname));
-        if (material.diffuseTexture == -1)
+    if (!pending.cachedMesh.shapes.empty())
+        UploadCachedMesh(pending.cachedMesh, allMaterial, &tmp_model, &error);
+    error.Print(pending.model_path);
+    if (!pending.tangents.empty())
+        UploadTangents(&tmp_model, pending.tangents);
+    tmp_model.bvh = pending.bvh;
+    tmp_model.shapeFirstTriangle.swap(pending.shapeFirstTriangle);
+
+    pending = PendingModel();
+    return tmp_model;
+}
+
+void LoadTexturedModels(string model_path)
+{
+    PendingModel pending = PrepareTexturedModel(model_path);
+    models.push_back(UploadModel(pending));
+}
+
+//* Loader threads *//
+// setupRC() prepares all models of model_list at once on a pool of threads and uploads each one as
+// soon as it and the ones before it are ready, so the startup time no longer sums over the models.
+bool parallelModelLoading = true;
+
+class LoaderPool
+{
+public:
+    explicit LoaderPool(unsigned thread_count)
+    {
+        for (unsigned i = 0; i < thread_count; i++)
+            threads.push_back(thread(&LoaderPool::Run, this));
+    }
+
+    ~LoaderPool()
+    {
         {
-            cout << "LoadTexturedModels: Fail to load model's material " << i << endl;
-            system("pause");
-            
+            lock_guard<mutex> lock(m);
+            stopping = true;
         }
-        
-        allMaterial.push_back(material);
+        wake.notify_all();
+        for (thread& t : threads)
+            t.join();
     }
-    
-    for (int i = 0; i < shapes.size(); i++)
+
+    template <typename F>
+    future<typename result_of<F()>::type> Submit(F f)
+    {
+        typedef typename result_of<F()>::type R;
+        shared_ptr<packaged_task<R()>> task = make_shared<packaged_task<R()>>(f);
+        future<R> res = task->get_future();
+        {
+            lock_guard<mutex> lock(m);
+            tasks.push_back([task]() { (*task)(); });
+        }
+        wake.notify_one();
+        return res;
+    }
+
+private:
+    void Run()
     {
-        vertices.clear();
-        colors.clear();
-        normals.clear();
-        textureCoords.clear();
-        material_id.clear();
+        for (;;)
+        {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(m);
+                wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
 
-        normalization(&attrib, vertices, colors, normals, textureCoords, material_id, &shapes[i]);
-        // printf("Vertices size: %d", vertices.size() / 3);
+    vector<thread> threads;
+    deque<function<void()>> tasks;
+    mutex m;
+    condition_variable wake;
+    bool stopping = false;
+};
+
+LoaderPool& GetLoaderPool()
+{
+    static LoaderPool pool(max(1u, thread::hardware_concurrency()));
+    return pool;
+}
+
+void LoadTexturedModelsParallel(const vector<string>& model_paths)
+{
+    vector<future<PendingModel>> pending;
+    for (const string& model_path : model_paths)
+        pending.push_back(GetLoaderPool().Submit([model_path]() { return PrepareTexturedModel(model_path); }));
+
+    // models[] has the order of model_paths
+    for (future<PendingModel>& f : pending)
+    {
+        PendingModel loaded = f.get();
+        models.push_back(UploadModel(loaded));
+    }
+}
+//* Loader threads *//
+
+//* Lazy loading *//
+// With lazyModelLoading, setupRC() only loads model_list[cur_idx] before the first frame. The
+// others are loaded on the loader pool once they are next to cur_idx, and freed again when cur_idx
+// moves away. models[] has a slot per model_list entry, a placeholder cube is drawn for a slot
+// which is still loading.
+bool lazyModelLoading = true;
+// loaded models further than this from cur_idx are freed
+const int keepLoadedDistance = 2;
+
+vector<future<PendingModel>> modelLoads;    // per model_list entry, valid while loading
+
+model CreatePlaceholderModel()
+{
+    vector<GLfloat> vertices, colors, normals, textureCoords;
+    vector<GLushort> indices;
+    // a face per axis and direction, half size of a normalized model
+    for (int face = 0; face < 6; face++)
+    {
+        int axis = face / 2;
+        GLfloat sign = face % 2 ? 1.0f : -1.0f;
+        const GLfloat corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+        GLushort first = vertices.size() / 3;
+        for (int c = 0; c < 4; c++)
+        {
+            GLfloat p[3], n[3] = { 0, 0, 0 };
+            p[axis] = sign * 0.5f;
+            p[(axis + 1) % 3] = corners[c][0] * 0.5f * sign;
+            p[(axis + 2) % 3] = corners[c][1] * 0.5f;
+            n[axis] = sign;
+            vertices.insert(vertices.end(), p, p + 3);
+            normals.insert(normals.end(), n, n + 3);
+            colors.insert(colors.end(), 3, 0.6f);
+            textureCoords.insert(textureCoords.end(), 2, 0.0f);
+        }
+        const GLushort quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (GLushort i : quad)
+            indices.push_back(first + i);
+    }
+
+    // white texture, the lighting gives the color
+    PhongMaterial material = PhongMaterial();
+    material.Ka = Vector3(0.3f, 0.3f, 0.3f);
+    material.Kd = Vector3(0.6f, 0.6f, 0.6f);
+    material.Ks = Vector3(0.1f, 0.1f, 0.1f);
+    const GLubyte white[4] = { 255, 255, 255, 255 };
+    glGenTextures(1, &material.diffuseTexture);
+    glBindTexture(GL_TEXTURE_2D, material.diffuseTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    model tmp_model;
+    tmp_model.loaded = true;
+    vector<PhongMaterial> materials(1, material);
+    tmp_model.materialBuffer = UploadMaterialBlocks(materials);
+    QuantizationError error;
+    tmp_model.shapes.push_back(CreateShape(vertices.size() / 3, vertices.data(), colors.data(), normals.data(), textureCoords.data(),
+                                           indices.size(), GL_UNSIGNED_SHORT, indices.data(), vector<MeshLod>(), vector<MeshCluster>(),
+                                           materials[0], &error));
+    return tmp_model;
+}
+
+// Moves what UploadModel() made into `m`, the transform of `m` stays.
+void AdoptUploadedModel(model* m, model& loaded)
+{
+    m->shapes.swap(loaded.shapes);
+    m->textures.swap(loaded.textures);
+    m->bvh = loaded.bvh;
+    m->shapeFirstTriangle.swap(loaded.shapeFirstTriangle);
+    m->tangentBuffer = loaded.tangentBuffer;
+    m->materialBuffer = loaded.materialBuffer;
+    m->loaded = true;
+}
+
+// Deletes the GL objects of a model, its transform stays. Shapes may share buffers.
+void FreeModel(model* m)
+{
+    set<GLuint> vaos, buffers;
+    for (GLuint buffer : { m->tangentBuffer, m->materialBuffer })
+    {
+        if (buffer != 0)
+            buffers.insert(buffer);
+    }
+    for (const Shape& shape : m->shapes)
+    {
+        vaos.insert(shape.vao);
+        for (GLuint buffer : { shape.vbo, shape.ebo })
+        {
+            if (buffer != 0)
+                buffers.insert(buffer);
+        }
+    }
+    vector<GLuint> names(vaos.begin(), vaos.end());
+    glDeleteVertexArrays(names.size(), names.data());
+    names.assign(buffers.begin(), buffers.end());
+    glDeleteBuffers(names.size(), names.data());
+    for (GLuint texture : m->textures)
+        textureCache.Release(texture);
+
+    m->shapes.clear();
+    m->textures.clear();
+    m->tangentBuffer = 0;
+    m->materialBuffer = 0;
+    m->loaded = false;
+}
+
+// steps between two entries of model_list, Z/X wrap around
+static int ModelDistance(int a, int b)
+{
+    int n = model_list.size();
+    int d = abs(a - b) % n;
+    return min(d, n - d);
+}
+
+// Starts loading model_list[idx] on the loader pool unless it is loaded or loading.
+void RequestModel(int idx)
+{
+    if (models[idx].loaded || modelLoads[idx].valid())
+        return;
+    string model_path = model_list[idx];
+    modelLoads[idx] = GetLoaderPool().Submit([model_path]() { return PrepareTexturedModel(model_path); });
+}
 
-        // split current shape into multiple shapes base on material_id.
-        vector<Shape> splitedShapeByMaterial = SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, allMaterial);
+// Once per frame: uploads the finished models, prefetches the neighbours of cur_idx and frees the far ones.
+void UpdateLazyModels()
+{
+    for (int i = 0; i < model_list.size(); i++)
+    {
+        if (modelLoads[i].valid() && modelLoads[i].wait_for(chrono::seconds(0)) == future_status::ready)
+        {
+            PendingModel pending = modelLoads[i].get();
+            model loaded = UploadModel(pending);
+            AdoptUploadedModel(&models[i], loaded);
+        }
+    }
+
+    RequestModel(cur_idx);
+    RequestModel((cur_idx + 1) % model_list.size());
+    RequestModel((cur_idx - 1 + model_list.size()) % model_list.size());
 
-        // concatenate splited shape to model's shape list
-        tmp_model.shapes.insert(tmp_model.shapes.end(), splitedShapeByMaterial.begin(), splitedShapeByMaterial.end());
+    for (int i = 0; i < model_list.size(); i++)
+    {
+        if (models[i].loaded && ModelDistance(i, cur_idx) > keepLoadedDistance)
+            FreeModel(&models[i]);
     }
-    shapes.clear();
-    materials.clear();
-    models.push_back(tmp_model);
 }
 
+// Loads only model_list[cur_idx] now, the rest follows from UpdateLazyModels().
+void LoadTexturedModelsLazy()
+{
+    models.resize(model_list.size());
+    modelLoads.resize(model_list.size());
+    placeholderModel = CreatePlaceholderModel();
+
+    PendingModel pending = PrepareTexturedModel(model_list[cur_idx]);
+    model loaded = UploadModel(pending);
+    AdoptUploadedModel(&models[cur_idx], loaded);
+    UpdateLazyModels();
+}
+//* Lazy loading *//
+
 void initParameter()
 {
     proj.left = -1;
@@ -1154,54 +5070,83 @@ void initParameter()
     setPerspective();    //set default projection matrix as perspective matrix
 }
 
-void setUniformVariables()
+void setUniformVariables(GLuint program, Uniform* uniform)
 {
-    iLocP = glGetUniformLocation(program, "um4p");
-    iLocV = glGetUniformLocation(program, "um4v");
-    iLocM = glGetUniformLocation(program, "um4m");
+    uniform->iLocP = glGetUniformLocation(program, "um4p");
+    uniform->iLocV = glGetUniformLocation(program, "um4v");
+    uniform->iLocM = glGetUniformLocation(program, "um4m");
+    uniform->iLocN = glGetUniformLocation(program, "um3n");
+    uniform->iLocFirstView = glGetUniformLocation(program, "firstView");
 
-    uniform.iLocCameraPosition = glGetUniformLocation(program, "cameraPosition");
+    // lights, camera and materials are uniform blocks
+    BindUniformBlocks(program);
 
-    uniform.iLocMaterial.iLocKa = glGetUniformLocation(program, "material.Ka");
-    uniform.iLocMaterial.iLocKd = glGetUniformLocation(program, "material.Kd");
-    uniform.iLocMaterial.iLocKs = glGetUniformLocation(program, "material.Ks");
-
-    uniform.iLocLightInfo.iLocPosition = glGetUniformLocation(program, "lightSources.position");
-    uniform.iLocLightInfo.iLocAmbient = glGetUniformLocation(program, "lightSources.ambient");
-    uniform.iLocLightInfo.iLocDiffuse = glGetUniformLocation(program, "lightSources.diffuse");
-    uniform.iLocLightInfo.iLocSpecular = glGetUniformLocation(program, "lightSources.specular");
-    uniform.iLocLightInfo.iLocConstantAttenuation =  glGetUniformLocation(program, "lightSources.constAttenuation");
-    uniform.iLocLightInfo.iLocLinearAttenuation =    glGetUniformLocation(program, "lightSources.linearAttenuation");
-    uniform.iLocLightInfo.iLocQuadraticAttenuation = glGetUniformLocation(program, "lightSources.quadraticAttenuation");
+    // [TODO] Get uniform location of texture
+    uniform->iLocDiffuseTexture = glGetUniformLocation(program, "diffuseTexture");
+    uniform->iLocOffsetX = glGetUniformLocation(program, "offsetX");
+    uniform->iLocOffsetY = glGetUniformLocation(program, "offsetY");
+}
 
-    uniform.iLocSpotLight.iLocSpotDirection = glGetUniformLocation(program, "spotLightInfo.spotDirection");
-    uniform.iLocSpotLight.iLocSpotExponent =  glGetUniformLocation(program, "spotLightInfo.spotExponent");
-    uniform.iLocSpotLight.iLocSpotCutOff =    glGetUniformLocation(program, "spotLightInfo.spotCutOff");
+//* Shader permutations *//
+// Instead of branching on the light mode and the lighting at run time, the shaders are compiled
+// once per combination with #defines, so a program only has the lighting it draws with.
+unordered_map<int, ShaderProgram> shaderPrograms;
 
-    uniform.iLocCurLightMode = glGetUniformLocation(program, "curLightMode");
-    uniform.iLocShininess = glGetUniformLocation(program, "shininess");
-    uniform.iLocIsPerPixLighting = glGetUniformLocation(program, "isPerPixLighting");
-    
-    // [TODO] Get uniform location of texture
-    uniform.iLocDiffuseTexture = glGetUniformLocation(program, "diffuseTexture");
-    uniform.iLocIsEye = glGetUniformLocation(program, "isEye");
-    uniform.iLocOffsetX = glGetUniformLocation(program, "offsetX");
-    uniform.iLocOffsetY = glGetUniformLocation(program, "offsetY");
+// The program of `light_mode` (like curLightMode), `lighting` (ShaderLighting) and texture coordinates
+// with or without the eye offset, compiled on first use.
+const ShaderProgram& GetShaderProgram(int light_mode, int lighting, bool eye_offset)
+{
+    int key = (light_mode * 3 + lighting) * 2 + eye_offset;
+    auto it = shaderPrograms.find(key);
+    if (it != shaderPrograms.end())
+        return it->second;
+
+    char defines[128];
+    snprintf(defines, sizeof(defines), "#define LIGHT_MODE %d\n#define LIGHTING %d\n#define EYE_OFFSET %d\n", light_mode, lighting,
+             (int)eye_offset);
+    ShaderProgram& shader = shaderPrograms[key];
+    shader.program = CompileProgram(defines);
+    setUniformVariables(shader.program, &shader.uniform);
+    return shader;
 }
+//* Shader permutations *//
 
 void setupRC()
 {
     // setup shaders
     setShaders();
     initParameter();
-    setUniformVariables();
+    SetupUniformBlocks();
+    CreateSamplers();
 
     // OpenGL States and Values
     glClearColor(0.2, 0.2, 0.2, 1.0);
 
-    for (string model_path : model_list){
-        LoadTexturedModels(model_path);
+    // planar float streams took 3 + 3 + 3 + 2 floats in 4 buffers
+    printf("Vertex layout: %d bytes/vertex in 1 buffer, was 44 bytes/vertex in 4 buffers\n", GetVertexLayout().stride);
+
+    auto load_start = chrono::steady_clock::now();
+    // once for all loader threads, stbi keeps it in a global
+    stbi_set_flip_vertically_on_load(true);
+    if (lazyModelLoading)
+    {
+        LoadTexturedModelsLazy();
+        printf("Load first model in %.1f ms\n", chrono::duration<double, milli>(chrono::steady_clock::now() - load_start).count());
+        textureCache.PrintStats();
+        return;
+    }
+    else if (parallelModelLoading)
+    {
+        LoadTexturedModelsParallel(model_list);
+    }
+    else
+    {
+        for (string model_path : model_list){
+            LoadTexturedModels(model_path);
+        }
     }
+    printf("Load %d models in %.1f ms\n", (int)model_list.size(), chrono::duration<double, milli>(chrono::steady_clock::now() - load_start).count());
+    textureCache.PrintStats();
 }
 
 void glPrintContextInfo(bool printExtension)
@@ -1225,6 +5170,11 @@ void glPrintContextInfo(bool printExtension)
 
 int main(int argc, char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "--bench-normalization") == 0)
+    {
+        BenchmarkNormalization(argc > 2 ? strtoul(argv[2], NULL, 10) : 10000000);
+        return 0;
+    }
 
     // initial glfw
     glfwInit();
@@ -1265,20 +5215,36 @@ int main(int argc, char **argv)
 
     glfwSetFramebufferSizeCallback(window, ChangeSize);
     glEnable(GL_DEPTH_TEST);
+    // the side by side views clip at the middle of the window, see shader.vs.glsl
+    glEnable(GL_CLIP_DISTANCE0);
     // Setup render context
     setupRC();
 
     // main loop
     while (!glfwWindowShouldClose(window))
     {
+        if (lazyModelLoading)
+            UpdateLazyModels();
+
         // render
+        glState.BeginFrame();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-        // render left view
-        glViewport(0, 0, screenWidth / 2, screenHeight);
-        RenderScene(1);
-        // render right view
-        glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
-        RenderScene(0);
+        if (sideBySideRendering)
+        {
+            // render both views, each instance lands in its half of the viewport
+            glViewport(0, 0, screenWidth / 2 * 2, screenHeight);
+            RenderScene(1, true);
+        }
+        else
+        {
+            // render left view
+            glViewport(0, 0, screenWidth / 2, screenHeight);
+            RenderScene(1);
+            // render right view
+            glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
+            RenderScene(0);
+        }
+        glState.EndFrame();
         
         // swap buffer from back to front
         glfwSwapBuffers(window);
@@ -1,14 +1,23 @@
 #version 330
 
+// LIGHT_MODE, LIGHTING and EYE_OFFSET are defined by GetShaderProgram(), see shader.vs.glsl
+#define PER_VERTEX_LIGHTING 0
+#define PER_PIXEL_LIGHTING 1
+#define SIDE_BY_SIDE_LIGHTING 2
+
 in vec2 texCoord;
-in vec3 vertex_color;
 in vec3 vertex_normal;
 in vec3 vertex_pos;
+#if LIGHTING != PER_PIXEL_LIGHTING
+in vec3 vertex_color;
+#endif
+#if LIGHTING == SIDE_BY_SIDE_LIGHTING
+flat in int perPixelLighting;
+#endif
 
 out vec4 fragColor;
 
 const float PI = 3.14159265359;
-uniform vec3 cameraPosition;
 
 struct PhongMaterial
 {
@@ -16,7 +25,6 @@ struct PhongMaterial
     vec3 Kd;
     vec3 Ks;
 };
-uniform PhongMaterial material;
 
 struct LightInfo
 {
@@ -28,7 +36,6 @@ struct LightInfo
     float linearAttenuation;
     float quadraticAttenuation;
 };
-uniform LightInfo lightSources;
 
 struct SpotLightInfo
 {
@@ -36,16 +43,30 @@ struct SpotLightInfo
     float spotExponent;
     float spotCutOff;
 };
-uniform SpotLightInfo spotLightInfo;
 
-uniform int curLightMode;
-uniform float shininess;
-uniform int isPerPixLighting;
+// std140 blocks, the same in both shaders: FrameBlock and LightBlock are written by RenderScene(),
+// MaterialBlock is a range of the uniform buffer of the model
+layout (std140) uniform FrameBlock
+{
+    vec3 cameraPosition;
+    float shininess;
+};
+
+layout (std140) uniform LightBlock
+{
+    LightInfo lightSources;
+    SpotLightInfo spotLightInfo;
+};
+
+layout (std140) uniform MaterialBlock
+{
+    PhongMaterial material;
+    int isEye;
+};
 
 // [TODO] passing texture from main.cpp
 // Hint: sampler2D
 uniform sampler2D diffuseTexture;
-uniform int isEye;
 uniform float offsetX;
 uniform float offsetY;
 
@@ -108,22 +129,33 @@ vec3 spotLight(vec3 vertexPosition, vec3 vertexNormal)
     return ambient + spotEffect * f_att * (diffuse + specular);
 }
 
+vec3 light(vec3 vertexPosition, vec3 vertexNormal)
+{
+#if LIGHT_MODE == 0
+    return directionalLight(vertexPosition, vertexNormal);
+#elif LIGHT_MODE == 1
+    return positionLight(vertexPosition, vertexNormal);
+#else
+    return spotLight(vertexPosition, vertexNormal);
+#endif
+}
+
 void main() {
     //fragColor = vec4(texCoord.xy, 0, 1);
     
-    vec3 color;
-    if (curLightMode == 0)
-       color = directionalLight(vertex_pos, vertex_normal);
-    else if (curLightMode == 1)
-       color = positionLight(vertex_pos, vertex_normal);
-    else if (curLightMode == 2)
-       color = spotLight(vertex_pos, vertex_normal);
-    fragColor = (isPerPixLighting == 1) ? vec4(color, 1.0f) : vec4(vertex_color, 1.0f);
+#if LIGHTING == PER_VERTEX_LIGHTING
+    fragColor = vec4(vertex_color, 1.0f);
+#elif LIGHTING == PER_PIXEL_LIGHTING
+    fragColor = vec4(light(vertex_pos, vertex_normal), 1.0f);
+#else
+    fragColor = (perPixelLighting == 1) ? vec4(light(vertex_pos, vertex_normal), 1.0f) : vec4(vertex_color, 1.0f);
+#endif
     
     // [TODO] sampleing from texture
     // Hint: texture
-    if (isEye == 0)
-        fragColor *= texture(diffuseTexture, texCoord);
-    else
-        fragColor *= texture(diffuseTexture, texCoord + vec2(offsetX, offsetY));
+#if EYE_OFFSET
+    fragColor *= texture(diffuseTexture, texCoord + vec2(offsetX, offsetY));
+#else
+    fragColor *= texture(diffuseTexture, texCoord);
+#endif
 }
@@ -1,19 +1,36 @@
 #version 330
 
+// GetShaderProgram() defines LIGHT_MODE (0 directional, 1 point, 2 spot), LIGHTING and EYE_OFFSET
+// after the #version line, each combination is a program of its own
+#define PER_VERTEX_LIGHTING 0
+#define PER_PIXEL_LIGHTING 1
+// both views in one draw: instance 0 lit per vertex in the left half, instance 1 per pixel in the right
+#define SIDE_BY_SIDE_LIGHTING 2
+
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 layout (location = 2) in vec3 aNormal;
 layout (location = 3) in vec2 aTexCoord;
 
 out vec3 vertex_pos;
-out vec3 vertex_color;
 out vec3 vertex_normal;
 out vec2 texCoord;
+#if LIGHTING != PER_PIXEL_LIGHTING
+out vec3 vertex_color;
+#endif
+#if LIGHTING == SIDE_BY_SIDE_LIGHTING
+flat out int perPixelLighting;
+#endif
 
 uniform mat4 um4p;
 uniform mat4 um4v;
 uniform mat4 um4m;
-uniform vec3 cameraPosition;
+// mat3(transpose(inverse(um4m))), once per draw on the CPU
+uniform mat3 um3n;
+#if LIGHTING == SIDE_BY_SIDE_LIGHTING
+// view of instance 0, the multi-draws of culled clusters draw one view at a time
+uniform int firstView;
+#endif
 
 const float PI = 3.14159265359;
 
@@ -23,7 +40,6 @@ struct PhongMaterial
     vec3 Kd;
     vec3 Ks;
 };
-uniform PhongMaterial material;
 
 struct LightInfo
 {
@@ -35,7 +51,6 @@ struct LightInfo
     float linearAttenuation;
     float quadraticAttenuation;
 };
-uniform LightInfo lightSources;
 
 struct SpotLightInfo
 {
@@ -43,10 +58,26 @@ struct SpotLightInfo
     float spotExponent;
     float spotCutOff;
 };
-uniform SpotLightInfo spotLightInfo;
 
-uniform int curLightMode;
-uniform float shininess;
+// std140 blocks, the same in both shaders: FrameBlock and LightBlock are written by RenderScene(),
+// MaterialBlock is a range of the uniform buffer of the model
+layout (std140) uniform FrameBlock
+{
+    vec3 cameraPosition;
+    float shininess;
+};
+
+layout (std140) uniform LightBlock
+{
+    LightInfo lightSources;
+    SpotLightInfo spotLightInfo;
+};
+
+layout (std140) uniform MaterialBlock
+{
+    PhongMaterial material;
+    int isEye;
+};
 
 vec3 directionalLight(vec3 vertexPosition, vec3 vertexNormal)
 {
@@ -106,23 +137,40 @@ vec3 spotLight(vec3 vertexPosition, vec3 vertexNormal)
         spotEffect = pow(max(vd, 0.0f), spotLightInfo.spotExponent);
     return ambient + spotEffect * f_att * (diffuse + specular);
 }
+
+vec3 light(vec3 vertexPosition, vec3 vertexNormal)
+{
+#if LIGHT_MODE == 0
+    return directionalLight(vertexPosition, vertexNormal);
+#elif LIGHT_MODE == 1
+    return positionLight(vertexPosition, vertexNormal);
+#else
+    return spotLight(vertexPosition, vertexNormal);
+#endif
+}
 // [TODO] passing uniform variable for texture coordinate offset
 
 void main()
 {
     // [TODO]
     gl_Position = um4p * um4v * um4m * vec4(aPos, 1.0);
+    gl_ClipDistance[0] = 1.0;
+#if LIGHTING == SIDE_BY_SIDE_LIGHTING
+    // view 0 is squeezed into the left half, view 1 into the right half, the clip distance cuts at
+    // the middle
+    int view = firstView + gl_InstanceID;
+    float side = (view == 0) ? -1.0 : 1.0;
+    gl_Position.x = 0.5 * (gl_Position.x + side * gl_Position.w);
+    gl_ClipDistance[0] = side * gl_Position.x;
+    perPixelLighting = view;
+#endif
     vertex_pos = vec3(um4m * vec4(aPos, 1.0f));
-    vertex_normal = mat3(transpose(inverse(um4m))) * aNormal;
-
-    vec3 color;
+    vertex_normal = um3n * aNormal;
 
-    if (curLightMode == 0)
-       color = directionalLight(vertex_pos, vertex_normal);
-    else if (curLightMode == 1)
-       color = positionLight(vertex_pos, vertex_normal);
-    else if (curLightMode == 2)
-       color = spotLight(vertex_pos, vertex_normal);
-    vertex_color = color;
+#if LIGHTING == PER_VERTEX_LIGHTING
+    vertex_color = light(vertex_pos, vertex_normal);
+#elif LIGHTING == SIDE_BY_SIDE_LIGHTING
+    vertex_color = (perPixelLighting == 1) ? vec3(0.0f) : light(vertex_pos, vertex_normal);
+#endif
     texCoord = aTexCoord;
 }
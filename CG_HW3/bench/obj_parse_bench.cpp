@@ -0,0 +1,297 @@
+// Microbenchmark of the number parsing of tiny_obj_loader.h.
+//
+// Runs the `v`/`vn`/`vt`/`f` lines of the given .obj files through the
+// current parseReal/parseTriple and through the digit by digit versions they
+// replaced, and prints the throughput in MB/s.
+//
+//   g++ -O2 -std=c++11 obj_parse_bench.cpp -o obj_parse_bench
+//   ./obj_parse_bench ../../CG_HW1/ColorModels/*.obj ../TextureModels/*.obj
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../OpenGLFramework-Xcode/tiny_obj_loader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace legacy {
+
+using tinyobj::real_t;
+
+static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+  if (s >= s_end) {
+    return false;
+  }
+
+  double mantissa = 0.0;
+  int exponent = 0;
+  char sign = '+';
+  char exp_sign = '+';
+  char const *curr = s;
+  int read = 0;
+  bool end_not_reached = false;
+  bool leading_decimal_dots = false;
+
+  if (*curr == '+' || *curr == '-') {
+    sign = *curr;
+    curr++;
+    if ((curr != s_end) && (*curr == '.')) {
+      leading_decimal_dots = true;
+    }
+  } else if (IS_DIGIT(*curr)) {
+  } else if (*curr == '.') {
+    leading_decimal_dots = true;
+  } else {
+    goto fail;
+  }
+
+  end_not_reached = (curr != s_end);
+  if (!leading_decimal_dots) {
+    while (end_not_reached && IS_DIGIT(*curr)) {
+      mantissa *= 10;
+      mantissa += static_cast<int>(*curr - 0x30);
+      curr++;
+      read++;
+      end_not_reached = (curr != s_end);
+    }
+    if (read == 0) goto fail;
+  }
+
+  if (!end_not_reached) goto assemble;
+
+  if (*curr == '.') {
+    curr++;
+    read = 1;
+    end_not_reached = (curr != s_end);
+    while (end_not_reached && IS_DIGIT(*curr)) {
+      static const double pow_lut[] = {
+          1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+      };
+      const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+      mantissa += static_cast<int>(*curr - 0x30) *
+                  (read < lut_entries ? pow_lut[read] : std::pow(10.0, -read));
+      read++;
+      curr++;
+      end_not_reached = (curr != s_end);
+    }
+  } else if (*curr == 'e' || *curr == 'E') {
+  } else {
+    goto assemble;
+  }
+
+  if (!end_not_reached) goto assemble;
+
+  if (*curr == 'e' || *curr == 'E') {
+    curr++;
+    end_not_reached = (curr != s_end);
+    if (end_not_reached && (*curr == '+' || *curr == '-')) {
+      exp_sign = *curr;
+      curr++;
+    } else if (IS_DIGIT(*curr)) {
+    } else {
+      goto fail;
+    }
+
+    read = 0;
+    end_not_reached = (curr != s_end);
+    while (end_not_reached && IS_DIGIT(*curr)) {
+      exponent *= 10;
+      exponent += static_cast<int>(*curr - 0x30);
+      curr++;
+      read++;
+      end_not_reached = (curr != s_end);
+    }
+    exponent *= (exp_sign == '+' ? 1 : -1);
+    if (read == 0) goto fail;
+  }
+
+assemble:
+  *result = (sign == '+' ? 1 : -1) *
+            (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent)
+                      : mantissa);
+  return true;
+fail:
+  return false;
+}
+
+static inline real_t parseReal(const char **token, double default_value = 0.0) {
+  (*token) += strspn((*token), " \t");
+  const char *end = (*token) + strcspn((*token), " \t\r\n");
+  double val = default_value;
+  tryParseDouble((*token), end, &val);
+  real_t f = static_cast<real_t>(val);
+  (*token) = end;
+  return f;
+}
+
+static inline int atoiLine(const char *s) {
+  s += strspn(s, " \t");
+  return IS_NEW_LINE(*s) ? 0 : atoi(s);
+}
+
+static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
+                        tinyobj::vertex_index_t *ret) {
+  tinyobj::vertex_index_t vi(-1);
+
+  if (!tinyobj::fixIndex(atoiLine((*token)), vsize, &(vi.v_idx))) {
+    return false;
+  }
+
+  (*token) += strcspn((*token), "/ \t\r\n");
+  if ((*token)[0] != '/') {
+    (*ret) = vi;
+    return true;
+  }
+  (*token)++;
+
+  if ((*token)[0] == '/') {
+    (*token)++;
+    if (!tinyobj::fixIndex(atoiLine((*token)), vnsize, &(vi.vn_idx))) {
+      return false;
+    }
+    (*token) += strcspn((*token), "/ \t\r\n");
+    (*ret) = vi;
+    return true;
+  }
+
+  if (!tinyobj::fixIndex(atoiLine((*token)), vtsize, &(vi.vt_idx))) {
+    return false;
+  }
+
+  (*token) += strcspn((*token), "/ \t\r\n");
+  if ((*token)[0] != '/') {
+    (*ret) = vi;
+    return true;
+  }
+
+  (*token)++;
+  if (!tinyobj::fixIndex(atoiLine((*token)), vnsize, &(vi.vn_idx))) {
+    return false;
+  }
+  (*token) += strcspn((*token), "/ \t\r\n");
+
+  (*ret) = vi;
+  return true;
+}
+
+}  // namespace legacy
+
+struct LegacyParser {
+  static tinyobj::real_t Real(const char **token) {
+    return legacy::parseReal(token);
+  }
+  static bool Triple(const char **token, int n, tinyobj::vertex_index_t *vi) {
+    return legacy::parseTriple(token, n, n, n, vi);
+  }
+};
+
+struct CurrentParser {
+  static tinyobj::real_t Real(const char **token) {
+    return tinyobj::parseReal(token);
+  }
+  static bool Triple(const char **token, int n, tinyobj::vertex_index_t *vi) {
+    return tinyobj::parseTriple(token, n, n, n, vi);
+  }
+};
+
+// Parses every number of the `v`/`vn`/`vt`/`f` lines into `reals`/`indices`.
+template <typename Parser>
+static void ParseNumbers(const std::string &text,
+                         std::vector<tinyobj::real_t> *reals,
+                         std::vector<int> *indices) {
+  const int kNumVertices = 1 << 30;  // avoid out of range negative indices
+  const char *p = text.c_str();
+  const char *end = p + text.size();
+  while (p < end) {
+    const char *token = p + strspn(p, " \t");
+    if (token[0] == 'v' || token[0] == 'f') {
+      const bool is_face = (token[0] == 'f');
+      token += (token[0] == 'v' && !IS_SPACE(token[1])) ? 2 : 1;
+      token += strspn(token, " \t");
+      if (is_face) {
+        while (!IS_NEW_LINE(token[0])) {
+          tinyobj::vertex_index_t vi;
+          if (!Parser::Triple(&token, kNumVertices, &vi)) break;
+          indices->push_back(vi.v_idx);
+          indices->push_back(vi.vt_idx);
+          indices->push_back(vi.vn_idx);
+          token += strspn(token, " \t\r");
+        }
+      } else {
+        while (!IS_NEW_LINE(token[0])) {
+          reals->push_back(Parser::Real(&token));
+          token += strspn(token, " \t");
+        }
+      }
+    }
+    const char *nl =
+        static_cast<const char *>(memchr(p, '\n', size_t(end - p)));
+    p = nl ? nl + 1 : end;
+  }
+}
+
+// Returns the MB/s of the best of a few runs.
+template <typename Parser>
+static double Measure(const std::string &text,
+                      std::vector<tinyobj::real_t> *reals,
+                      std::vector<int> *indices) {
+  double best = 1e30;
+  for (int i = 0; i < 5; i++) {
+    reals->clear();
+    indices->clear();
+    std::chrono::steady_clock::time_point t0 =
+        std::chrono::steady_clock::now();
+    ParseNumbers<Parser>(text, reals, indices);
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    best = std::min(best, dt.count());
+  }
+  return text.size() / best / (1024.0 * 1024.0);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage: %s model.obj ...\n", argv[0]);
+    return 1;
+  }
+
+  printf("%-40s %9s %12s %12s %8s %s\n", "file", "MB", "legacy MB/s",
+         "current MB/s", "speedup", "differing reals");
+  for (int i = 1; i < argc; i++) {
+    std::ifstream ifs(argv[i], std::ios::binary);
+    if (!ifs) {
+      printf("%-40s cannot open\n", argv[i]);
+      continue;
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    const std::string text = ss.str();
+
+    std::vector<tinyobj::real_t> legacy_reals, current_reals;
+    std::vector<int> legacy_indices, current_indices;
+    double legacy_mbs =
+        Measure<LegacyParser>(text, &legacy_reals, &legacy_indices);
+    double current_mbs =
+        Measure<CurrentParser>(text, &current_reals, &current_indices);
+
+    // The current parser rounds correctly, the legacy one may be an ulp off.
+    size_t num_diff = 0;
+    for (size_t k = 0; k < legacy_reals.size() && k < current_reals.size();
+         k++) {
+      num_diff += (legacy_reals[k] != current_reals[k]);
+    }
+    if (legacy_reals.size() != current_reals.size() ||
+        legacy_indices != current_indices) {
+      printf("%-40s MISMATCH\n", argv[i]);
+      continue;
+    }
+
+    printf("%-40s %9.2f %12.1f %12.1f %7.2fx %zu/%zu\n", argv[i],
+           text.size() / (1024.0 * 1024.0), legacy_mbs, current_mbs,
+           current_mbs / legacy_mbs, num_diff, current_reals.size());
+  }
+
+  return 0;
+}